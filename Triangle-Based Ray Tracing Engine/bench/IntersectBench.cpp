@@ -0,0 +1,118 @@
+// Ray / triangle intersection microbenchmark.
+// "before": Cramer's rule through FaceIndex style vertex indirection (the original renderer loop)
+// "after":  Möller–Trumbore over the pre-subtracted SoA TriangleBuffer, one kernel per SIMD level
+//
+// Usage: intersect_bench [triangles] [rays]
+
+#include "Ray.h"
+#include "TriangleBuffer.h"
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+namespace
+{
+    struct Soup
+    {
+        std::vector<Vec3> vertices;
+        std::vector<std::array<int, 3>> faces;
+        TriangleBuffer buffer;
+    };
+
+    // Small random triangles in the unit cube, vertices shared through an index list
+    Soup makeSoup(int triangleCount, std::mt19937& rng)
+    {
+        std::uniform_real_distribution<float> pos(0.0f, 1.0f), offset(-0.05f, 0.05f);
+        Soup soup;
+
+        for (int i = 0; i < triangleCount; ++i)
+        {
+            Vec3 c(pos(rng), pos(rng), pos(rng));
+            int base = static_cast<int>(soup.vertices.size());
+            for (int k = 0; k < 3; ++k)
+            {
+                soup.vertices.push_back(c + Vec3(offset(rng), offset(rng), offset(rng)));
+            }
+            soup.faces.push_back({base + 2, base, base + 1}); // indices out of order like a real mesh
+        }
+
+        soup.buffer.reserve(triangleCount);
+        for (const auto& f : soup.faces)
+        {
+            soup.buffer.add(soup.vertices[f[0]], soup.vertices[f[1]], soup.vertices[f[2]]);
+        }
+        soup.buffer.finalize();
+        return soup;
+    }
+
+    double seconds(std::chrono::high_resolution_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    int triangleCount = argc > 1 ? std::atoi(argv[1]) : 100000;
+    int rayCount = argc > 2 ? std::atoi(argv[2]) : 2000;
+
+    std::mt19937 rng(1234);
+    Soup soup = makeSoup(triangleCount, rng);
+
+    std::uniform_real_distribution<float> pos(0.0f, 1.0f);
+    std::vector<Ray> rays;
+    for (int i = 0; i < rayCount; ++i)
+    {
+        Vec3 o(pos(rng) * 3.0f - 1.0f, pos(rng) * 3.0f - 1.0f, -1.0f);
+        Vec3 target(pos(rng), pos(rng), pos(rng));
+        rays.push_back(Ray(o, (target - o).normalized()));
+    }
+
+    double tests = static_cast<double>(triangleCount) * rayCount;
+    std::printf("%d triangles x %d rays\n", triangleCount, rayCount);
+
+    // Before: indexed vertices and Cramer's rule, one triangle per call
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        long long hits = 0;
+        for (const Ray& ray : rays)
+        {
+            Vec3 o = ray.getOrigin(), d = ray.getDirection();
+            for (const auto& f : soup.faces)
+            {
+                float t, beta, gamma;
+                if (intersectRayWithTriangle(o, d, soup.vertices[f[0]], soup.vertices[f[1]], soup.vertices[f[2]], t, beta, gamma))
+                    hits++;
+            }
+        }
+        double time = seconds(start);
+        std::printf("  %-8s width %2d  %8.1f Mtri/s  (%lld hits)\n", "cramer", 1, tests / time * 1e-6, hits);
+    }
+
+    // After: every kernel the CPU supports
+    SimdLevel best = detectSimdLevel();
+    for (int level = SIMD_SCALAR; level <= best; ++level)
+    {
+        const TriangleKernel& kernel = getTriangleKernel(static_cast<SimdLevel>(level));
+        float t[16], beta[16], gamma[16];
+
+        auto start = std::chrono::high_resolution_clock::now();
+        long long hits = 0;
+        for (const Ray& ray : rays)
+        {
+            Vec3 o = ray.getOrigin(), d = ray.getDirection();
+            for (int first = 0; first < triangleCount; first += kernel.width)
+            {
+                int count = std::min(kernel.width, triangleCount - first);
+                hits += __builtin_popcount(kernel.intersect(soup.buffer, first, count, o, d, 0.0f, 1e30f, t, beta, gamma));
+            }
+        }
+        double time = seconds(start);
+        std::printf("  %-8s width %2d  %8.1f Mtri/s  (%lld hits)\n", kernel.name, kernel.width, tests / time * 1e-6, hits);
+    }
+
+    return 0;
+}
@@ -0,0 +1,152 @@
+// Scene geometry parsing benchmark on generated <vertexdata> and <faces> text.
+// "before": istringstream extraction and sscanf per face token (the original XMLParser loops)
+// "after":  GeometryText, count-then-fill with std::from_chars, on 1 and on N threads
+//
+// Usage: parse_bench [megabytes] [threads]
+
+#include "GeometryText.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    typedef std::vector<std::array<FaceIndex, 3>> Faces;
+
+    // Same layout as the exported scenes: one "x y z" or "v/t/n v/t/n v/t/n" line per entry
+    void makeText(size_t bytes, std::string& vertexText, std::string& faceText, std::mt19937& rng)
+    {
+        std::uniform_real_distribution<float> pos(-100.0f, 100.0f);
+        char line[128];
+
+        vertexText.reserve(bytes * 2 / 5 + sizeof(line));
+        int vertexCount = 0;
+        while (vertexText.size() < bytes * 2 / 5)
+        {
+            int n = std::snprintf(line, sizeof(line), "        %f %f %f\n", pos(rng), pos(rng), pos(rng));
+            vertexText.append(line, n);
+            vertexCount++;
+        }
+
+        std::uniform_int_distribution<int> vertex(1, vertexCount), other(1, 1000);
+        faceText.reserve(bytes - vertexText.size() + sizeof(line));
+        while (vertexText.size() + faceText.size() < bytes)
+        {
+            int n = std::snprintf(line, sizeof(line), "                %d/%d/%d %d/%d/%d %d/%d/%d\n",
+                vertex(rng), other(rng), other(rng), vertex(rng), other(rng), other(rng), vertex(rng), other(rng), other(rng));
+            faceText.append(line, n);
+        }
+    }
+
+    void referenceVertices(const char* text, std::vector<Vec3>& out)
+    {
+        std::istringstream ss(text);
+        float x, y, z;
+        while (ss >> x >> y >> z)
+        {
+            out.push_back(Vec3(x, y, z));
+        }
+    }
+
+    void referenceFaces(const char* text, Faces& out)
+    {
+        std::istringstream faceStream(text);
+        std::string faceToken;
+
+        while (faceStream >> faceToken)
+        {
+            std::array<FaceIndex, 3> triangle;
+            for (int i = 0; i < 3; ++i)
+            {
+                if (i > 0) faceStream >> faceToken;
+
+                FaceIndex idx;
+                sscanf(faceToken.c_str(), "%d/%d/%d", &idx.vertexId, &idx.textureId, &idx.normalId);
+                idx.vertexId--;
+                idx.textureId--;
+                idx.normalId--;
+                triangle[i] = idx;
+            }
+            out.emplace_back(triangle);
+        }
+    }
+
+    bool sameVertices(const std::vector<Vec3>& a, const std::vector<Vec3>& b)
+    {
+        if (a.size() != b.size()) return false;
+        for (size_t i = 0; i < a.size(); ++i)
+        {
+            if (a[i].x != b[i].x || a[i].y != b[i].y || a[i].z != b[i].z) return false;
+        }
+        return true;
+    }
+
+    bool sameFaces(const Faces& a, const Faces& b)
+    {
+        if (a.size() != b.size()) return false;
+        return b.empty() || std::memcmp(a.data(), b.data(), a.size() * sizeof(a[0])) == 0;
+    }
+
+    double seconds(std::chrono::high_resolution_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    void report(const char* name, double vertexSeconds, double faceSeconds, size_t bytes, bool matches)
+    {
+        double megabytes = bytes / (1024.0 * 1024.0);
+        std::printf("%-14s %8.3f s %8.1f MB/s  (vertices %.3f s, faces %.3f s)%s\n", name, vertexSeconds + faceSeconds,
+            megabytes / (vertexSeconds + faceSeconds), vertexSeconds, faceSeconds, matches ? "" : "  MISMATCH");
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    int megabytes = argc > 1 ? std::atoi(argv[1]) : 500;
+    int threadCount = argc > 2 ? std::atoi(argv[2]) : static_cast<int>(std::thread::hardware_concurrency());
+    if (threadCount < 1) threadCount = 1;
+
+    std::mt19937 rng(1234);
+    std::string vertexText, faceText;
+    makeText(static_cast<size_t>(megabytes) << 20, vertexText, faceText, rng);
+    size_t bytes = vertexText.size() + faceText.size();
+
+    // before
+    std::vector<Vec3> refVertices;
+    Faces refFaces;
+    auto start = std::chrono::high_resolution_clock::now();
+    referenceVertices(vertexText.c_str(), refVertices);
+    double vertexSeconds = seconds(start);
+    start = std::chrono::high_resolution_clock::now();
+    referenceFaces(faceText.c_str(), refFaces);
+    double faceSeconds = seconds(start);
+
+    std::printf("%.1f MB of geometry text, %zu vertices, %zu triangles\n", bytes / (1024.0 * 1024.0), refVertices.size(), refFaces.size());
+    report("istringstream", vertexSeconds, faceSeconds, bytes, true);
+
+    // after
+    int threadCounts[2] = { 1, threadCount };
+    for (int i = 0; i < (threadCount > 1 ? 2 : 1); ++i)
+    {
+        std::vector<Vec3> vertices;
+        Faces faces;
+        start = std::chrono::high_resolution_clock::now();
+        bool valid = GeometryText::decodeVec3s(vertexText.c_str(), vertices, threadCounts[i]);
+        vertexSeconds = seconds(start);
+        start = std::chrono::high_resolution_clock::now();
+        valid = GeometryText::decodeFaces(faceText.c_str(), faces, threadCounts[i]) && valid;
+        faceSeconds = seconds(start);
+
+        char name[32];
+        std::snprintf(name, sizeof(name), "from_chars x%d", threadCounts[i]);
+        report(name, vertexSeconds, faceSeconds, bytes, valid && sameVertices(vertices, refVertices) && sameFaces(faces, refFaces));
+    }
+
+    return 0;
+}
@@ -0,0 +1,444 @@
+// End to end render benchmark over the synthetic SceneGen scenarios.
+// Every scene is rendered several times by the raytracer binary in a child process;
+// reported are the median and p95 of the "Render time" line, rays per second (all BVH
+// queries: primary, shadow and reflection rays) and the peak resident memory of the
+// process. Results go to stdout as a table and to a JSON file for tracking regressions.
+// With --check-packets every scene is instead rendered once per pixel and once with
+// --packets, and the two images must match exactly.
+//
+// Usage: render_bench [--raytracer ./raytracer] [--triangles n] [--runs n] [--threads n]
+//                     [--resolution n] [--lights n] [--light-samples n] [--area-samples n] [--area-coarse n]
+//                     [--materials n] [--generic-shading] [--scenario name]... [--dir bench_scenes]
+//                     [--json bench.json] [--label text] [--generate-only] [--check-packets]
+
+#include "SceneGen.h"
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace
+{
+    struct BenchOptions
+    {
+        std::string raytracer = "./raytracer";
+        std::string dir = "bench_scenes";
+        std::string json = "bench.json";
+        std::string label;
+        std::vector<std::string> scenarios;
+        SceneGenOptions scene;
+        int runs = 5;
+        int threads = 0;        // 0 = the renderer's default
+        int lightSamples = 0;   // > 0: passed on as --light-samples
+        int areaSamples = 0;    // > 0: passed on as --area-samples
+        int areaCoarse = 0;     // > 0: passed on as --area-coarse
+        bool genericShading = false;
+        bool generateOnly = false;
+        bool checkPackets = false;
+    };
+
+    // One finished child process
+    struct RunResult
+    {
+        bool ok = false;
+        double renderSeconds = 0.0;
+        double wallSeconds = 0.0;
+        long long rays = 0;
+        long peakKB = 0;
+    };
+
+    struct ScenarioResult
+    {
+        SceneSummary summary;
+        std::vector<RunResult> runs;
+        double medianSeconds = 0.0, p95Seconds = 0.0, medianWallSeconds = 0.0;
+        double mraysPerSecond = 0.0;
+        double peakMB = 0.0;
+    };
+
+    void printUsage(const char* program)
+    {
+        std::printf("Usage: %s [options]\n"
+                    "  --raytracer <path>  renderer binary (default ./raytracer)\n"
+                    "  --triangles <n>     approximate triangles per scene (default 100000)\n"
+                    "  --runs <n>          renders per scene (default 5)\n"
+                    "  --threads <n>       render threads (default: the renderer's)\n"
+                    "  --resolution <n>    image width and height (default 512)\n"
+                    "  --lights <n>        point lights of the lights scenario (default 64)\n"
+                    "  --light-samples <n> renderer --light-samples, lights shaded per hit (default: all)\n"
+                    "  --area-samples <n>  renderer --area-samples, shadow rays per triangle light in penumbra (default 16)\n"
+                    "  --area-coarse <n>   renderer --area-coarse, shadow rays per triangle light to find penumbra (default 4)\n"
+                    "  --materials <n>     sphere materials of the materials scenario (default 32)\n"
+                    "  --generic-shading   renderer --generic-shading, one kernel for all materials\n"
+                    "  --scenario <name>   grid, soup, thin, lights, area, materials, mirrors; repeatable (default all)\n"
+                    "  --dir <dir>         where scenes and images are written (default bench_scenes)\n"
+                    "  --json <file>       machine readable results (default bench.json)\n"
+                    "  --label <text>      stored in the JSON, e.g. the commit\n"
+                    "  --generate-only     write the scenes and exit\n"
+                    "  --check-packets     render every scene with and without --packets and compare the images\n", program);
+    }
+
+    int positiveInt(const char* flag, const char* text)
+    {
+        int value = std::atoi(text);
+        if (value <= 0)
+        {
+            std::fprintf(stderr, "Invalid value for %s: %s\n", flag, text);
+            exit(1);
+        }
+        return value;
+    }
+
+    BenchOptions parseOptions(int argc, char* argv[])
+    {
+        BenchOptions options;
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+            if (arg == "--generate-only")
+            {
+                options.generateOnly = true;
+                continue;
+            }
+            if (arg == "--generic-shading")
+            {
+                options.genericShading = true;
+                continue;
+            }
+            if (arg == "--check-packets")
+            {
+                options.checkPackets = true;
+                continue;
+            }
+            if (arg == "--help" || arg == "-h")
+            {
+                printUsage(argv[0]);
+                exit(0);
+            }
+            if (i + 1 >= argc)
+            {
+                std::fprintf(stderr, "Missing value for %s\n", arg.c_str());
+                printUsage(argv[0]);
+                exit(1);
+            }
+
+            const char* value = argv[++i];
+            if (arg == "--raytracer") options.raytracer = value;
+            else if (arg == "--triangles") options.scene.triangles = positiveInt("--triangles", value);
+            else if (arg == "--runs") options.runs = positiveInt("--runs", value);
+            else if (arg == "--threads") options.threads = positiveInt("--threads", value);
+            else if (arg == "--resolution") options.scene.resolution = positiveInt("--resolution", value);
+            else if (arg == "--lights") options.scene.lights = positiveInt("--lights", value);
+            else if (arg == "--light-samples") options.lightSamples = positiveInt("--light-samples", value);
+            else if (arg == "--area-samples") options.areaSamples = positiveInt("--area-samples", value);
+            else if (arg == "--area-coarse") options.areaCoarse = positiveInt("--area-coarse", value);
+            else if (arg == "--materials") options.scene.materials = positiveInt("--materials", value);
+            else if (arg == "--scenario") options.scenarios.push_back(value);
+            else if (arg == "--dir") options.dir = value;
+            else if (arg == "--json") options.json = value;
+            else if (arg == "--label") options.label = value;
+            else
+            {
+                std::fprintf(stderr, "Unknown option: %s\n", arg.c_str());
+                printUsage(argv[0]);
+                exit(1);
+            }
+        }
+
+        if (options.scenarios.empty())
+            options.scenarios = SceneGen::getScenarios();
+        return options;
+    }
+
+    // Number following the first occurrence of prefix
+    bool findNumber(const std::string& output, const char* prefix, double& value)
+    {
+        size_t at = output.find(prefix);
+        if (at == std::string::npos) return false;
+        value = std::atof(output.c_str() + at + std::strlen(prefix));
+        return true;
+    }
+
+    // Renders one scene in a child process started in the scene directory, the only
+    // way to get a clean peak RSS per run. The image is <scenario>.ppm, <scenario>.packets.ppm
+    // when traced with --packets.
+    RunResult runRenderer(const BenchOptions& options, const std::string& raytracer, const std::string& scenario,
+        bool packets = false)
+    {
+        RunResult result;
+        int fds[2];
+        if (pipe(fds) != 0) return result;
+
+        std::string scene = scenario + ".xml", output = scenario + (packets ? ".packets.ppm" : ".ppm");
+        std::string threads = std::to_string(options.threads);
+        std::string lightSamples = std::to_string(options.lightSamples);
+        std::string areaSamples = std::to_string(options.areaSamples), areaCoarse = std::to_string(options.areaCoarse);
+        std::vector<const char*> args = { raytracer.c_str(), "--scene", scene.c_str(), "--output", output.c_str(), "--no-cache" };
+        if (options.threads > 0)
+        {
+            args.push_back("--threads");
+            args.push_back(threads.c_str());
+        }
+        if (options.lightSamples > 0)
+        {
+            args.push_back("--light-samples");
+            args.push_back(lightSamples.c_str());
+        }
+        if (options.areaSamples > 0)
+        {
+            args.push_back("--area-samples");
+            args.push_back(areaSamples.c_str());
+        }
+        if (options.areaCoarse > 0)
+        {
+            args.push_back("--area-coarse");
+            args.push_back(areaCoarse.c_str());
+        }
+        if (options.genericShading)
+            args.push_back("--generic-shading");
+        if (packets)
+            args.push_back("--packets");
+        args.push_back(nullptr);
+
+        auto start = std::chrono::steady_clock::now();
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            dup2(fds[1], STDOUT_FILENO);
+            close(fds[0]);
+            close(fds[1]);
+            if (chdir(options.dir.c_str()) != 0) _exit(127);
+            execv(raytracer.c_str(), const_cast<char* const*>(args.data()));
+            _exit(127);
+        }
+        close(fds[1]);
+        if (pid < 0)
+        {
+            close(fds[0]);
+            return result;
+        }
+
+        std::string text;
+        char buffer[4096];
+        ssize_t n;
+        while ((n = read(fds[0], buffer, sizeof(buffer))) > 0)
+        {
+            text.append(buffer, n);
+        }
+        close(fds[0]);
+
+        int status = 0;
+        struct rusage usage;
+        if (wait4(pid, &status, 0, &usage) != pid) return result;
+        result.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        result.peakKB = usage.ru_maxrss;
+
+        result.ok = WIFEXITED(status) && WEXITSTATUS(status) == 0 && findNumber(text, "Render time: ", result.renderSeconds);
+        if (!result.ok)
+        {
+            std::fprintf(stderr, "%s failed (status %d):\n%s\n", scenario.c_str(), status, text.c_str());
+            return result;
+        }
+
+        // "BVH nodes visited per ray: 9.7 (4715675 rays)", missing from an RT_NO_STATS build
+        size_t at = text.find("BVH nodes visited per ray: ");
+        if (at == std::string::npos || (at = text.find('(', at)) == std::string::npos)
+        {
+            std::fprintf(stderr, "%s: %s printed no ray count, Mrays/s needs a build with render statistics (make, not make release)\n",
+                scenario.c_str(), raytracer.c_str());
+            result.ok = false;
+            return result;
+        }
+        result.rays = std::atoll(text.c_str() + at + 1);
+        return result;
+    }
+
+    // Pixels of a binary P6 image as written by the renderer
+    bool readPPM(const std::string& file, int& width, int& height, std::vector<unsigned char>& pixels)
+    {
+        FILE* f = std::fopen(file.c_str(), "rb");
+        if (f == nullptr) return false;
+        int maxValue = 0;
+        bool ok = std::fscanf(f, "P6 %d %d %d", &width, &height, &maxValue) == 3 && maxValue == 255 && std::fgetc(f) != EOF;
+        if (ok)
+        {
+            pixels.resize(static_cast<size_t>(width) * height * 3);
+            ok = std::fread(pixels.data(), 1, pixels.size(), f) == pixels.size();
+        }
+        std::fclose(f);
+        return ok;
+    }
+
+    // Renders a scene per pixel and with --packets; both trace the same rays through the same
+    // triangle tests, so any differing pixel is a bug. Prints the first few and returns whether they match.
+    bool checkPackets(const BenchOptions& options, const std::string& raytracer, const std::string& scenario)
+    {
+        if (!runRenderer(options, raytracer, scenario).ok || !runRenderer(options, raytracer, scenario, true).ok)
+            return false;
+
+        int width = 0, height = 0, packetWidth = 0, packetHeight = 0;
+        std::vector<unsigned char> single, packet;
+        std::string base = options.dir + "/" + scenario;
+        if (!readPPM(base + ".ppm", width, height, single) || !readPPM(base + ".packets.ppm", packetWidth, packetHeight, packet) ||
+            width != packetWidth || height != packetHeight)
+        {
+            std::fprintf(stderr, "%s: cannot compare %s.ppm and %s.packets.ppm\n", scenario.c_str(), base.c_str(), base.c_str());
+            return false;
+        }
+
+        int differing = 0, largest = 0;
+        for (size_t i = 0; i < single.size(); i += 3)
+        {
+            int difference = 0;
+            for (size_t c = i; c < i + 3; ++c)
+            {
+                difference = std::max(difference, std::abs(single[c] - packet[c]));
+            }
+            if (difference == 0) continue;
+
+            if (differing < 5)
+            {
+                int x = static_cast<int>(i / 3 % width), y = static_cast<int>(i / 3 / width);
+                std::printf("  %s (%d,%d): [%d,%d,%d] per pixel, [%d,%d,%d] packets\n", scenario.c_str(), x, y,
+                    single[i], single[i + 1], single[i + 2], packet[i], packet[i + 1], packet[i + 2]);
+            }
+            differing++;
+            largest = std::max(largest, difference);
+        }
+        std::printf("%-8s %9d differing pixels, largest difference %d\n", scenario.c_str(), differing, largest);
+        return differing == 0;
+    }
+
+    // Nearest rank percentile of a sorted list
+    double percentile(const std::vector<double>& sorted, int p)
+    {
+        size_t rank = (sorted.size() * p + 99) / 100;
+        return sorted[std::max<size_t>(rank, 1) - 1];
+    }
+
+    void summarize(ScenarioResult& s)
+    {
+        std::vector<double> render, wall;
+        long long rays = 0;
+        long peakKB = 0;
+        for (const RunResult& run : s.runs)
+        {
+            render.push_back(run.renderSeconds);
+            wall.push_back(run.wallSeconds);
+            rays = run.rays;
+            peakKB = std::max(peakKB, run.peakKB);
+        }
+        std::sort(render.begin(), render.end());
+        std::sort(wall.begin(), wall.end());
+
+        s.medianSeconds = percentile(render, 50);
+        s.p95Seconds = percentile(render, 95);
+        s.medianWallSeconds = percentile(wall, 50);
+        s.mraysPerSecond = s.medianSeconds > 0 ? rays / s.medianSeconds / 1e6 : 0.0;
+        s.peakMB = peakKB / 1024.0;
+    }
+
+    bool writeJson(const BenchOptions& options, const std::vector<ScenarioResult>& results)
+    {
+        FILE* f = std::fopen(options.json.c_str(), "w");
+        if (f == nullptr)
+        {
+            std::fprintf(stderr, "Cannot write %s\n", options.json.c_str());
+            return false;
+        }
+
+        std::fprintf(f, "{\n  \"label\": \"%s\",\n  \"threads\": %d,\n  \"runs\": %d,\n  \"light_samples\": %d,\n  \"area_samples\": %d,\n  \"area_coarse\": %d,\n  \"generic_shading\": %s,\n  \"scenarios\": [\n",
+            options.label.c_str(), options.threads, options.runs, options.lightSamples, options.areaSamples, options.areaCoarse,
+            options.genericShading ? "true" : "false");
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            const ScenarioResult& r = results[i];
+            std::fprintf(f, "    {\"name\": \"%s\", \"triangles\": %d, \"lights\": %d, \"depth\": %d, \"resolution\": %d, "
+                "\"median_seconds\": %.6f, \"p95_seconds\": %.6f, \"median_wall_seconds\": %.6f, "
+                "\"rays\": %lld, \"mrays_per_second\": %.3f, \"peak_rss_mb\": %.1f, \"render_seconds\": [",
+                r.summary.scenario.c_str(), r.summary.triangles, r.summary.lights, r.summary.depth, r.summary.resolution,
+                r.medianSeconds, r.p95Seconds, r.medianWallSeconds, r.runs.empty() ? 0 : r.runs.back().rays,
+                r.mraysPerSecond, r.peakMB);
+            for (size_t k = 0; k < r.runs.size(); ++k)
+            {
+                std::fprintf(f, "%s%.6f", k > 0 ? ", " : "", r.runs[k].renderSeconds);
+            }
+            std::fprintf(f, "]}%s\n", i + 1 < results.size() ? "," : "");
+        }
+        std::fprintf(f, "  ]\n}\n");
+        return std::fclose(f) == 0;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    BenchOptions options = parseOptions(argc, argv);
+
+    // 1. Scenes
+    mkdir(options.dir.c_str(), 0755);
+    const char* TEXTURE = "bench_texture.ppm";
+    if (!SceneGen::writeTexture(options.dir + "/" + TEXTURE)) return 1;
+
+    std::vector<ScenarioResult> results;
+    for (const std::string& scenario : options.scenarios)
+    {
+        ScenarioResult result;
+        if (!SceneGen::write(scenario, options.scene, options.dir, TEXTURE, result.summary)) return 1;
+        results.push_back(result);
+    }
+    if (options.generateOnly)
+    {
+        std::printf("%zu scenes written to %s\n", results.size(), options.dir.c_str());
+        return 0;
+    }
+
+    // The child runs in the scene directory
+    char resolved[PATH_MAX];
+    if (realpath(options.raytracer.c_str(), resolved) == nullptr || access(resolved, X_OK) != 0)
+    {
+        std::fprintf(stderr, "Renderer not found: %s\n", options.raytracer.c_str());
+        return 1;
+    }
+    std::string raytracer = resolved;
+
+    if (options.checkPackets)
+    {
+        bool match = true;
+        for (const ScenarioResult& result : results)
+        {
+            match = checkPackets(options, raytracer, result.summary.scenario) && match;
+        }
+        return match ? 0 : 1;
+    }
+
+    // 2. Renders
+    std::printf("%-8s %9s %6s %5s %10s %10s %10s %9s\n", "scene", "triangles", "lights", "depth", "median s", "p95 s", "Mrays/s", "peak MB");
+    for (ScenarioResult& result : results)
+    {
+        for (int run = 0; run < options.runs; ++run)
+        {
+            RunResult r = runRenderer(options, raytracer, result.summary.scenario);
+            if (!r.ok) return 1;
+            result.runs.push_back(r);
+        }
+        summarize(result);
+
+        const SceneSummary& s = result.summary;
+        std::printf("%-8s %9d %6d %5d %10.3f %10.3f %10.2f %9.1f\n", s.scenario.c_str(), s.triangles, s.lights, s.depth,
+            result.medianSeconds, result.p95Seconds, result.mraysPerSecond, result.peakMB);
+        std::fflush(stdout);
+    }
+
+    // 3. Report
+    if (!writeJson(options, results)) return 1;
+    std::printf("Results written to %s\n", options.json.c_str());
+    return 0;
+}
@@ -0,0 +1,444 @@
+#include "SceneGen.h"
+#include "Vec3.h"
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <random>
+
+namespace
+{
+    struct GenMaterial
+    {
+        Vec3 ambient, diffuse, specular, mirror;
+        float phongExponent;
+        float textureFactor;
+    };
+
+    struct GenLight
+    {
+        Vec3 position, intensity;
+    };
+
+    struct GenTriangleLight
+    {
+        Vec3 v0, v1, v2, intensity;     // shines towards (v1 - v0) x (v2 - v0)
+    };
+
+    struct GenMesh
+    {
+        int materialId;
+        std::vector<std::array<int, 4>> faces;  // 3 vertex indices and the face normal index
+    };
+
+    // Collects a scene and writes it in the layout XMLParser reads
+    class Builder
+    {
+        public:
+            std::vector<Vec3> vertices;
+            std::vector<Vec3> normals;
+            std::vector<GenMesh> meshes;
+            std::vector<GenLight> lights;
+            std::vector<GenTriangleLight> triangleLights;
+            std::vector<GenMaterial> materials;
+            Vec3 cameraPosition, cameraGaze;
+            Vec3 ambient = Vec3(25, 25, 25);
+            int depth = 3;
+            int resolution = 512;
+
+            Builder()
+            {
+                // 1 matte, 2 glossy, 3 mirror, 4 ground
+                materials.push_back({ Vec3(0.2f, 0.2f, 0.2f), Vec3(0.8f, 0.5f, 0.3f), Vec3(0.1f, 0.1f, 0.1f), Vec3(0, 0, 0), 10.0f, 0.3f });
+                materials.push_back({ Vec3(0.2f, 0.2f, 0.2f), Vec3(0.3f, 0.5f, 0.9f), Vec3(0.8f, 0.8f, 0.8f), Vec3(0.3f, 0.3f, 0.3f), 60.0f, 0.0f });
+                materials.push_back({ Vec3(0.05f, 0.05f, 0.05f), Vec3(0.1f, 0.1f, 0.1f), Vec3(1, 1, 1), Vec3(0.85f, 0.85f, 0.85f), 200.0f, 0.0f });
+                materials.push_back({ Vec3(0.3f, 0.3f, 0.3f), Vec3(0.7f, 0.7f, 0.7f), Vec3(0, 0, 0), Vec3(0, 0, 0), 1.0f, 0.6f });
+            }
+
+            // Index of a new mesh, the face functions take it
+            int mesh(int materialId)
+            {
+                meshes.push_back(GenMesh{ materialId, {} });
+                return static_cast<int>(meshes.size()) - 1;
+            }
+
+            int vertex(const Vec3& v)
+            {
+                vertices.push_back(v);
+                return static_cast<int>(vertices.size()) - 1;
+            }
+
+            void face(int m, int a, int b, int c)
+            {
+                Vec3 n = (vertices[b] - vertices[a]).cross(vertices[c] - vertices[a]);
+                normals.push_back(n.length() > 0 ? n.normalized() : Vec3(0, 1, 0));
+                meshes[m].faces.push_back({ a, b, c, static_cast<int>(normals.size()) - 1 });
+            }
+
+            void triangle(int m, const Vec3& a, const Vec3& b, const Vec3& c)
+            {
+                int ia = vertex(a), ib = vertex(b), ic = vertex(c);
+                face(m, ia, ib, ic);
+            }
+
+            void quad(int m, const Vec3& a, const Vec3& b, const Vec3& c, const Vec3& d)
+            {
+                int ia = vertex(a), ib = vertex(b), ic = vertex(c), id = vertex(d);
+                face(m, ia, ib, ic);
+                face(m, ia, ic, id);
+            }
+
+            // Latitude / longitude sphere, 2 * segments * (rings - 1) triangles
+            void sphere(int m, const Vec3& center, float radius, int segments, int rings)
+            {
+                const float PI = 3.14159265f;
+                int top = vertex(center + Vec3(0, radius, 0));
+                int first = static_cast<int>(vertices.size());
+                for (int r = 1; r < rings; ++r)
+                {
+                    float phi = PI * r / rings;
+                    for (int s = 0; s < segments; ++s)
+                    {
+                        float theta = 2.0f * PI * s / segments;
+                        vertex(center + Vec3(std::sin(phi) * std::cos(theta), std::cos(phi), std::sin(phi) * std::sin(theta)) * radius);
+                    }
+                }
+                int bottom = vertex(center + Vec3(0, -radius, 0));
+
+                for (int s = 0; s < segments; ++s)
+                {
+                    int next = (s + 1) % segments;
+                    face(m, top, first + next, first + s);
+                    for (int r = 0; r + 2 < rings; ++r)
+                    {
+                        int row = first + r * segments, below = row + segments;
+                        face(m, row + s, row + next, below + next);
+                        face(m, row + s, below + next, below + s);
+                    }
+                    int last = first + (rings - 2) * segments;
+                    face(m, bottom, last + s, last + next);
+                }
+            }
+
+            int triangleCount() const
+            {
+                int count = 0;
+                for (const GenMesh& m : meshes)
+                {
+                    count += static_cast<int>(m.faces.size());
+                }
+                return count;
+            }
+
+            bool save(const std::string& file, const std::string& textureFile) const;
+    };
+
+    const int SPHERE_SEGMENTS = 32;
+    const int SPHERE_RINGS = 16;
+    const int SPHERE_TRIANGLES = 2 * SPHERE_SEGMENTS * (SPHERE_RINGS - 1);
+
+    void printVec3(FILE* f, const char* tag, const Vec3& v)
+    {
+        std::fprintf(f, "            <%s>%g %g %g</%s>\n", tag, v.x, v.y, v.z, tag);
+    }
+
+    bool Builder::save(const std::string& file, const std::string& textureFile) const
+    {
+        FILE* f = std::fopen(file.c_str(), "w");
+        if (f == nullptr)
+        {
+            std::fprintf(stderr, "Cannot write %s\n", file.c_str());
+            return false;
+        }
+
+        // 1. Header, camera, lights and materials
+        std::fprintf(f, "<?xml version='1.0' encoding='utf-8'?>\n<!-- triangle count: %d -->\n<scene>\n", triangleCount());
+        std::fprintf(f, "    <maxraytracedepth>%d</maxraytracedepth>\n    <backgroundColor>0 0 0</backgroundColor>\n", depth);
+        std::fprintf(f, "    <camera>\n");
+        printVec3(f, "position", cameraPosition);
+        printVec3(f, "gaze", cameraGaze);
+        std::fprintf(f, "            <up>0 1 0</up>\n            <nearPlane>-1 1 -1 1</nearPlane>\n");
+        std::fprintf(f, "            <neardistance>1</neardistance>\n            <imageresolution>%d %d</imageresolution>\n    </camera>\n",
+            resolution, resolution);
+
+        std::fprintf(f, "    <lights>\n        <ambientlight>%g %g %g</ambientlight>\n", ambient.x, ambient.y, ambient.z);
+        for (size_t i = 0; i < lights.size(); ++i)
+        {
+            std::fprintf(f, "        <pointlight id=\"%zu\">\n", i + 1);
+            printVec3(f, "position", lights[i].position);
+            printVec3(f, "intensity", lights[i].intensity);
+            std::fprintf(f, "        </pointlight>\n");
+        }
+        for (size_t i = 0; i < triangleLights.size(); ++i)
+        {
+            const GenTriangleLight& l = triangleLights[i];
+            std::fprintf(f, "        <triangularlight id=\"%zu\">\n", lights.size() + i + 1);
+            printVec3(f, "vertex1", l.v0);
+            printVec3(f, "vertex2", l.v1);
+            printVec3(f, "vertex3", l.v2);
+            printVec3(f, "intensity", l.intensity);
+            std::fprintf(f, "        </triangularlight>\n");
+        }
+        std::fprintf(f, "    </lights>\n    <materials>\n");
+        for (size_t i = 0; i < materials.size(); ++i)
+        {
+            const GenMaterial& m = materials[i];
+            std::fprintf(f, "        <material id=\"%zu\">\n", i + 1);
+            printVec3(f, "ambient", m.ambient);
+            printVec3(f, "diffuse", m.diffuse);
+            printVec3(f, "specular", m.specular);
+            printVec3(f, "mirrorreflactance", m.mirror);
+            std::fprintf(f, "            <phongexponent>%g</phongexponent>\n            <texturefactor>%g</texturefactor>\n        </material>\n",
+                m.phongExponent, m.textureFactor);
+        }
+        std::fprintf(f, "    </materials>\n");
+
+        // 2. Geometry, every face uses the three corners of the texture
+        std::fprintf(f, "    <vertexdata>\n");
+        for (const Vec3& v : vertices)
+        {
+            std::fprintf(f, "        %f %f %f\n", v.x, v.y, v.z);
+        }
+        std::fprintf(f, "    </vertexdata>\n    <texturedata>\n        0 0\n        1 0\n        1 1\n    </texturedata>\n    <normaldata>\n");
+        for (const Vec3& n : normals)
+        {
+            std::fprintf(f, "        %f %f %f\n", n.x, n.y, n.z);
+        }
+        std::fprintf(f, "    </normaldata>\n    <textureimage>%s</textureimage>\n    <objects>\n", textureFile.c_str());
+
+        for (size_t i = 0; i < meshes.size(); ++i)
+        {
+            std::fprintf(f, "        <mesh id=\"%zu\">\n            <materialid>%d</materialid>\n            <faces>\n",
+                i + 1, meshes[i].materialId);
+            for (const std::array<int, 4>& t : meshes[i].faces)
+            {
+                std::fprintf(f, "                %d/1/%d %d/2/%d %d/3/%d\n", t[0] + 1, t[3] + 1, t[1] + 1, t[3] + 1, t[2] + 1, t[3] + 1);
+            }
+            std::fprintf(f, "            </faces>\n        </mesh>\n");
+        }
+        std::fprintf(f, "    </objects>\n</scene>\n");
+
+        bool written = std::ferror(f) == 0;
+        if (std::fclose(f) != 0) written = false;
+        if (!written) std::fprintf(stderr, "Failed to write %s\n", file.c_str());
+        return written;
+    }
+
+    // Spheres on a square grid, taking turns in the given materials (matte and glossy by default),
+    // on a ground plane; returns the grid extent
+    float makeGrid(Builder& b, int triangles, const std::vector<int>& sphereMaterials = { 1, 2 })
+    {
+        int copies = std::max(1, triangles / SPHERE_TRIANGLES);
+        int side = static_cast<int>(std::ceil(std::sqrt(static_cast<double>(copies))));
+        float spacing = 2.5f, extent = side * spacing;
+
+        int ground = b.mesh(4);
+        float g = extent * 0.5f + spacing;
+        b.quad(ground, Vec3(-g, 0, -g), Vec3(-g, 0, g), Vec3(g, 0, g), Vec3(g, 0, -g));
+
+        std::vector<int> meshes;
+        for (int materialId : sphereMaterials)
+        {
+            meshes.push_back(b.mesh(materialId));
+        }
+        for (int i = 0; i < copies; ++i)
+        {
+            float x = (i % side + 0.5f) * spacing - extent * 0.5f;
+            float z = (i / side + 0.5f) * spacing - extent * 0.5f;
+            b.sphere(meshes[i % meshes.size()], Vec3(x, 1.0f, z), 1.0f, SPHERE_SEGMENTS, SPHERE_RINGS);
+        }
+
+        b.cameraPosition = Vec3(extent * 0.5f + 2.0f, extent * 0.4f + 3.0f, extent * 0.5f + 2.0f);
+        b.cameraGaze = (Vec3(0, 0, 0) - b.cameraPosition).normalized();
+        return extent;
+    }
+
+    void makeSoup(Builder& b, int triangles, std::mt19937& rng)
+    {
+        float size = 20.0f / std::cbrt(static_cast<float>(std::max(1, triangles))) * 1.5f;
+        std::uniform_real_distribution<float> pos(-10.0f, 10.0f), offset(-size, size);
+
+        int matte = b.mesh(1);
+        for (int i = 0; i < triangles; ++i)
+        {
+            Vec3 c(pos(rng), pos(rng), pos(rng));
+            b.triangle(matte, c + Vec3(offset(rng), offset(rng), offset(rng)), c + Vec3(offset(rng), offset(rng), offset(rng)),
+                c + Vec3(offset(rng), offset(rng), offset(rng)));
+        }
+
+        b.cameraPosition = Vec3(0, 0, 28);
+        b.cameraGaze = Vec3(0, 0, -1);
+        b.lights.push_back({ Vec3(20, 25, 30), Vec3(180, 180, 180) });
+        b.lights.push_back({ Vec3(-25, 10, 20), Vec3(90, 90, 120) });
+    }
+
+    // Slivers 6 units long and a few hundredths wide in random directions: their boxes are
+    // large and overlap heavily although the triangles cover almost nothing
+    void makeThin(Builder& b, int triangles, std::mt19937& rng)
+    {
+        std::uniform_real_distribution<float> pos(-10.0f, 10.0f), dir(-1.0f, 1.0f), width(-0.03f, 0.03f);
+
+        int matte = b.mesh(1);
+        for (int i = 0; i < triangles; ++i)
+        {
+            Vec3 a(pos(rng), pos(rng), pos(rng));
+            Vec3 d = Vec3(dir(rng), dir(rng), dir(rng)).normalized();
+            b.triangle(matte, a - d * 3.0f, a + d * 3.0f, a + Vec3(width(rng), width(rng), width(rng)));
+        }
+
+        b.cameraPosition = Vec3(0, 0, 28);
+        b.cameraGaze = Vec3(0, 0, -1);
+        b.lights.push_back({ Vec3(20, 25, 30), Vec3(180, 180, 180) });
+        b.lights.push_back({ Vec3(-25, 10, 20), Vec3(90, 90, 120) });
+    }
+
+    void makeLights(Builder& b, int triangles, int lightCount, std::mt19937& rng)
+    {
+        float extent = makeGrid(b, triangles);
+        std::uniform_real_distribution<float> pos(-0.5f * extent, 0.5f * extent), height(4.0f, 8.0f);
+
+        // Together about as bright as the two lights of the other scenes
+        float intensity = 270.0f / std::max(1, lightCount) * 2.0f;
+        for (int i = 0; i < lightCount; ++i)
+        {
+            b.lights.push_back({ Vec3(pos(rng), height(rng), pos(rng)), Vec3(intensity, intensity * 0.9f, intensity * 0.8f) });
+        }
+    }
+
+    // A square light a third of the grid across, high above its centre and facing down, so
+    // every sphere casts a shadow with a wide penumbra
+    void makeArea(Builder& b, int triangles)
+    {
+        float extent = makeGrid(b, triangles);
+        float s = extent / 6.0f, h = 6.0f + extent * 0.25f;
+        Vec3 intensity(130, 130, 120);
+
+        Vec3 a(-s, h, -s), c(s, h, -s), d(s, h, s), e(-s, h, s);
+        b.triangleLights.push_back({ a, c, d, intensity });
+        b.triangleLights.push_back({ a, d, e, intensity });
+    }
+
+    // Sphere materials in every combination of textured or not, mirror or not and whole or
+    // fractional phong exponent, under 8 lights so shading weighs more than traversal
+    void makeMaterials(Builder& b, int triangles, int materialCount, std::mt19937& rng)
+    {
+        std::uniform_real_distribution<float> channel(0.1f, 0.9f);
+        std::vector<int> ids;
+        for (int k = 0; k < materialCount; ++k)
+        {
+            bool textured = (k & 1) != 0, mirror = (k & 2) != 0, wholePhong = (k & 4) != 0;
+            int variant = k / 8 % 4;
+            float phong = wholePhong ? static_cast<float>(8 << variant) : 5.5f + variant * 12.25f;
+            Vec3 diffuse(channel(rng), channel(rng), channel(rng));
+            b.materials.push_back({ Vec3(0.2f, 0.2f, 0.2f), diffuse, Vec3(0.6f, 0.6f, 0.6f),
+                mirror ? Vec3(0.35f, 0.35f, 0.35f) : Vec3(0, 0, 0), phong, textured ? 0.5f : 0.0f });
+            ids.push_back(static_cast<int>(b.materials.size()));
+        }
+        float extent = makeGrid(b, triangles, ids);
+
+        const float PI = 3.14159265f;
+        for (int i = 0; i < 8; ++i)
+        {
+            float angle = 2.0f * PI * i / 8;
+            b.lights.push_back({ Vec3(std::cos(angle) * extent * 0.4f, 6.0f + (i % 2) * 3.0f, std::sin(angle) * extent * 0.4f),
+                Vec3(70, 70, 65) });
+        }
+    }
+
+    // Spheres in a corridor between two mirrors, the camera looks into one of them at an angle
+    void makeMirrors(Builder& b, int triangles, int depth)
+    {
+        int copies = std::max(1, triangles / SPHERE_TRIANGLES);
+        int rows = (copies + 1) / 2;
+        float spacing = 2.5f, length = rows * spacing * 0.5f + 4.0f, w = 4.0f;
+
+        int ground = b.mesh(4);
+        b.quad(ground, Vec3(-w, 0, -length), Vec3(-w, 0, length), Vec3(w, 0, length), Vec3(w, 0, -length));
+        int mirrors = b.mesh(3);
+        b.quad(mirrors, Vec3(-w, 0, -length), Vec3(-w, 8, -length), Vec3(-w, 8, length), Vec3(-w, 0, length));
+        b.quad(mirrors, Vec3(w, 0, -length), Vec3(w, 0, length), Vec3(w, 8, length), Vec3(w, 8, -length));
+
+        int glossy = b.mesh(2);
+        for (int i = 0; i < copies; ++i)
+        {
+            float x = (i % 2 == 0) ? -1.5f : 1.5f;
+            float z = (i / 2 + 0.5f) * spacing - rows * spacing * 0.5f;
+            b.sphere(glossy, Vec3(x, 1.0f, z), 1.0f, SPHERE_SEGMENTS, SPHERE_RINGS);
+        }
+
+        // Lights inside the corridor, the mirror walls would shadow anything outside
+        b.lights.push_back({ Vec3(0, 7, length * 0.5f), Vec3(160, 160, 150) });
+        b.lights.push_back({ Vec3(0, 7, -length * 0.5f), Vec3(90, 90, 120) });
+
+        b.depth = depth;
+        b.cameraPosition = Vec3(-w * 0.5f, 2.5f, 0.0f);
+        b.cameraGaze = Vec3(1.0f, -0.1f, -0.35f).normalized();
+    }
+}
+
+const std::vector<std::string>& SceneGen::getScenarios()
+{
+    static const std::vector<std::string> names = { "grid", "soup", "thin", "lights", "area", "materials", "mirrors" };
+    return names;
+}
+
+bool SceneGen::write(const std::string& scenario, const SceneGenOptions& options, const std::string& dir,
+    const std::string& textureFile, SceneSummary& summary)
+{
+    Builder b;
+    b.resolution = options.resolution;
+    std::mt19937 rng(options.seed);
+
+    if (scenario == "grid")
+    {
+        makeGrid(b, options.triangles);
+        b.lights.push_back({ Vec3(10, 20, 15), Vec3(180, 180, 170) });
+        b.lights.push_back({ Vec3(-15, 12, -5), Vec3(80, 80, 110) });
+    }
+    else if (scenario == "mirrors")
+        makeMirrors(b, options.triangles, options.mirrorDepth);
+    else if (scenario == "soup")
+        makeSoup(b, options.triangles, rng);
+    else if (scenario == "thin")
+        makeThin(b, options.triangles, rng);
+    else if (scenario == "lights")
+        makeLights(b, options.triangles, options.lights, rng);
+    else if (scenario == "area")
+        makeArea(b, options.triangles);
+    else if (scenario == "materials")
+        makeMaterials(b, options.triangles, options.materials, rng);
+    else
+    {
+        std::fprintf(stderr, "Unknown scenario: %s\n", scenario.c_str());
+        return false;
+    }
+
+    summary.scenario = scenario;
+    summary.triangles = b.triangleCount();
+    summary.lights = static_cast<int>(b.lights.size() + b.triangleLights.size());
+    summary.depth = b.depth;
+    summary.resolution = b.resolution;
+    return b.save(dir + "/" + scenario + ".xml", textureFile);
+}
+
+bool SceneGen::writeTexture(const std::string& file)
+{
+    const int SIZE = 64, CELL = 8;
+    FILE* f = std::fopen(file.c_str(), "wb");
+    if (f == nullptr)
+    {
+        std::fprintf(stderr, "Cannot write %s\n", file.c_str());
+        return false;
+    }
+
+    std::fprintf(f, "P6\n%d %d\n255\n", SIZE, SIZE);
+    for (int y = 0; y < SIZE; ++y)
+    {
+        for (int x = 0; x < SIZE; ++x)
+        {
+            unsigned char c = ((x / CELL + y / CELL) % 2 == 0) ? 220 : 60;
+            unsigned char rgb[3] = { c, c, static_cast<unsigned char>(c / 2 + 60) };
+            std::fwrite(rgb, 1, 3, f);
+        }
+    }
+    return std::fclose(f) == 0;
+}
@@ -0,0 +1,49 @@
+#ifndef SCENEGEN_H
+#define SCENEGEN_H
+
+#include <string>
+#include <vector>
+
+// Synthetic benchmark scenes in the renderer's XML format, deterministic for a given seed
+//   grid     copies of one sphere mesh on a ground plane (the renderer has no instancing)
+//   soup     small random triangles filling a cube
+//   thin     long thin triangles crossing the whole scene, overlapping BVH boxes
+//   lights   the grid scene lit by many point lights
+//   area     the grid scene under a large square area light (two triangle lights), soft shadows
+//   materials  the grid scene with every sphere in one of many materials, lit by 8 point lights
+//   mirrors  spheres between two facing mirrors, deep reflection chains
+struct SceneGenOptions
+{
+    int triangles = 100000;     // approximate, whole meshes are added
+    int resolution = 512;       // square image
+    int lights = 64;            // point lights of the lights scenario
+    int materials = 32;         // sphere materials of the materials scenario
+    int mirrorDepth = 12;       // maxraytracedepth of the mirrors scenario
+    unsigned seed = 1234;
+};
+
+// What was written, for the benchmark report
+struct SceneSummary
+{
+    std::string scenario;
+    int triangles = 0;
+    int lights = 0;
+    int depth = 0;
+    int resolution = 0;
+};
+
+class SceneGen
+{
+    public:
+        static const std::vector<std::string>& getScenarios();
+
+        // Writes <dir>/<scenario>.xml, false for an unknown scenario or a write error.
+        // The scenes reference textureFile relative to dir.
+        static bool write(const std::string& scenario, const SceneGenOptions& options, const std::string& dir,
+            const std::string& textureFile, SceneSummary& summary);
+
+        // Small checkerboard PPM for the scenes' <textureimage>
+        static bool writeTexture(const std::string& file);
+};
+
+#endif // SCENEGEN_H
@@ -0,0 +1,257 @@
+// Texture loading and lookup benchmark on generated PPM images.
+// "before": one row-major RGB8 image per texture, decoded one after the other, sampled with
+//           the original clamp and bounds checked TextureImage::getColor
+// "after":  TextureCache, decoded in parallel into 8x8 tiles of packed RGBA8 in 64x64 blocks,
+//           in memory and mapped from a .rttex file under a byte budget
+// Lookups are timed for a coherent pattern (neighbouring pixels of a textured surface hit
+// neighbouring texels, in both directions), a minified one (8 texels between neighbouring
+// pixels, a distant surface) and an incoherent one (random texture and uv, like rays after
+// a few bounces). Trilinear lookups get the footprint of the pattern and read the mip level
+// that matches it instead of the base level.
+//
+// Usage: texture_bench [textures] [size] [threads] [budget MB]
+
+#include "TextureCache.h"
+#define STB_IMAGE_IMPLEMENTATION  // the renderer's copy lives in main.cpp
+#include "stb_image.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/stat.h>
+
+namespace
+{
+    const char* DIR = "texture_bench_images";
+    const int LOOKUPS = 1 << 22;
+
+    struct RowMajorTexture
+    {
+        unsigned char* data = nullptr;
+        int width = 0, height = 0, channels = 3;
+
+        Color getColor(int x, int y) const
+        {
+            if (data == nullptr) return Color(1, 0, 1);
+            x = std::min(std::max(x, 0), width - 1);
+            y = std::min(std::max(y, 0), height - 1);
+            int index = (y * width + x) * channels;
+            if (index + 2 >= width * height * channels) return Color(1, 0, 1);
+            return Color(data[index] / 255.0f, data[index + 1] / 255.0f, data[index + 2] / 255.0f);
+        }
+    };
+
+    struct Lookup
+    {
+        int texture;
+        Vec2f uv;
+    };
+
+    // Smooth colour gradients with noise, so the PPMs are not trivially compressible and every texel differs
+    bool writeImage(const std::string& file, int size, unsigned seed)
+    {
+        FILE* f = std::fopen(file.c_str(), "wb");
+        if (f == nullptr)
+        {
+            std::fprintf(stderr, "Cannot write %s\n", file.c_str());
+            return false;
+        }
+
+        std::mt19937 rng(seed);
+        std::vector<unsigned char> row(size * 3);
+        std::fprintf(f, "P6\n%d %d\n255\n", size, size);
+        for (int y = 0; y < size; ++y)
+        {
+            for (int x = 0; x < size; ++x)
+            {
+                row[x * 3] = static_cast<unsigned char>(x * 255 / size);
+                row[x * 3 + 1] = static_cast<unsigned char>(y * 255 / size);
+                row[x * 3 + 2] = static_cast<unsigned char>(rng());
+            }
+            std::fwrite(row.data(), 1, row.size(), f);
+        }
+        return std::fclose(f) == 0;
+    }
+
+    // Screen-like tiles of 64x64 lookups, each over one texture at texelsPerLookup texels per lookup
+    std::vector<Lookup> coherentLookups(int textureCount, int size, int texelsPerLookup, std::mt19937& rng)
+    {
+        std::uniform_int_distribution<int> texture(0, textureCount - 1);
+        std::uniform_real_distribution<float> start(0.0f, 1.0f);
+        std::vector<Lookup> lookups;
+        lookups.reserve(LOOKUPS);
+        float step = static_cast<float>(texelsPerLookup) / size;
+        while (lookups.size() < static_cast<size_t>(LOOKUPS))
+        {
+            int t = texture(rng);
+            float u0 = start(rng), v0 = start(rng);
+            for (int y = 0; y < 64; ++y)
+            {
+                for (int x = 0; x < 64; ++x)
+                {
+                    lookups.push_back(Lookup{t, Vec2f{u0 + x * step, v0 - y * step}});
+                }
+            }
+        }
+        lookups.resize(LOOKUPS);
+        return lookups;
+    }
+
+    std::vector<Lookup> randomLookups(int textureCount, std::mt19937& rng)
+    {
+        std::uniform_int_distribution<int> texture(0, textureCount - 1);
+        std::uniform_real_distribution<float> uv(0.0f, 1.0f);
+        std::vector<Lookup> lookups(LOOKUPS);
+        for (Lookup& lookup : lookups)
+        {
+            lookup.texture = texture(rng);
+            lookup.uv = Vec2f{uv(rng), uv(rng)};
+        }
+        return lookups;
+    }
+
+    double seconds(std::chrono::high_resolution_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    // Sum of the looked up colours, the same texels give the same sum in the same order
+    template <typename Sample>
+    double timeLookups(const std::vector<Lookup>& lookups, Sample sample, double& checksum)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        float sum = 0.0f;
+        for (const Lookup& lookup : lookups)
+        {
+            Color c = sample(lookup);
+            sum += c.getColorR() + c.getColorG() + c.getColorB();
+        }
+        double elapsed = seconds(start);
+        checksum = sum;
+        return elapsed;
+    }
+
+    // Trilinear lookups read other texels, they have no reference to match
+    void report(const char* name, double elapsed, double checksum, double reference)
+    {
+        std::printf("  %-22s %8.1f Mlookups/s%s\n", name, LOOKUPS / elapsed / 1e6, checksum == reference ? "" : "  MISMATCH");
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    int textureCount = argc > 1 ? std::atoi(argv[1]) : 16;
+    int size = argc > 2 ? std::atoi(argv[2]) : 1024;
+    int threadCount = argc > 3 ? std::atoi(argv[3]) : static_cast<int>(std::thread::hardware_concurrency());
+    int budgetMB = argc > 4 ? std::atoi(argv[4]) : 16;
+    if (textureCount < 1 || size < 1 || budgetMB < 1)
+    {
+        std::fprintf(stderr, "Usage: %s [textures] [size] [threads] [budget MB]\n", argv[0]);
+        return 1;
+    }
+    if (threadCount < 1) threadCount = 1;
+
+    // 1. Images
+    mkdir(DIR, 0755);
+    std::vector<std::string> files;
+    for (int i = 0; i < textureCount; ++i)
+    {
+        files.push_back(std::string(DIR) + "/texture" + std::to_string(i) + ".ppm");
+        if (!writeImage(files.back(), size, 1234 + i)) return 1;
+    }
+    std::printf("%d textures of %dx%d, %.1f MB as RGB8\n", textureCount, size, size, textureCount * 3.0 * size * size / (1 << 20));
+
+    // 2. Loading
+    std::vector<RowMajorTexture> rowMajor(textureCount);
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < textureCount; ++i)
+    {
+        int channels = 0;
+        rowMajor[i].data = stbi_load(files[i].c_str(), &rowMajor[i].width, &rowMajor[i].height, &channels, 3);
+        if (rowMajor[i].data == nullptr)
+        {
+            std::fprintf(stderr, "Cannot read %s\n", files[i].c_str());
+            return 1;
+        }
+    }
+    std::printf("load  row-major x1            %8.3f s\n", seconds(start));
+
+    TextureCache tiled;
+    std::string failed;
+    int threadCounts[2] = { 1, threadCount };
+    for (int k = 0; k < (threadCount > 1 ? 2 : 1); ++k)
+    {
+        for (const std::string& file : files)
+        {
+            tiled.add(file);
+        }
+        start = std::chrono::high_resolution_clock::now();
+        if (!tiled.load(threadCounts[k], failed))
+        {
+            std::fprintf(stderr, "Cannot read %s\n", failed.c_str());
+            return 1;
+        }
+        std::printf("load  tiled x%-16d %8.3f s\n", threadCounts[k], seconds(start));
+    }
+
+    TextureCache mapped;
+    for (const std::string& file : files)
+    {
+        mapped.add(file);
+    }
+    std::string textureFile = std::string(DIR) + "/bench.rttex";
+    size_t budget = static_cast<size_t>(budgetMB) << 20;
+    start = std::chrono::high_resolution_clock::now();
+    if (!mapped.open(textureFile, budget, false, threadCount, failed))
+    {
+        std::fprintf(stderr, "Cannot write %s (%s)\n", textureFile.c_str(), failed.c_str());
+        return 1;
+    }
+    std::printf("write tiled .rttex x%-10d %8.3f s\n", threadCount, seconds(start));
+
+    // 3. Lookups
+    std::mt19937 rng(42);
+    std::vector<Lookup> patterns[3] = { coherentLookups(textureCount, size, 1, rng), coherentLookups(textureCount, size, 8, rng),
+                                        randomLookups(textureCount, rng) };
+    const char* patternNames[3] = { "coherent", "minified", "random" };
+    float footprints[3] = { 1.0f / size, 8.0f / size, 1.0f / size };  // uv between neighbouring lookups
+    for (int p = 0; p < 3; ++p)
+    {
+        std::printf("%s, %d lookups:\n", patternNames[p], LOOKUPS);
+        double reference = 0.0, checksum = 0.0;
+
+        double elapsed = timeLookups(patterns[p], [&](const Lookup& lookup)
+        {
+            const RowMajorTexture& texture = rowMajor[lookup.texture];
+            int x = static_cast<int>(lookup.uv.u * texture.width);
+            int y = static_cast<int>((1.0f - lookup.uv.v) * texture.height);
+            return texture.getColor(x, y);
+        }, reference);
+        report("row-major RGB8", elapsed, reference, reference);
+
+        elapsed = timeLookups(patterns[p], [&](const Lookup& lookup) { return tiled.sample(lookup.texture, lookup.uv); }, checksum);
+        report("tiled RGBA8", elapsed, checksum, reference);
+
+        Vec2f duvdx{footprints[p], 0.0f}, duvdy{0.0f, footprints[p]};
+        elapsed = timeLookups(patterns[p], [&](const Lookup& lookup) { return tiled.sample(lookup.texture, lookup.uv, duvdx, duvdy); }, checksum);
+        report("tiled trilinear", elapsed, checksum, checksum);
+
+        TextureCacheStats before = mapped.getStats();
+        elapsed = timeLookups(patterns[p], [&](const Lookup& lookup) { return mapped.sample(lookup.texture, lookup.uv); }, checksum);
+        char name[64];
+        std::snprintf(name, sizeof(name), "mapped, %d MB budget", budgetMB);
+        report(name, elapsed, checksum, reference);
+        std::printf("  %-22s %lld page-ins, %lld evictions\n", "", mapped.getStats().pageIns - before.pageIns,
+            mapped.getStats().evictions - before.evictions);
+    }
+
+    for (RowMajorTexture& texture : rowMajor)
+    {
+        stbi_image_free(texture.data);
+    }
+    return 0;
+}
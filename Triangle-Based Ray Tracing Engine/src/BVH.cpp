@@ -0,0 +1,840 @@
+#include "BVH.h"
+#include "Scene.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include "TileScheduler.h"
+#include "RenderStats.h"
+
+namespace
+{
+    const float TRAVERSAL_COST = 1.0f;  // relative to one triangle test
+
+    // Scene order of two faces, used to break ties between coincident triangles
+    bool precedes(const TriangleRef& a, const TriangleRef& b)
+    {
+        return a.meshIndex < b.meshIndex || (a.meshIndex == b.meshIndex && a.faceIndex < b.faceIndex);
+    }
+
+    // Corner k of a triangle, for the scene and for the triangle soup builds
+    struct SceneCorners
+    {
+        const Scene& scene;
+
+        const Vec3& operator()(const TriangleRef& ref, int k) const
+        {
+            return scene.vertexData[scene.objects.meshes[ref.meshIndex].faces[ref.faceIndex][k].vertexId];
+        }
+    };
+
+    struct SoupCorners
+    {
+        const Vec3* vertices;
+
+        const Vec3& operator()(const TriangleRef& ref, int k) const
+        {
+            return vertices[3 * ref.faceIndex + k];
+        }
+    };
+
+    float axisValue(const Vec3& v, int axis)
+    {
+        return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+    }
+
+    // First lane of a kernel result strictly inside (tMin, tMax), -1 if there is none
+    int firstOccluder(uint32_t mask, const float* laneT, float tMin, float tMax)
+    {
+        while (mask != 0)
+        {
+            int lane = __builtin_ctz(mask);
+            if (laneT[lane] > tMin && laneT[lane] < tMax) return lane;
+            mask &= mask - 1;
+        }
+        return -1;
+    }
+
+
+    // Interval bounds of a packet: origins and inverse directions of all active rays.
+    // Only coherent packets (same direction sign per axis, finite inverses) are culled as a whole.
+    struct PacketBounds
+    {
+        float oMin[3], oMax[3];
+        float invMin[3], invMax[3];
+        bool coherent;
+    };
+
+    PacketBounds computePacketBounds(const RayPacket& packet, uint32_t mask)
+    {
+        PacketBounds pb;
+        const float* o[3] = {packet.ox, packet.oy, packet.oz};
+        const float* inv[3] = {packet.invDx, packet.invDy, packet.invDz};
+        pb.coherent = true;
+
+        for (int a = 0; a < 3; ++a)
+        {
+            pb.oMin[a] = pb.invMin[a] = 1e30f;
+            pb.oMax[a] = pb.invMax[a] = -1e30f;
+            for (uint32_t m = mask; m != 0; m &= m - 1)
+            {
+                int lane = __builtin_ctz(m);
+                pb.oMin[a] = std::min(pb.oMin[a], o[a][lane]);
+                pb.oMax[a] = std::max(pb.oMax[a], o[a][lane]);
+                pb.invMin[a] = std::min(pb.invMin[a], inv[a][lane]);
+                pb.invMax[a] = std::max(pb.invMax[a], inv[a][lane]);
+            }
+            if (!std::isfinite(pb.invMin[a]) || !std::isfinite(pb.invMax[a]) || (pb.invMin[a] < 0 && pb.invMax[a] > 0))
+                pb.coherent = false;
+        }
+        return pb;
+    }
+
+    // Interval arithmetic slab test: true when no ray of the packet can enter the box before maxT
+    bool packetMissesBox(const PacketBounds& pb, const Vec3& bmin, const Vec3& bmax, float maxT)
+    {
+        if (!pb.coherent) return false;
+
+        float nearLower = -1e30f, farUpper = 1e30f;
+        for (int a = 0; a < 3; ++a)
+        {
+            bool positive = pb.invMin[a] > 0;
+            float nearPlane = axisValue(positive ? bmin : bmax, a);
+            float farPlane = axisValue(positive ? bmax : bmin, a);
+
+            // (plane - o) * inv over o in [oMin, oMax], inv in [invMin, invMax]
+            float n0 = (nearPlane - pb.oMax[a]) * pb.invMin[a], n1 = (nearPlane - pb.oMax[a]) * pb.invMax[a];
+            float n2 = (nearPlane - pb.oMin[a]) * pb.invMin[a], n3 = (nearPlane - pb.oMin[a]) * pb.invMax[a];
+            float f0 = (farPlane - pb.oMax[a]) * pb.invMin[a], f1 = (farPlane - pb.oMax[a]) * pb.invMax[a];
+            float f2 = (farPlane - pb.oMin[a]) * pb.invMin[a], f3 = (farPlane - pb.oMin[a]) * pb.invMax[a];
+
+            nearLower = std::max(nearLower, std::min(std::min(n0, n1), std::min(n2, n3)));
+            farUpper = std::min(farUpper, std::max(std::max(f0, f1), std::max(f2, f3)));
+        }
+
+        return nearLower > farUpper || farUpper < 0 || nearLower > maxT;
+    }
+
+    // Slab test of every lane of a packet, written branch free so the compiler vectorizes it
+    void intersectAABBLanes(const RayPacket& packet, const Vec3& bmin, const Vec3& bmax, float* tNear, float* tFar)
+    {
+        for (int i = 0; i < PACKET_SIZE; ++i)
+        {
+            float tx1 = (bmin.x - packet.ox[i]) * packet.invDx[i], tx2 = (bmax.x - packet.ox[i]) * packet.invDx[i];
+            float ty1 = (bmin.y - packet.oy[i]) * packet.invDy[i], ty2 = (bmax.y - packet.oy[i]) * packet.invDy[i];
+            float tz1 = (bmin.z - packet.oz[i]) * packet.invDz[i], tz2 = (bmax.z - packet.oz[i]) * packet.invDz[i];
+            tNear[i] = std::max(std::max(std::min(tx1, tx2), std::min(ty1, ty2)), std::min(tz1, tz2));
+            tFar[i] = std::min(std::min(std::max(tx1, tx2), std::max(ty1, ty2)), std::max(tz1, tz2));
+        }
+    }
+
+    // Per ray slab test of the lanes in mask, entry receives the entry distance per lane
+    uint32_t intersectAABBPacket(const RayPacket& packet, uint32_t mask, const Vec3& bmin, const Vec3& bmax,
+        const float* maxT, float* entry)
+    {
+        float tNear[PACKET_SIZE], tFar[PACKET_SIZE];
+        intersectAABBLanes(packet, bmin, bmax, tNear, tFar);
+
+        uint32_t result = 0;
+        for (uint32_t m = mask; m != 0; m &= m - 1)
+        {
+            int lane = __builtin_ctz(m);
+            if (tFar[lane] >= tNear[lane] && tFar[lane] >= 0 && tNear[lane] <= maxT[lane])
+            {
+                result |= 1u << lane;
+                entry[lane] = tNear[lane];
+            }
+        }
+        return result;
+    }
+
+    // Möller–Trumbore with one triangle (tri[i] = buffer entry i) broadcast against every lane
+    void intersectTriangleLanes(const TriangleBuffer& tris, int i, const RayPacket& packet,
+        float* det, float* t, float* beta, float* gamma)
+    {
+        float v0x = tris.v0x[i], v0y = tris.v0y[i], v0z = tris.v0z[i];
+        float e1x = tris.e1x[i], e1y = tris.e1y[i], e1z = tris.e1z[i];
+        float e2x = tris.e2x[i], e2y = tris.e2y[i], e2z = tris.e2z[i];
+
+        for (int k = 0; k < PACKET_SIZE; ++k)
+        {
+            float px = packet.dy[k] * e2z - packet.dz[k] * e2y;
+            float py = packet.dz[k] * e2x - packet.dx[k] * e2z;
+            float pz = packet.dx[k] * e2y - packet.dy[k] * e2x;
+            det[k] = e1x * px + e1y * py + e1z * pz;
+            float invDet = 1.0f / det[k];
+
+            float sx = packet.ox[k] - v0x, sy = packet.oy[k] - v0y, sz = packet.oz[k] - v0z;
+            beta[k] = (sx * px + sy * py + sz * pz) * invDet;
+
+            float qx = sy * e1z - sz * e1y;
+            float qy = sz * e1x - sx * e1z;
+            float qz = sx * e1y - sy * e1x;
+            gamma[k] = (packet.dx[k] * qx + packet.dy[k] * qy + packet.dz[k] * qz) * invDet;
+            t[k] = (e2x * qx + e2y * qy + e2z * qz) * invDet;
+        }
+    }
+}
+
+void AABB::grow(const Vec3& p)
+{
+    min = Vec3(std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z));
+    max = Vec3(std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z));
+}
+
+void AABB::grow(const AABB& box)
+{
+    if (box.min.x > box.max.x) return; // empty box
+    grow(box.min);
+    grow(box.max);
+}
+
+float AABB::area() const
+{
+    Vec3 e = max - min;
+    if (e.x < 0) return 0.0f;
+    return e.x * e.y + e.y * e.z + e.z * e.x;
+}
+
+bool parseBVHBuilder(const char* text, BVHBuilder& builder)
+{
+    if (std::strcmp(text, "sah") == 0) builder = BUILD_SAH;
+    else if (std::strcmp(text, "lbvh") == 0) builder = BUILD_LBVH;
+    else return false;
+    return true;
+}
+
+const char* getBVHBuilderName(BVHBuilder builder)
+{
+    return builder == BUILD_LBVH ? "LBVH" : "SAH";
+}
+
+void BVH::build(const Scene& scene, BVHBuilder builder, int threadCount)
+{
+    // 1. Collect every face of every mesh
+    triangles.clear();
+    for (int m = 0; m < static_cast<int>(scene.objects.meshes.size()); ++m)
+    {
+        const Mesh& mesh = scene.objects.meshes[m];
+        for (int f = 0; f < static_cast<int>(mesh.faces.size()); ++f)
+        {
+            triangles.push_back(TriangleRef{m, f});
+        }
+    }
+
+    buildTriangles(SceneCorners{scene}, builder, threadCount);
+}
+
+void BVH::build(const std::vector<Vec3>& vertices, BVHBuilder builder, int threadCount)
+{
+    int count = static_cast<int>(vertices.size() / 3);
+    triangles.resize(count);
+    for (int i = 0; i < count; ++i)
+    {
+        triangles[i] = TriangleRef{0, i};
+    }
+
+    buildTriangles(SoupCorners{vertices.data()}, builder, threadCount);
+}
+
+template <typename Corners>
+void BVH::buildTriangles(const Corners& corners, BVHBuilder builder, int threadCount)
+{
+    const int CHUNK_SIZE = 4096;
+
+    nodes.clear();
+    wideNodes.clear();
+
+    int count = static_cast<int>(triangles.size());
+    if (count == 0) return;
+
+    // 2. Per triangle bounds and centroids used by the builders
+    triBounds.resize(count);
+    triCentroids.resize(count);
+    triOrder.resize(count);
+
+    TileScheduler::parallelFor(count, CHUNK_SIZE, threadCount, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; ++i)
+        {
+            const Vec3& a = corners(triangles[i], 0);
+            const Vec3& b = corners(triangles[i], 1);
+            const Vec3& c = corners(triangles[i], 2);
+
+            triBounds[i] = AABB();
+            triBounds[i].grow(a);
+            triBounds[i].grow(b);
+            triBounds[i].grow(c);
+            triCentroids[i] = (a + b + c) * (1.0f / 3.0f);
+            triOrder[i] = i;
+        }
+    });
+
+    // 3. Either the recursive SAH subdivision starting from the root that holds
+    //    everything, or the Morton code build that produces all nodes at once
+    if (builder == BUILD_LBVH)
+    {
+        buildLBVH(threadCount);
+    }
+    else
+    {
+        nodes.reserve(2 * count);
+        BVHNode root;
+        root.leftFirst = 0;
+        root.triCount = count;
+        nodes.push_back(root);
+        updateNodeBounds(0);
+        subdivide(0);
+    }
+
+    // 4. Reorder the triangle references so every leaf is a contiguous range
+    std::vector<TriangleRef> ordered(count);
+    TileScheduler::parallelFor(count, CHUNK_SIZE, threadCount, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; ++i)
+        {
+            ordered[i] = triangles[triOrder[i]];
+        }
+    });
+    triangles.swap(ordered);
+
+    // 5. Pre-subtracted vertex data in leaf order for the SIMD kernels
+    fillTriangleBuffer(corners, threadCount);
+
+    nodes.shrink_to_fit();
+    std::vector<AABB>().swap(triBounds);
+    std::vector<Vec3>().swap(triCentroids);
+    std::vector<int>().swap(triOrder);
+}
+
+void BVH::restore(const Scene& scene, std::vector<BVHNode> savedNodes, std::vector<TriangleRef> savedTriangles, int threadCount)
+{
+    nodes.swap(savedNodes);
+    triangles.swap(savedTriangles);
+    wideNodes.clear();
+    fillTriangleBuffer(SceneCorners{scene}, threadCount);
+}
+
+void BVH::restore(const Vec3* vertices, std::vector<BVHNode> savedNodes, std::vector<TriangleRef> savedTriangles, int threadCount)
+{
+    nodes.swap(savedNodes);
+    triangles.swap(savedTriangles);
+    wideNodes.clear();
+    fillTriangleBuffer(SoupCorners{vertices}, threadCount);
+}
+
+template <typename Corners>
+void BVH::fillTriangleBuffer(const Corners& corners, int threadCount)
+{
+    const int CHUNK_SIZE = 4096;
+    int count = getTriangleCount();
+
+    triBuffer.resize(count);
+    TileScheduler::parallelFor(count, CHUNK_SIZE, threadCount, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; ++i)
+        {
+            triBuffer.set(i, corners(triangles[i], 0), corners(triangles[i], 1), corners(triangles[i], 2));
+        }
+    });
+}
+
+void BVH::updateNodeBounds(int nodeIndex)
+{
+    BVHNode& node = nodes[nodeIndex];
+    AABB box;
+
+    for (int i = 0; i < node.triCount; ++i)
+    {
+        box.grow(triBounds[triOrder[node.leftFirst + i]]);
+    }
+
+    node.boundsMin = box.min;
+    node.boundsMax = box.max;
+}
+
+float BVH::findBestSplit(const BVHNode& node, int& axis, float& splitPos) const
+{
+    float bestCost = 1e30f;
+
+    for (int a = 0; a < 3; ++a)
+    {
+        // Bin over the centroid bounds, not the node bounds
+        float boundsMin = 1e30f, boundsMax = -1e30f;
+        for (int i = 0; i < node.triCount; ++i)
+        {
+            float c = axisValue(triCentroids[triOrder[node.leftFirst + i]], a);
+            boundsMin = std::min(boundsMin, c);
+            boundsMax = std::max(boundsMax, c);
+        }
+        if (boundsMin == boundsMax) continue;
+
+        AABB binBounds[BIN_COUNT];
+        int binCount[BIN_COUNT] = {0};
+        float scale = BIN_COUNT / (boundsMax - boundsMin);
+
+        for (int i = 0; i < node.triCount; ++i)
+        {
+            int id = triOrder[node.leftFirst + i];
+            int bin = std::min(BIN_COUNT - 1, static_cast<int>((axisValue(triCentroids[id], a) - boundsMin) * scale));
+            binCount[bin]++;
+            binBounds[bin].grow(triBounds[id]);
+        }
+
+        // Sweep from both sides to get the area and count of every split plane
+        float leftArea[BIN_COUNT - 1], rightArea[BIN_COUNT - 1];
+        int leftCount[BIN_COUNT - 1], rightCount[BIN_COUNT - 1];
+        AABB leftBox, rightBox;
+        int leftSum = 0, rightSum = 0;
+
+        for (int i = 0; i < BIN_COUNT - 1; ++i)
+        {
+            leftSum += binCount[i];
+            leftCount[i] = leftSum;
+            leftBox.grow(binBounds[i]);
+            leftArea[i] = leftBox.area();
+
+            rightSum += binCount[BIN_COUNT - 1 - i];
+            rightCount[BIN_COUNT - 2 - i] = rightSum;
+            rightBox.grow(binBounds[BIN_COUNT - 1 - i]);
+            rightArea[BIN_COUNT - 2 - i] = rightBox.area();
+        }
+
+        float binWidth = (boundsMax - boundsMin) / BIN_COUNT;
+        for (int i = 0; i < BIN_COUNT - 1; ++i)
+        {
+            if (leftCount[i] == 0 || rightCount[i] == 0) continue;
+
+            float cost = leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                axis = a;
+                splitPos = boundsMin + binWidth * (i + 1);
+            }
+        }
+    }
+
+    return bestCost;
+}
+
+void BVH::subdivide(int rootIndex)
+{
+    // Explicit stack of (node, depth) so huge scenes cannot overflow the call stack
+    std::vector<std::pair<int, int>> stack;
+    stack.push_back({rootIndex, 0});
+
+    while (!stack.empty())
+    {
+        int nodeIndex = stack.back().first;
+        int depth = stack.back().second;
+        stack.pop_back();
+
+        BVHNode& node = nodes[nodeIndex];
+        if (node.triCount <= 2 || depth >= MAX_DEPTH) continue;
+
+        int axis = 0;
+        float splitPos = 0.0f;
+        float splitCost = findBestSplit(node, axis, splitPos);
+        if (splitCost >= 1e30f) continue; // all centroids coincide
+
+        AABB nodeBox;
+        nodeBox.min = node.boundsMin;
+        nodeBox.max = node.boundsMax;
+        float nodeArea = nodeBox.area();
+        float leafCost = node.triCount * nodeArea;
+
+        if (TRAVERSAL_COST * nodeArea + splitCost >= leafCost && node.triCount <= MAX_LEAF_SIZE) continue;
+
+        // Partition the triangle range around the split plane
+        int i = node.leftFirst;
+        int j = i + node.triCount - 1;
+        while (i <= j)
+        {
+            if (axisValue(triCentroids[triOrder[i]], axis) < splitPos)
+                i++;
+            else
+                std::swap(triOrder[i], triOrder[j--]);
+        }
+
+        int leftCount = i - node.leftFirst;
+        if (leftCount == 0 || leftCount == node.triCount) continue;
+
+        int leftIndex = static_cast<int>(nodes.size());
+
+        BVHNode left;
+        left.leftFirst = node.leftFirst;
+        left.triCount = leftCount;
+
+        BVHNode right;
+        right.leftFirst = i;
+        right.triCount = node.triCount - leftCount;
+
+        node.leftFirst = leftIndex;
+        node.triCount = 0;
+
+        nodes.push_back(left);
+        nodes.push_back(right);
+        updateNodeBounds(leftIndex);
+        updateNodeBounds(leftIndex + 1);
+
+        stack.push_back({leftIndex, depth + 1});
+        stack.push_back({leftIndex + 1, depth + 1});
+    }
+}
+
+void BVH::intersectTriangles(int first, int end, const Vec3& o, const Vec3& d, HitRecord& hit, bool& found) const
+{
+    float laneT[16], laneBeta[16], laneGamma[16];
+    RT_COUNT(triangleTests, end - first);
+
+    for (; first < end; first += kernel->width)
+    {
+        int count = std::min(kernel->width, end - first);
+        uint32_t mask = kernel->intersect(triBuffer, first, count, o, d, 0.0f, hit.t, laneT, laneBeta, laneGamma);
+
+        while (mask != 0)
+        {
+            int lane = __builtin_ctz(mask);
+            mask &= mask - 1;
+            int i = first + lane;
+            float t = laneT[lane];
+
+            // Equal distances go to the face that comes first in the scene, like a linear scan would
+            if (t < hit.t || (t == hit.t && found && precedes(triangles[i], triangles[hit.triIndex])))
+            {
+                hit.t = t;
+                hit.beta = laneBeta[lane];
+                hit.gamma = laneGamma[lane];
+                hit.triIndex = i;
+                found = true;
+            }
+        }
+    }
+}
+
+bool BVH::occludedTriangles(int first, int end, const Vec3& o, const Vec3& d, float tMin, float tMax, int& occluder) const
+{
+    float laneT[16], laneBeta[16], laneGamma[16];
+    RT_COUNT(triangleTests, end - first);
+
+    for (; first < end; first += kernel->width)
+    {
+        int count = std::min(kernel->width, end - first);
+        int lane = firstOccluder(kernel->intersect(triBuffer, first, count, o, d, tMin, tMax, laneT, laneBeta, laneGamma), laneT, tMin, tMax);
+        if (lane >= 0)
+        {
+            occluder = first + lane;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool BVH::intersect(const Ray& ray, HitRecord& hit) const
+{
+    Vec3 o = ray.getOrigin();
+    Vec3 d = ray.getDirection();
+    Vec3 invDir(1.0f / d.x, 1.0f / d.y, 1.0f / d.z);
+
+    RT_COUNT(bvhQueries, 1);
+    if (!wideNodes.empty()) return intersectWide(o, invDir, d, hit);
+    if (nodes.empty()) return false;
+
+    if (intersectAABB(o, invDir, nodes[0].boundsMin, nodes[0].boundsMax, hit.t) >= 1e30f) return false;
+
+    // Stack of far children together with their entry distance
+    int stack[64];
+    float stackDist[64];
+    int stackSize = 0;
+
+    int nodeIndex = 0;
+    bool found = false;
+
+    while (true)
+    {
+        const BVHNode& node = nodes[nodeIndex];
+        RT_COUNT(nodeVisits, 1);
+
+        if (node.isLeaf())
+        {
+            intersectTriangles(node.leftFirst, node.leftFirst + node.triCount, o, d, hit, found);
+        }
+        else
+        {
+            // Visit the nearer child first, remember the farther one
+            int near = node.leftFirst;
+            int far = node.leftFirst + 1;
+            float nearDist = intersectAABB(o, invDir, nodes[near].boundsMin, nodes[near].boundsMax, hit.t);
+            float farDist = intersectAABB(o, invDir, nodes[far].boundsMin, nodes[far].boundsMax, hit.t);
+
+            if (farDist < nearDist)
+            {
+                std::swap(near, far);
+                std::swap(nearDist, farDist);
+            }
+
+            if (nearDist < 1e30f)
+            {
+                if (farDist < 1e30f)
+                {
+                    stack[stackSize] = far;
+                    stackDist[stackSize++] = farDist;
+                }
+                nodeIndex = near;
+                continue;
+            }
+        }
+
+        // Pop the next far child that can still contain a closer hit
+        bool next = false;
+        while (stackSize > 0)
+        {
+            --stackSize;
+            if (stackDist[stackSize] <= hit.t)
+            {
+                nodeIndex = stack[stackSize];
+                next = true;
+                break;
+            }
+        }
+        if (!next) break;
+    }
+
+    return found;
+}
+
+bool BVH::occluded(const Ray& ray, float tMin, float tMax, int& occluder) const
+{
+    if (nodes.empty() && wideNodes.empty()) return false;
+
+    Vec3 o = ray.getOrigin();
+    Vec3 d = ray.getDirection();
+
+    RT_COUNT(bvhQueries, 1);
+
+    // 1. The last occluder usually still blocks the light for neighbouring pixels
+    if (occluder >= 0 && occluder < getTriangleCount() &&
+        occludedTriangles(occluder, occluder + 1, o, d, tMin, tMax, occluder))
+        return true;
+
+    // 2. Unordered traversal, the first triangle in range ends the query
+    Vec3 invDir(1.0f / d.x, 1.0f / d.y, 1.0f / d.z);
+    if (!wideNodes.empty()) return occludedWide(o, invDir, d, tMin, tMax, occluder);
+
+    int stack[64];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+
+    while (stackSize > 0)
+    {
+        const BVHNode& node = nodes[stack[--stackSize]];
+        RT_COUNT(nodeVisits, 1);
+
+        if (intersectAABB(o, invDir, node.boundsMin, node.boundsMax, tMax) >= 1e30f) continue;
+
+        if (node.isLeaf())
+        {
+            if (occludedTriangles(node.leftFirst, node.leftFirst + node.triCount, o, d, tMin, tMax, occluder))
+            {
+                return true;
+            }
+        }
+        else
+        {
+            stack[stackSize++] = node.leftFirst + 1;
+            stack[stackSize++] = node.leftFirst;
+        }
+    }
+
+    return false;
+}
+
+uint32_t BVH::intersectTrianglePacket(int triIndex, const RayPacket& packet, uint32_t mask,
+    const float* tMin, const float* tMax, float* t, float* beta, float* gamma) const
+{
+    float det[PACKET_SIZE];
+    RT_COUNT(triangleTests, __builtin_popcount(mask));
+    intersectTriangleLanes(triBuffer, triIndex, packet, det, t, beta, gamma);
+
+    uint32_t result = 0;
+    for (uint32_t m = mask; m != 0; m &= m - 1)
+    {
+        int lane = __builtin_ctz(m);
+        if (std::fabs(det[lane]) >= TriangleBuffer::DET_EPSILON && beta[lane] >= 0 && gamma[lane] >= 0 && beta[lane] + gamma[lane] <= 1 &&
+            t[lane] >= tMin[lane] && t[lane] <= tMax[lane])
+        {
+            result |= 1u << lane;
+        }
+    }
+    return result;
+}
+
+void BVH::intersectPacket(const RayPacket& packet, HitRecord* hits) const
+{
+    if (nodes.empty() || packet.active == 0) return;
+    RT_COUNT(bvhQueries, __builtin_popcount(packet.active));
+
+    PacketBounds bounds = computePacketBounds(packet, packet.active);
+    float hitT[PACKET_SIZE], zero[PACKET_SIZE], entry[PACKET_SIZE];
+    float laneT[PACKET_SIZE], laneBeta[PACKET_SIZE], laneGamma[PACKET_SIZE];
+    bool found[PACKET_SIZE];
+
+    for (int i = 0; i < PACKET_SIZE; ++i)
+    {
+        hitT[i] = hits[i].t;
+        zero[i] = 0.0f;
+        found[i] = false;
+    }
+
+    // Stack of (node, lanes that entered its parent)
+    int stack[64];
+    uint32_t stackMask[64];
+    int stackSize = 0;
+    stack[stackSize] = 0;
+    stackMask[stackSize++] = packet.active;
+
+    while (stackSize > 0)
+    {
+        --stackSize;
+        const BVHNode& node = nodes[stack[stackSize]];
+        RT_COUNT(nodeVisits, 1);
+
+        float maxT = 0.0f;
+        for (uint32_t m = stackMask[stackSize]; m != 0; m &= m - 1)
+        {
+            maxT = std::max(maxT, hitT[__builtin_ctz(m)]);
+        }
+
+        // 1. Whole packet rejection, 2. per ray test for the survivors
+        if (packetMissesBox(bounds, node.boundsMin, node.boundsMax, maxT)) continue;
+        uint32_t mask = intersectAABBPacket(packet, stackMask[stackSize], node.boundsMin, node.boundsMax, hitT, entry);
+        if (mask == 0) continue;
+
+        if (node.isLeaf())
+        {
+            for (int i = node.leftFirst; i < node.leftFirst + node.triCount; ++i)
+            {
+                uint32_t hitMask = intersectTrianglePacket(i, packet, mask, zero, hitT, laneT, laneBeta, laneGamma);
+
+                for (; hitMask != 0; hitMask &= hitMask - 1)
+                {
+                    int lane = __builtin_ctz(hitMask);
+                    HitRecord& hit = hits[lane];
+
+                    // Same scene order tie break as the single ray traversal
+                    if (laneT[lane] < hit.t || (found[lane] && precedes(triangles[i], triangles[hit.triIndex])))
+                    {
+                        hit.t = hitT[lane] = laneT[lane];
+                        hit.beta = laneBeta[lane];
+                        hit.gamma = laneGamma[lane];
+                        hit.triIndex = i;
+                        found[lane] = true;
+                    }
+                }
+            }
+        }
+        else
+        {
+            // Near child on top, judged by the first ray still in the packet
+            int lane = __builtin_ctz(mask);
+            const BVHNode& left = nodes[node.leftFirst];
+            const BVHNode& right = nodes[node.leftFirst + 1];
+            float leftDist = intersectAABB(Vec3(packet.ox[lane], packet.oy[lane], packet.oz[lane]),
+                Vec3(packet.invDx[lane], packet.invDy[lane], packet.invDz[lane]), left.boundsMin, left.boundsMax, 1e30f);
+            float rightDist = intersectAABB(Vec3(packet.ox[lane], packet.oy[lane], packet.oz[lane]),
+                Vec3(packet.invDx[lane], packet.invDy[lane], packet.invDz[lane]), right.boundsMin, right.boundsMax, 1e30f);
+
+            int near = node.leftFirst, far = node.leftFirst + 1;
+            if (rightDist < leftDist) std::swap(near, far);
+
+            stack[stackSize] = far;
+            stackMask[stackSize++] = mask;
+            stack[stackSize] = near;
+            stackMask[stackSize++] = mask;
+        }
+    }
+}
+
+uint32_t BVH::occludedPacket(const RayPacket& packet, const float* tMin, const float* tMax, int* occluders) const
+{
+    if (nodes.empty() || packet.active == 0) return 0;
+    RT_COUNT(bvhQueries, __builtin_popcount(packet.active));
+
+    float laneT[PACKET_SIZE], laneBeta[PACKET_SIZE], laneGamma[PACKET_SIZE], entry[PACKET_SIZE];
+    uint32_t occluded = 0;
+
+    // Triangle that tests strictly inside (tMin, tMax) for the lanes in mask
+    auto blocks = [&](int triIndex, uint32_t mask)
+    {
+        uint32_t hitMask = intersectTrianglePacket(triIndex, packet, mask, tMin, tMax, laneT, laneBeta, laneGamma);
+        uint32_t result = 0;
+        for (; hitMask != 0; hitMask &= hitMask - 1)
+        {
+            int lane = __builtin_ctz(hitMask);
+            if (laneT[lane] > tMin[lane] && laneT[lane] < tMax[lane]) result |= 1u << lane;
+        }
+        return result;
+    };
+
+    // 1. Cached occluders, lanes usually share the same one
+    for (uint32_t m = packet.active; m != 0; m &= m - 1)
+    {
+        int lane = __builtin_ctz(m);
+        int cached = occluders[lane];
+        if (cached < 0 || cached >= getTriangleCount() || (occluded >> lane & 1)) continue;
+
+        uint32_t sameCache = 0;
+        for (uint32_t n = m; n != 0; n &= n - 1)
+        {
+            if (occluders[__builtin_ctz(n)] == cached) sameCache |= 1u << __builtin_ctz(n);
+        }
+        occluded |= blocks(cached, sameCache & ~occluded);
+    }
+
+    uint32_t remaining = packet.active & ~occluded;
+    if (remaining == 0) return occluded;
+
+    // 2. Traversal for the rest, lanes drop out as soon as they are blocked
+    PacketBounds bounds = computePacketBounds(packet, remaining);
+    float maxT = 0.0f;
+    for (uint32_t m = remaining; m != 0; m &= m - 1)
+    {
+        maxT = std::max(maxT, tMax[__builtin_ctz(m)]);
+    }
+
+    int stack[64];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+
+    while (stackSize > 0 && remaining != 0)
+    {
+        const BVHNode& node = nodes[stack[--stackSize]];
+        RT_COUNT(nodeVisits, 1);
+
+        if (packetMissesBox(bounds, node.boundsMin, node.boundsMax, maxT)) continue;
+        uint32_t mask = intersectAABBPacket(packet, remaining, node.boundsMin, node.boundsMax, tMax, entry);
+        if (mask == 0) continue;
+
+        if (node.isLeaf())
+        {
+            for (int i = node.leftFirst; i < node.leftFirst + node.triCount && mask != 0; ++i)
+            {
+                uint32_t blocked = blocks(i, mask);
+                for (uint32_t m = blocked; m != 0; m &= m - 1)
+                {
+                    occluders[__builtin_ctz(m)] = i;
+                }
+                occluded |= blocked;
+                mask &= ~blocked;
+                remaining &= ~blocked;
+            }
+        }
+        else
+        {
+            stack[stackSize++] = node.leftFirst + 1;
+            stack[stackSize++] = node.leftFirst;
+        }
+    }
+
+    return occluded;
+}
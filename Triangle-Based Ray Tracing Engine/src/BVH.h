@@ -0,0 +1,192 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include "Vec3.h"
+#include "Ray.h"
+#include "TriangleBuffer.h"
+#include "RayPacket.h"
+
+class Scene;
+
+// Axis aligned bounding box
+struct AABB
+{
+    Vec3 min = Vec3(1e30f, 1e30f, 1e30f);
+    Vec3 max = Vec3(-1e30f, -1e30f, -1e30f);
+
+    void grow(const Vec3& p);
+    void grow(const AABB& box);
+    float area() const;
+};
+
+// Slab test against the box [bmin, bmax], returns the entry distance or 1e30 on a miss
+inline float intersectAABB(const Vec3& o, const Vec3& invDir, const Vec3& bmin, const Vec3& bmax, float maxT)
+{
+    float tx1 = (bmin.x - o.x) * invDir.x, tx2 = (bmax.x - o.x) * invDir.x;
+    float tmin = std::min(tx1, tx2), tmax = std::max(tx1, tx2);
+    float ty1 = (bmin.y - o.y) * invDir.y, ty2 = (bmax.y - o.y) * invDir.y;
+    tmin = std::max(tmin, std::min(ty1, ty2)); tmax = std::min(tmax, std::max(ty1, ty2));
+    float tz1 = (bmin.z - o.z) * invDir.z, tz2 = (bmax.z - o.z) * invDir.z;
+    tmin = std::max(tmin, std::min(tz1, tz2)); tmax = std::min(tmax, std::max(tz1, tz2));
+
+    if (tmax >= tmin && tmax >= 0 && tmin <= maxT) return tmin;
+    return 1e30f;
+}
+
+// Flattened BVH node (32 bytes).
+// Interior node: leftFirst = index of the left child, right child is leftFirst + 1
+// Leaf node:     leftFirst = index of the first triangle, triCount > 0
+struct BVHNode
+{
+    Vec3 boundsMin;
+    int leftFirst;
+    Vec3 boundsMax;
+    int triCount;
+
+    bool isLeaf() const { return triCount > 0; }
+};
+
+// Points a BVH triangle back to the mesh face it was built from
+struct TriangleRef
+{
+    int meshIndex;
+    int faceIndex;
+};
+
+// A hit as traversal keeps it, 16 bytes: the triangle, t and two barycentrics. The primary,
+// packet, wavefront and reflection traversals all return it; normal, material, uv and the
+// texture footprint are reconstructed from it once the closest hit is known.
+struct HitRecord
+{
+    int triIndex = -1;
+    float t = 1e9f;
+    float beta = 0.0f;
+    float gamma = 0.0f;
+};
+
+// 8-wide node with child boxes quantized to 8 bits per plane (Ylitie et al. 2017).
+// Child box i spans origin + q[i] * 2^exponent per axis, rounded outwards when built.
+// Interior children are stored from childBase on in slot order, the triangles of the
+// leaf children from triBase on, also in slot order (leafEnd is relative to triBase).
+struct BVH8Node
+{
+    Vec3 origin;
+    int childBase;
+    int triBase;
+    uint16_t leafEnd[8];        // end of the triangles of slots 0..i
+    int8_t exponent[3];
+    uint8_t interiorMask;       // bit i: slot i is a BVH8Node
+    uint8_t childCount;         // slots in use, always the first ones
+    uint8_t qlox[8], qloy[8], qloz[8];
+    uint8_t qhix[8], qhiy[8], qhiz[8];
+};
+
+// How BVH::build splits the triangles
+enum BVHBuilder
+{
+    BUILD_SAH,  // binned surface area heuristic, slower build, faster traversal
+    BUILD_LBVH  // Morton code order (linear BVH), parallel and built in a fraction of the time
+};
+
+bool parseBVHBuilder(const char* text, BVHBuilder& builder);
+const char* getBVHBuilderName(BVHBuilder builder);
+
+class BVH
+{
+    public:
+        // Builds over every face of every mesh in the scene, the LBVH builder and
+        // the per triangle set up run on threadCount threads
+        void build(const Scene& scene, BVHBuilder builder = BUILD_SAH, int threadCount = 1);
+
+        // Uses the nodes and triangle order of an earlier build (see SceneCache) instead of building
+        void restore(const Scene& scene, std::vector<BVHNode> savedNodes, std::vector<TriangleRef> savedTriangles, int threadCount = 1);
+        const std::vector<BVHNode>& getNodes() const { return nodes; }
+        const std::vector<TriangleRef>& getTriangles() const { return triangles; }
+
+        // Same for a triangle soup that is not part of a Scene (see ChunkCache): triangle i
+        // is vertices[3i .. 3i + 2] and its TriangleRef is {0, i}
+        void build(const std::vector<Vec3>& vertices, BVHBuilder builder = BUILD_SAH, int threadCount = 1);
+        void restore(const Vec3* vertices, std::vector<BVHNode> savedNodes, std::vector<TriangleRef> savedTriangles, int threadCount = 1);
+
+        // Collapses the binary tree into BVH8 nodes which intersect and occluded use from
+        // then on. Leaf triangles are regrouped so the leaves of a BVH8 node are adjacent;
+        // the binary nodes are freed unless the packet traversal still needs them.
+        // Returns false (and keeps the binary tree) when a BVH8 node would hold more leaf
+        // triangles than leafEnd can count.
+        bool buildWide(bool keepBinaryNodes);
+
+        // Closest hit along the ray with 0 <= t < hit.t
+        bool intersect(const Ray& ray, HitRecord& hit) const;
+
+        // Any hit with tMin < t < tMax, stops at the first occluder.
+        // occluder is tested before the traversal when >= 0 and is set to the blocking triangle.
+        bool occluded(const Ray& ray, float tMin, float tMax, int& occluder) const;
+
+        // Closest hits for the active rays of a packet, hits[lane].t is the per ray limit on entry.
+        // Nodes are first culled for the whole packet with interval arithmetic, then per ray.
+        void intersectPacket(const RayPacket& packet, HitRecord* hits) const;
+
+        // Any-hit for the active rays with tMin[lane] < t < tMax[lane], returns the mask of occluded
+        // lanes. occluders[lane] is tested first when >= 0 and receives the blocking triangle.
+        uint32_t occludedPacket(const RayPacket& packet, const float* tMin, const float* tMax, int* occluders) const;
+
+        // Leaf triangles are tested with this kernel, the widest supported one by default.
+        // BVH8 child boxes use AVX2 from SIMD_AVX2 on.
+        void setSimdLevel(SimdLevel level) { kernel = &getTriangleKernel(level); wideAVX2 = kernel->level >= SIMD_AVX2; }
+        const TriangleKernel& getKernel() const { return *kernel; }
+
+        const TriangleRef& getTriangle(int index) const { return triangles[index]; }
+        int getTriangleCount() const { return static_cast<int>(triangles.size()); }
+        int getNodeCount() const { return static_cast<int>(nodes.size()); }
+        int getWideNodeCount() const { return static_cast<int>(wideNodes.size()); }
+        size_t getNodeMemoryBytes() const { return nodes.size() * sizeof(BVHNode) + wideNodes.size() * sizeof(BVH8Node); }
+
+    private:
+        static const int BIN_COUNT = 16;
+        static const int MAX_LEAF_SIZE = 8;
+        static const int LBVH_LEAF_SIZE = 4;   // Morton ranges this small become one leaf
+        static const int MAX_DEPTH = 60;       // traversal stack is 64 entries deep
+
+        static const int WIDE_STACK_SIZE = 7 * MAX_DEPTH + 8;
+
+        std::vector<BVHNode> nodes;
+        std::vector<BVH8Node> wideNodes;  // empty unless buildWide was called
+        std::vector<TriangleRef> triangles;
+        TriangleBuffer triBuffer;  // vertex data of triangles[i] at index i
+        const TriangleKernel* kernel = &getTriangleKernel(detectSimdLevel());
+        bool wideAVX2 = kernel->level >= SIMD_AVX2;
+
+        // Build-time only data, indexed by the original triangle order
+        std::vector<AABB> triBounds;
+        std::vector<Vec3> triCentroids;
+        std::vector<int> triOrder;
+
+        // Leaf triangles [first, end), shared by the binary and the BVH8 traversal
+        void intersectTriangles(int first, int end, const Vec3& o, const Vec3& d, HitRecord& hit, bool& found) const;
+        bool occludedTriangles(int first, int end, const Vec3& o, const Vec3& d, float tMin, float tMax, int& occluder) const;
+
+        // BVH8 traversals (see BVH8.cpp)
+        bool intersectWide(const Vec3& o, const Vec3& invDir, const Vec3& d, HitRecord& hit) const;
+        bool occludedWide(const Vec3& o, const Vec3& invDir, const Vec3& d, float tMin, float tMax, int& occluder) const;
+
+        // Triangle triIndex against the lanes in mask, with the epsilon, edge and tMin <= t <= tMax
+        // tests of the leaf kernels so packets hit and shadow exactly where single rays do
+        uint32_t intersectTrianglePacket(int triIndex, const RayPacket& packet, uint32_t mask,
+            const float* tMin, const float* tMax, float* t, float* beta, float* gamma) const;
+
+        // corners(ref, k) is corner k of a triangle, see build
+        template <typename Corners> void buildTriangles(const Corners& corners, BVHBuilder builder, int threadCount);
+        template <typename Corners> void fillTriangleBuffer(const Corners& corners, int threadCount);
+        void updateNodeBounds(int nodeIndex);
+        float findBestSplit(const BVHNode& node, int& axis, float& splitPos) const;
+        void subdivide(int rootIndex);
+
+        // Linear BVH over the triangles sorted by the Morton code of their centroid, fills
+        // nodes and triOrder (see LBVH.cpp)
+        void buildLBVH(int threadCount);
+};
+
+#endif // BVH_H
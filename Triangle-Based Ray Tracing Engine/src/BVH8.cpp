@@ -0,0 +1,347 @@
+#include "BVH.h"
+#include "RenderStats.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <immintrin.h>
+
+// Collapse of the binary BVH into 8-wide nodes and their traversal. A BVH8 node
+// stores its child boxes as bytes relative to its own box, so one node (92 bytes)
+// replaces up to seven binary interior nodes and the boxes of eight children
+// (8 * 32 bytes), and a single 8-lane slab test replaces three levels of pairs.
+
+namespace
+{
+    const int WIDTH = 8;
+
+    // 2^exponent built from the bits, exponent in [-126, 127]
+    float exponentScale(int exponent)
+    {
+        uint32_t bits = static_cast<uint32_t>(exponent + 127) << 23;
+        float scale;
+        std::memcpy(&scale, &bits, sizeof(scale));
+        return scale;
+    }
+
+    // Smallest power of two step so that 255 steps from lo reach hi
+    int8_t chooseExponent(float lo, float hi)
+    {
+        float extent = hi - lo;
+        int exponent = extent > 0 ? static_cast<int>(std::ceil(std::log2(extent / 255.0f))) : -126;
+        exponent = std::min(std::max(exponent, -126), 127);
+        while (exponent < 127 && lo + 255.0f * exponentScale(exponent) < hi)
+            exponent++;
+        return static_cast<int8_t>(exponent);
+    }
+
+    // Quantized child planes, rounded outwards so the decoded box always contains the child
+    void quantize(float lo, float hi, float origin, float scale, uint8_t& qlo, uint8_t& qhi)
+    {
+        int low = std::min(std::max(static_cast<int>(std::floor((lo - origin) / scale)), 0), 255);
+        while (low > 0 && origin + low * scale > lo) low--;
+
+        int high = std::min(std::max(static_cast<int>(std::ceil((hi - origin) / scale)), 0), 255);
+        while (high < 255 && origin + high * scale < hi) high++;
+
+        qlo = static_cast<uint8_t>(low);
+        qhi = static_cast<uint8_t>(high);
+    }
+
+    float boxArea(const BVHNode& node)
+    {
+        AABB box;
+        box.min = node.boundsMin;
+        box.max = node.boundsMax;
+        return box.area();
+    }
+
+    // Slab test of the child boxes, same acceptance rule as the binary intersectAABB.
+    // Writes the entry distance per slot and returns the mask of slots hit.
+    uint32_t intersectChildrenScalar(const BVH8Node& node, const Vec3& o, const Vec3& invDir, float maxT, float* tNear)
+    {
+        float sx = exponentScale(node.exponent[0]);
+        float sy = exponentScale(node.exponent[1]);
+        float sz = exponentScale(node.exponent[2]);
+        uint32_t mask = 0;
+
+        for (int i = 0; i < node.childCount; ++i)
+        {
+            float tx1 = (node.origin.x + node.qlox[i] * sx - o.x) * invDir.x;
+            float tx2 = (node.origin.x + node.qhix[i] * sx - o.x) * invDir.x;
+            float ty1 = (node.origin.y + node.qloy[i] * sy - o.y) * invDir.y;
+            float ty2 = (node.origin.y + node.qhiy[i] * sy - o.y) * invDir.y;
+            float tz1 = (node.origin.z + node.qloz[i] * sz - o.z) * invDir.z;
+            float tz2 = (node.origin.z + node.qhiz[i] * sz - o.z) * invDir.z;
+
+            float tmin = std::max(std::max(std::min(tx1, tx2), std::min(ty1, ty2)), std::min(tz1, tz2));
+            float tmax = std::min(std::min(std::max(tx1, tx2), std::max(ty1, ty2)), std::max(tz1, tz2));
+
+            tNear[i] = tmin;
+            if (tmax >= tmin && tmax >= 0 && tmin <= maxT) mask |= 1u << i;
+        }
+        return mask;
+    }
+
+    __attribute__((target("avx2,fma")))
+    __m256 decodePlanes(const uint8_t* q, float origin, float scale)
+    {
+        __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(q));
+        __m256 steps = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes));
+        return _mm256_fmadd_ps(steps, _mm256_set1_ps(scale), _mm256_set1_ps(origin));
+    }
+
+    // All eight slabs at once
+    __attribute__((target("avx2,fma")))
+    uint32_t intersectChildrenAVX2(const BVH8Node& node, const Vec3& o, const Vec3& invDir, float maxT, float* tNear)
+    {
+        __m256 ox = _mm256_set1_ps(o.x), oy = _mm256_set1_ps(o.y), oz = _mm256_set1_ps(o.z);
+        __m256 ix = _mm256_set1_ps(invDir.x), iy = _mm256_set1_ps(invDir.y), iz = _mm256_set1_ps(invDir.z);
+
+        float sx = exponentScale(node.exponent[0]);
+        float sy = exponentScale(node.exponent[1]);
+        float sz = exponentScale(node.exponent[2]);
+
+        __m256 tx1 = _mm256_mul_ps(_mm256_sub_ps(decodePlanes(node.qlox, node.origin.x, sx), ox), ix);
+        __m256 tx2 = _mm256_mul_ps(_mm256_sub_ps(decodePlanes(node.qhix, node.origin.x, sx), ox), ix);
+        __m256 ty1 = _mm256_mul_ps(_mm256_sub_ps(decodePlanes(node.qloy, node.origin.y, sy), oy), iy);
+        __m256 ty2 = _mm256_mul_ps(_mm256_sub_ps(decodePlanes(node.qhiy, node.origin.y, sy), oy), iy);
+        __m256 tz1 = _mm256_mul_ps(_mm256_sub_ps(decodePlanes(node.qloz, node.origin.z, sz), oz), iz);
+        __m256 tz2 = _mm256_mul_ps(_mm256_sub_ps(decodePlanes(node.qhiz, node.origin.z, sz), oz), iz);
+
+        __m256 tmin = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(tx1, tx2), _mm256_min_ps(ty1, ty2)), _mm256_min_ps(tz1, tz2));
+        __m256 tmax = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(tx1, tx2), _mm256_max_ps(ty1, ty2)), _mm256_max_ps(tz1, tz2));
+
+        __m256 hit = _mm256_and_ps(_mm256_cmp_ps(tmax, tmin, _CMP_GE_OQ), _mm256_cmp_ps(tmax, _mm256_setzero_ps(), _CMP_GE_OQ));
+        hit = _mm256_and_ps(hit, _mm256_cmp_ps(tmin, _mm256_set1_ps(maxT), _CMP_LE_OQ));
+
+        _mm256_storeu_ps(tNear, tmin);
+        return static_cast<uint32_t>(_mm256_movemask_ps(hit)) & ((1u << node.childCount) - 1);
+    }
+
+    // Index of the BVH8Node in an interior slot
+    int interiorChild(const BVH8Node& node, int slot)
+    {
+        return node.childBase + __builtin_popcount(node.interiorMask & ((1u << slot) - 1));
+    }
+
+    // Triangle range of a leaf slot
+    void leafRange(const BVH8Node& node, int slot, int& first, int& end)
+    {
+        first = node.triBase + (slot > 0 ? node.leafEnd[slot - 1] : 0);
+        end = node.triBase + node.leafEnd[slot];
+    }
+
+    struct WideStackEntry
+    {
+        int node;
+        int slot;       // -1: test the children of node, otherwise the leaf in that slot
+        float dist;
+    };
+}
+
+bool BVH::buildWide(bool keepBinaryNodes)
+{
+    wideNodes.clear();
+    if (nodes.empty()) return true;
+
+    // 1. Top down: every BVH8 node opens the binary children with the largest area
+    //    until it has eight children or only leaves are left
+    std::vector<BVH8Node> wide(1);
+    std::vector<int> wideSource(1, 0);      // binary node each BVH8 node was made from
+    std::vector<int> triangleOrder;         // old triangle index of every new position
+    std::vector<int> newLeafFirst(nodes.size(), -1);
+    triangleOrder.reserve(triangles.size());
+
+    for (size_t w = 0; w < wide.size(); ++w)
+    {
+        const BVHNode& source = nodes[wideSource[w]];
+
+        int children[WIDTH];
+        int childCount = 0;
+        if (source.isLeaf())
+        {
+            children[childCount++] = wideSource[w];
+        }
+        else
+        {
+            children[childCount++] = source.leftFirst;
+            children[childCount++] = source.leftFirst + 1;
+        }
+
+        while (childCount < WIDTH)
+        {
+            int best = -1;
+            float bestArea = -1.0f;
+            for (int i = 0; i < childCount; ++i)
+            {
+                const BVHNode& child = nodes[children[i]];
+                if (!child.isLeaf() && boxArea(child) > bestArea)
+                {
+                    best = i;
+                    bestArea = boxArea(child);
+                }
+            }
+            if (best < 0) break;
+
+            int opened = children[best];
+            children[best] = nodes[opened].leftFirst;
+            children[childCount++] = nodes[opened].leftFirst + 1;
+        }
+
+        // 2. Quantization grid from the box of the binary node
+        BVH8Node node = BVH8Node();
+        node.origin = source.boundsMin;
+        node.exponent[0] = chooseExponent(source.boundsMin.x, source.boundsMax.x);
+        node.exponent[1] = chooseExponent(source.boundsMin.y, source.boundsMax.y);
+        node.exponent[2] = chooseExponent(source.boundsMin.z, source.boundsMax.z);
+        node.childCount = static_cast<uint8_t>(childCount);
+        node.childBase = static_cast<int>(wide.size());
+        node.triBase = static_cast<int>(triangleOrder.size());
+
+        float sx = exponentScale(node.exponent[0]);
+        float sy = exponentScale(node.exponent[1]);
+        float sz = exponentScale(node.exponent[2]);
+
+        int leafTriangles = 0;
+        for (int i = 0; i < childCount; ++i)
+        {
+            const BVHNode& child = nodes[children[i]];
+            quantize(child.boundsMin.x, child.boundsMax.x, node.origin.x, sx, node.qlox[i], node.qhix[i]);
+            quantize(child.boundsMin.y, child.boundsMax.y, node.origin.y, sy, node.qloy[i], node.qhiy[i]);
+            quantize(child.boundsMin.z, child.boundsMax.z, node.origin.z, sz, node.qloz[i], node.qhiz[i]);
+
+            // 3. Interior children become BVH8 nodes next to each other, the triangles
+            //    of the leaf children are moved next to each other
+            if (child.isLeaf())
+            {
+                newLeafFirst[children[i]] = static_cast<int>(triangleOrder.size());
+                for (int t = 0; t < child.triCount; ++t)
+                {
+                    triangleOrder.push_back(child.leftFirst + t);
+                }
+                leafTriangles += child.triCount;
+                if (leafTriangles > 0xffff)
+                {
+                    std::cerr << "BVH8 collapse skipped: more than 65535 leaf triangles under one node" << std::endl;
+                    return false;
+                }
+            }
+            else
+            {
+                node.interiorMask |= static_cast<uint8_t>(1u << i);
+                wide.push_back(BVH8Node());
+                wideSource.push_back(children[i]);
+            }
+            node.leafEnd[i] = static_cast<uint16_t>(leafTriangles);
+        }
+
+        wide[w] = node;
+    }
+
+    // 4. Apply the new triangle order to the triangle data and the binary leaves
+    std::vector<TriangleRef> reordered(triangles.size());
+    for (size_t i = 0; i < triangleOrder.size(); ++i)
+    {
+        reordered[i] = triangles[triangleOrder[i]];
+    }
+    triangles.swap(reordered);
+    triBuffer.reorder(triangleOrder);
+
+    for (size_t n = 0; n < nodes.size(); ++n)
+    {
+        if (newLeafFirst[n] >= 0) nodes[n].leftFirst = newLeafFirst[n];
+    }
+
+    wideNodes.swap(wide);
+    if (!keepBinaryNodes) std::vector<BVHNode>().swap(nodes);
+    return true;
+}
+
+bool BVH::intersectWide(const Vec3& o, const Vec3& invDir, const Vec3& d, HitRecord& hit) const
+{
+    WideStackEntry stack[WIDE_STACK_SIZE];
+    int stackSize = 0;
+    stack[stackSize++] = WideStackEntry{0, -1, 0.0f};
+    bool found = false;
+
+    while (stackSize > 0)
+    {
+        WideStackEntry entry = stack[--stackSize];
+        if (entry.dist > hit.t) continue;
+
+        const BVH8Node& node = wideNodes[entry.node];
+        RT_COUNT(nodeVisits, 1);
+
+        if (entry.slot >= 0)
+        {
+            int first, end;
+            leafRange(node, entry.slot, first, end);
+            intersectTriangles(first, end, o, d, hit, found);
+            continue;
+        }
+
+        float tNear[WIDTH];
+        uint32_t mask = wideAVX2 ? intersectChildrenAVX2(node, o, invDir, hit.t, tNear)
+                                 : intersectChildrenScalar(node, o, invDir, hit.t, tNear);
+
+        // Hit slots sorted far to near, so the nearest child is popped first
+        int order[WIDTH];
+        int count = 0;
+        for (; mask != 0; mask &= mask - 1)
+        {
+            int slot = __builtin_ctz(mask);
+            int k = count++;
+            while (k > 0 && tNear[order[k - 1]] < tNear[slot])
+            {
+                order[k] = order[k - 1];
+                k--;
+            }
+            order[k] = slot;
+        }
+
+        for (int k = 0; k < count; ++k)
+        {
+            int slot = order[k];
+            if (node.interiorMask & (1u << slot))
+                stack[stackSize++] = WideStackEntry{interiorChild(node, slot), -1, tNear[slot]};
+            else
+                stack[stackSize++] = WideStackEntry{entry.node, slot, tNear[slot]};
+        }
+    }
+
+    return found;
+}
+
+bool BVH::occludedWide(const Vec3& o, const Vec3& invDir, const Vec3& d, float tMin, float tMax, int& occluder) const
+{
+    int stack[WIDE_STACK_SIZE];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+
+    while (stackSize > 0)
+    {
+        const BVH8Node& node = wideNodes[stack[--stackSize]];
+        RT_COUNT(nodeVisits, 1);
+
+        float tNear[WIDTH];
+        uint32_t mask = wideAVX2 ? intersectChildrenAVX2(node, o, invDir, tMax, tNear)
+                                 : intersectChildrenScalar(node, o, invDir, tMax, tNear);
+
+        // Leaves right away, any triangle in range ends the query
+        for (uint32_t m = mask & ~static_cast<uint32_t>(node.interiorMask); m != 0; m &= m - 1)
+        {
+            int first, end;
+            leafRange(node, __builtin_ctz(m), first, end);
+            RT_COUNT(nodeVisits, 1);
+            if (occludedTriangles(first, end, o, d, tMin, tMax, occluder)) return true;
+        }
+
+        for (uint32_t m = mask & node.interiorMask; m != 0; m &= m - 1)
+        {
+            stack[stackSize++] = interiorChild(node, __builtin_ctz(m));
+        }
+    }
+
+    return false;
+}
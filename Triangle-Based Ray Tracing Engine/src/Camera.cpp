@@ -11,6 +11,11 @@ Camera::Camera(float distance, float left, float right, float bottom, float top,
 }
 
 Ray Camera::getRay(int i, int j) const 
+{
+    return getRay(i, j, 0.5f, 0.5f);
+}
+
+Ray Camera::getRay(int i, int j, float dx, float dy) const
 {
     float su, sv;
     Vec3 s;
@@ -27,8 +32,8 @@ Ray Camera::getRay(int i, int j) const
     // cout << "Gaze: " << gaze.x << " " << gaze.y << " " << gaze.z << endl;
     // cout << "Up: " << up.x << " " << up.y << " " << up.z << endl;
     // cout << "Origin: " << origin.x << " " << origin.y << " " << origin.z << endl;
-    su = (right - left) * (i + 0.5f) / nx;
-    sv = (top - bottom) * (j + 0.5f) / ny;
+    su = (right - left) * (i + dx) / nx;
+    sv = (top - bottom) * (j + dy) / ny;
 
     s = q + u*su - v*sv;
 
@@ -38,6 +43,13 @@ Ray Camera::getRay(int i, int j) const
     return ray;
 }
 
+RayDifferential Camera::getRayDifferential() const
+{
+    // s moves by one pixel along u to the right and along -v downwards, the origin stays
+    Vec3 zero(0, 0, 0);
+    return RayDifferential{zero, zero, u * ((right - left) / nx), v * (-(top - bottom) / ny)};
+}
+
 float Camera::getDistance() const 
 {
     return distance;
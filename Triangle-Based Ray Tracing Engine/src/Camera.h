@@ -9,6 +9,10 @@ class Camera
         Camera();
         Camera(float distance, float left, float right, float bottom, float top, int nx, int ny, Vec3 gaze, Vec3 up, Vec3 origin = Vec3(0.0, 0.0, 0.0));
         Ray getRay(int i, int j) const;
+        // Ray through the point (i + dx, j + dy) of the image plane, dx and dy in [0, 1)
+        Ray getRay(int i, int j, float dx, float dy) const;
+        // Differentials of getRay, the same for every pixel since directions are not normalised
+        RayDifferential getRayDifferential() const;
         float getDistance() const;
         float getLeft() const;
         float getRight() const;
@@ -19,6 +23,9 @@ class Camera
         void getGaze();
         void getOrigin();
         void getUp();
+        Vec3 getGazeVector() const { return gaze; }
+        Vec3 getOriginVector() const { return origin; }
+        Vec3 getUpVector() const { return up; }
 
     private:
         float distance, left, right, bottom, top;
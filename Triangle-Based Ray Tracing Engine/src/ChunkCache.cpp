@@ -0,0 +1,635 @@
+#include "ChunkCache.h"
+#include "TileScheduler.h"
+#include "RenderStats.h"
+#include "MappedFile.h"
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+#include <unistd.h>
+#include <sys/mman.h>
+
+namespace
+{
+    const char MAGIC[8] = {'R', 'T', 'C', 'H', 'U', 'N', 'K', '\0'};
+    const uint32_t VERSION = 3;
+    const uint64_t ALIGNMENT = 64;
+    const int TOP_LEAF_SIZE = 2;
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t chunkCount;
+        uint64_t sourceHash;
+        uint64_t fileSize;
+        uint64_t tableOffset;
+        int32_t triangleCount;
+        int32_t padding;
+    };
+
+    struct ChunkRecord
+    {
+        Vec3 boundsMin, boundsMax;
+        int32_t firstTriangle;
+        int32_t triangleCount;
+        int32_t nodeCount;
+        int32_t padding;
+        uint64_t offset;
+    };
+
+    static_assert(std::is_trivially_copyable<ChunkTriangle>::value && sizeof(ChunkTriangle) == 72, "ChunkTriangle layout");
+    static_assert(std::is_trivially_copyable<BVHNode>::value && sizeof(BVHNode) == 32, "BVHNode layout");
+    static_assert(std::is_trivially_copyable<TriangleRef>::value, "TriangleRef layout");
+
+    // Offsets of the arrays of a chunk relative to its start: BVH nodes, triangle refs of
+    // the BVH, vertices (3 per triangle, scene order) and shading (BVH order). Returns the size.
+    uint64_t chunkLayout(int nodeCount, int triangleCount, uint64_t offsets[4])
+    {
+        offsets[0] = 0;
+        offsets[1] = alignUp(offsets[0] + nodeCount * sizeof(BVHNode), ALIGNMENT);
+        offsets[2] = alignUp(offsets[1] + triangleCount * sizeof(TriangleRef), ALIGNMENT);
+        offsets[3] = alignUp(offsets[2] + 3 * static_cast<uint64_t>(triangleCount) * sizeof(Vec3), ALIGNMENT);
+        return alignUp(offsets[3] + triangleCount * sizeof(ChunkTriangle), ALIGNMENT);
+    }
+
+    // Every triangle ref of a chunk names one of its triangles and every node stays inside
+    // the chunk, so a damaged file cannot send pageIn or a traversal out of its arrays
+    bool validChunk(const char* chunk, int nodeCount, int triangleCount, const uint64_t offsets[4])
+    {
+        for (int i = 0; i < triangleCount; ++i)
+        {
+            TriangleRef ref;
+            std::memcpy(&ref, chunk + offsets[1] + i * sizeof(TriangleRef), sizeof(ref));
+            if (ref.faceIndex < 0 || ref.faceIndex >= triangleCount) return false;
+        }
+        for (int i = 0; i < nodeCount; ++i)
+        {
+            BVHNode node;
+            std::memcpy(&node, chunk + offsets[0] + i * sizeof(BVHNode), sizeof(node));
+            if (node.isLeaf() ? node.leftFirst < 0 || node.leftFirst > triangleCount - node.triCount
+                              : node.leftFirst <= i || node.leftFirst >= nodeCount - 1)
+                return false;
+        }
+        return true;
+    }
+
+    // Drops the process' pages of a range of the mapping, they fault back in from the file
+    void releasePages(const char* begin, uint64_t size)
+    {
+        uintptr_t pageSize = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+        uintptr_t pageStart = reinterpret_cast<uintptr_t>(begin) / pageSize * pageSize;
+        madvise(reinterpret_cast<void*>(pageStart), reinterpret_cast<uintptr_t>(begin) + size - pageStart, MADV_DONTNEED);
+    }
+
+    struct Range
+    {
+        int first, end;
+    };
+
+    // Triangles [first, end) of the BVH order below a node, both builders keep subtrees contiguous
+    Range subtreeRange(const std::vector<BVHNode>& nodes, int nodeIndex, std::vector<Range>& ranges)
+    {
+        const BVHNode& node = nodes[nodeIndex];
+        if (node.isLeaf())
+        {
+            ranges[nodeIndex] = Range{node.leftFirst, node.leftFirst + node.triCount};
+        }
+        else
+        {
+            Range left = subtreeRange(nodes, node.leftFirst, ranges);
+            Range right = subtreeRange(nodes, node.leftFirst + 1, ranges);
+            ranges[nodeIndex] = Range{std::min(left.first, right.first), std::max(left.end, right.end)};
+        }
+        return ranges[nodeIndex];
+    }
+
+    // Largest subtrees of at most limit triangles in depth first order (a larger leaf stays whole)
+    void collectSubtrees(const std::vector<BVHNode>& nodes, int nodeIndex, int limit,
+        const std::vector<Range>& ranges, std::vector<Range>& out)
+    {
+        const Range& range = ranges[nodeIndex];
+        if (range.end - range.first <= limit || nodes[nodeIndex].isLeaf())
+        {
+            out.push_back(range);
+            return;
+        }
+        collectSubtrees(nodes, nodes[nodeIndex].leftFirst, limit, ranges, out);
+        collectSubtrees(nodes, nodes[nodeIndex].leftFirst + 1, limit, ranges, out);
+    }
+
+    // One chunk on its way to the file
+    struct ChunkData
+    {
+        ChunkRecord record;
+        std::vector<BVHNode> nodes;
+        std::vector<TriangleRef> refs;
+        std::vector<Vec3> vertices;
+        std::vector<ChunkTriangle> shading;
+    };
+
+    ChunkTriangle getShading(const Scene& scene, const TriangleRef& ref)
+    {
+        const Mesh& mesh = scene.objects.meshes[ref.meshIndex];
+        const auto& face = mesh.faces[ref.faceIndex];
+
+        ChunkTriangle triangle;
+        triangle.materialId = mesh.materialId;
+        int normalId = face[0].normalId;
+        triangle.normal = normalId >= 0 && normalId < static_cast<int>(scene.normalData.size()) ? scene.normalData[normalId] : Vec3(0, 0, 0);
+        for (int k = 0; k < 3; ++k)
+        {
+            int textureId = face[k].textureId;
+            triangle.uv[k] = textureId >= 0 && textureId < static_cast<int>(scene.textureData.size()) ? scene.textureData[textureId] : Vec2f{0, 0};
+        }
+        const Vec3& v0 = scene.vertexData[face[0].vertexId];
+        triangle.edges[0] = scene.vertexData[face[1].vertexId] - v0;
+        triangle.edges[1] = scene.vertexData[face[2].vertexId] - v0;
+        triangle.meshIndex = ref.meshIndex;
+        triangle.faceIndex = ref.faceIndex;
+        return triangle;
+    }
+
+    // Vertices in scene order (so coincident faces keep their tie break), a BVH over
+    // them and the shading of every triangle in BVH order
+    void makeChunk(const Scene& scene, const Range& range, ChunkData& chunk)
+    {
+        std::vector<TriangleRef> sceneRefs(scene.bvh.getTriangles().begin() + range.first, scene.bvh.getTriangles().begin() + range.end);
+        std::sort(sceneRefs.begin(), sceneRefs.end(), [](const TriangleRef& a, const TriangleRef& b)
+        {
+            return a.meshIndex < b.meshIndex || (a.meshIndex == b.meshIndex && a.faceIndex < b.faceIndex);
+        });
+
+        chunk.vertices.clear();
+        for (const TriangleRef& ref : sceneRefs)
+        {
+            const auto& face = scene.objects.meshes[ref.meshIndex].faces[ref.faceIndex];
+            for (int k = 0; k < 3; ++k)
+                chunk.vertices.push_back(scene.vertexData[face[k].vertexId]);
+        }
+
+        BVH bvh;
+        bvh.build(chunk.vertices);
+        chunk.nodes = bvh.getNodes();
+        chunk.refs = bvh.getTriangles();
+
+        chunk.shading.resize(chunk.refs.size());
+        for (size_t i = 0; i < chunk.refs.size(); ++i)
+        {
+            chunk.shading[i] = getShading(scene, sceneRefs[chunk.refs[i].faceIndex]);
+        }
+
+        chunk.record = ChunkRecord();
+        chunk.record.boundsMin = chunk.nodes[0].boundsMin;
+        chunk.record.boundsMax = chunk.nodes[0].boundsMax;
+        chunk.record.firstTriangle = range.first;
+        chunk.record.triangleCount = range.end - range.first;
+        chunk.record.nodeCount = static_cast<int32_t>(chunk.nodes.size());
+    }
+}
+
+std::string ChunkCache::getChunkPath(const std::string& sceneFile)
+{
+    return sceneFile + ".rtchunks";
+}
+
+bool ChunkCache::write(const std::string& chunkFile, uint64_t sourceHash, const Scene& scene,
+    int trianglesPerChunk, int threadCount)
+{
+    const std::vector<BVHNode>& nodes = scene.bvh.getNodes();
+
+    // 1. Chunks are BVH subtrees, neighbouring small ones merged while they fit
+    std::vector<Range> subtrees;
+    if (!nodes.empty() && scene.bvh.getTriangleCount() > 0)
+    {
+        std::vector<Range> ranges(nodes.size());
+        subtreeRange(nodes, 0, ranges);
+        collectSubtrees(nodes, 0, trianglesPerChunk, ranges, subtrees);
+    }
+
+    std::vector<Range> chunkRanges;
+    for (const Range& range : subtrees)
+    {
+        if (!chunkRanges.empty() && range.end - chunkRanges.back().first <= trianglesPerChunk)
+            chunkRanges.back().end = range.end;
+        else
+            chunkRanges.push_back(range);
+    }
+
+    Header header = MappedFile::makeHeader<Header>(MAGIC, VERSION);
+    header.chunkCount = static_cast<uint32_t>(chunkRanges.size());
+    header.sourceHash = sourceHash;
+    header.triangleCount = scene.bvh.getTriangleCount();
+
+    return MappedFile::write(chunkFile, "chunk file", [&](std::ofstream& out)
+    {
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        // 2. Batches of chunks are built in parallel and appended in order, so only one
+        //    batch of chunk data is held in memory besides the scene
+        int chunkCount = static_cast<int>(chunkRanges.size());
+        int batchSize = std::max(1, threadCount) * 4;
+        std::vector<ChunkData> batch(batchSize);
+        std::vector<ChunkRecord> table;
+        uint64_t fileOffset = sizeof(header);
+        const char zeros[ALIGNMENT] = {};
+
+        for (int batchFirst = 0; batchFirst < chunkCount; batchFirst += batchSize)
+        {
+            int batchCount = std::min(batchSize, chunkCount - batchFirst);
+            TileScheduler::parallelFor(batchCount, 1, threadCount, [&](int begin, int end)
+            {
+                for (int i = begin; i < end; ++i)
+                    makeChunk(scene, chunkRanges[batchFirst + i], batch[i]);
+            });
+
+            for (int i = 0; i < batchCount; ++i)
+            {
+                ChunkData& chunk = batch[i];
+                uint64_t offsets[4];
+                uint64_t size = chunkLayout(chunk.record.nodeCount, chunk.record.triangleCount, offsets);
+
+                uint64_t start = alignUp(fileOffset, ALIGNMENT);
+                out.write(zeros, start - fileOffset);
+                chunk.record.offset = start;
+
+                const char* arrays[4] = {
+                    reinterpret_cast<const char*>(chunk.nodes.data()), reinterpret_cast<const char*>(chunk.refs.data()),
+                    reinterpret_cast<const char*>(chunk.vertices.data()), reinterpret_cast<const char*>(chunk.shading.data()) };
+                uint64_t bytes[4] = {
+                    chunk.nodes.size() * sizeof(BVHNode), chunk.refs.size() * sizeof(TriangleRef),
+                    chunk.vertices.size() * sizeof(Vec3), chunk.shading.size() * sizeof(ChunkTriangle) };
+
+                for (int a = 0; a < 4; ++a)
+                {
+                    uint64_t next = a < 3 ? offsets[a + 1] : size;
+                    out.write(arrays[a], bytes[a]);
+                    out.write(zeros, next - offsets[a] - bytes[a]);
+                }
+
+                fileOffset = start + size;
+                table.push_back(chunk.record);
+            }
+        }
+
+        // 3. Chunk table at the end, then the header again with its offset and the file size
+        header.tableOffset = alignUp(fileOffset, ALIGNMENT);
+        out.write(zeros, header.tableOffset - fileOffset);
+        out.write(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(ChunkRecord));
+        header.fileSize = header.tableOffset + table.size() * sizeof(ChunkRecord);
+        out.seekp(0);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        return true;
+    });
+}
+
+bool ChunkCache::open(const std::string& chunkFile, uint64_t sourceHash, size_t budgetBytes)
+{
+    // 1. The chunks of another XML are as stale as a file of another version
+    MappedFile file;
+    Header header;
+    if (!file.map(chunkFile, MAGIC, VERSION, header)) return false;
+
+    const char* base = file.getData();
+    bool valid = header.sourceHash == sourceHash && header.triangleCount >= 0 &&
+        file.contains(header.tableOffset, static_cast<uint64_t>(header.chunkCount) * sizeof(ChunkRecord));
+
+    // 2. Chunk table: the chunks lie inside the file and cover the triangles in order
+    //    without gaps (findChunk relies on that), their BVHs stay inside the chunk
+    std::vector<ChunkInfo> infos;
+    int nextTriangle = 0;
+    for (uint32_t i = 0; valid && i < header.chunkCount; ++i)
+    {
+        ChunkRecord record;
+        std::memcpy(&record, base + header.tableOffset + i * sizeof(ChunkRecord), sizeof(record));
+
+        uint64_t offsets[4];
+        valid = record.nodeCount > 0 && record.triangleCount > 0 && record.firstTriangle == nextTriangle &&
+            record.triangleCount <= header.triangleCount - record.firstTriangle &&
+            record.offset % ALIGNMENT == 0 &&
+            file.contains(record.offset, chunkLayout(record.nodeCount, record.triangleCount, offsets));
+        if (!valid) break;
+
+        valid = validChunk(base + record.offset, record.nodeCount, record.triangleCount, offsets);
+        releasePages(base + record.offset, offsets[2]);
+        nextTriangle = record.firstTriangle + record.triangleCount;
+
+        ChunkInfo chunk;
+        chunk.bounds.min = record.boundsMin;
+        chunk.bounds.max = record.boundsMax;
+        chunk.offset = record.offset;
+        chunk.firstTriangle = record.firstTriangle;
+        chunk.triangleCount = record.triangleCount;
+        chunk.nodeCount = record.nodeCount;
+        infos.push_back(chunk);
+    }
+    valid = valid && nextTriangle == header.triangleCount;
+
+    if (!valid) return false;
+
+    mapped = std::move(file);
+    budget = budgetBytes;
+    triangleCount = header.triangleCount;
+    chunks.swap(infos);
+
+    // 3. Chunks are in depth first order of the scene BVH, halving their list gives a
+    //    reasonable tree over the chunk bounds
+    topNodes.clear();
+    if (!chunks.empty())
+    {
+        topNodes.reserve(2 * chunks.size());
+        topNodes.push_back(BVHNode());
+        buildTopLevel(0, 0, getChunkCount());
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    slots.reset(new Slot[chunks.size()]);
+    for (size_t i = 0; i < chunks.size(); ++i)
+    {
+        slots[i].chunk = nullptr;
+        slots[i].pins = 0;
+        slots[i].referenced = false;
+    }
+    resident.clear();
+    resident.resize(chunks.size());
+    hand = 0;
+    stats = ChunkCacheStats();
+    return true;
+}
+
+void ChunkCache::buildTopLevel(int nodeIndex, int first, int last)
+{
+    AABB bounds;
+    for (int c = first; c < last; ++c)
+    {
+        bounds.grow(chunks[c].bounds);
+    }
+    topNodes[nodeIndex].boundsMin = bounds.min;
+    topNodes[nodeIndex].boundsMax = bounds.max;
+
+    if (last - first <= TOP_LEAF_SIZE)
+    {
+        topNodes[nodeIndex].leftFirst = first;
+        topNodes[nodeIndex].triCount = last - first;
+        return;
+    }
+
+    int left = static_cast<int>(topNodes.size());
+    topNodes[nodeIndex].leftFirst = left;
+    topNodes[nodeIndex].triCount = 0;
+    topNodes.push_back(BVHNode());
+    topNodes.push_back(BVHNode());
+
+    int middle = (first + last) / 2;
+    buildTopLevel(left, first, middle);
+    buildTopLevel(left + 1, middle, last);
+}
+
+int ChunkCache::findChunk(int triIndex) const
+{
+    auto after = std::upper_bound(chunks.begin(), chunks.end(), triIndex, [](int index, const ChunkInfo& chunk)
+    {
+        return index < chunk.firstTriangle;
+    });
+    return static_cast<int>(after - chunks.begin()) - 1;
+}
+
+ChunkCache::Pin ChunkCache::acquire(int chunkIndex) const
+{
+    RT_COUNT(chunkLookups, 1);
+    Slot& slot = slots[chunkIndex];
+
+    // 1. Resident: pinned and used without the lock
+    slot.pins.fetch_add(1);
+    const Chunk* chunk = slot.chunk.load();
+    if (chunk != nullptr)
+    {
+        if (!slot.referenced.load(std::memory_order_relaxed))
+            slot.referenced.store(true, std::memory_order_relaxed);
+        return Pin(chunk, &slot.pins);
+    }
+    slot.pins.fetch_sub(1, std::memory_order_release);
+
+    // 2. Read outside the lock so other threads keep tracing through resident chunks
+    std::unique_ptr<const Chunk> loaded = pageIn(chunkIndex);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    slot.pins.fetch_add(1);
+    slot.referenced.store(true, std::memory_order_relaxed);
+    if (resident[chunkIndex])
+    {
+        // Another thread paged it in meanwhile
+        return Pin(resident[chunkIndex].get(), &slot.pins);
+    }
+
+    stats.pageIns++;
+    stats.residentChunks++;
+    stats.residentBytes += loaded->bytes;
+    resident[chunkIndex] = std::move(loaded);
+    slot.chunk.store(resident[chunkIndex].get());
+
+    // 3. Second chance: a chunk visited since the hand last passed stays for another round.
+    //    Chunks other threads are traversing stay too, two rounds end the sweep even when
+    //    those alone are over budget.
+    size_t count = chunks.size();
+    for (size_t step = 0; stats.residentBytes > budget && stats.residentChunks > 1 && step < 2 * count; ++step)
+    {
+        hand = (hand + 1) % count;
+        if (hand == static_cast<size_t>(chunkIndex) || !resident[hand]) continue;
+        if (slots[hand].referenced.exchange(false, std::memory_order_relaxed)) continue;
+        drop(hand);
+    }
+    stats.peakResidentBytes = std::max(stats.peakResidentBytes, stats.residentBytes);
+    return Pin(resident[chunkIndex].get(), &slot.pins);
+}
+
+void ChunkCache::drop(size_t chunkIndex) const
+{
+    // Readers that pinned the slot before chunk was cleared are seen here and keep it
+    Slot& slot = slots[chunkIndex];
+    slot.chunk.store(nullptr);
+    if (slot.pins.load() > 0)
+    {
+        slot.chunk.store(resident[chunkIndex].get());
+        return;
+    }
+
+    stats.residentBytes -= resident[chunkIndex]->bytes;
+    stats.residentChunks--;
+    stats.evictions++;
+    resident[chunkIndex].reset();
+}
+
+std::unique_ptr<const ChunkCache::Chunk> ChunkCache::pageIn(int chunkIndex) const
+{
+    const ChunkInfo& info = chunks[chunkIndex];
+    const char* base = mapped.getData() + info.offset;
+    uint64_t offsets[4];
+    uint64_t size = chunkLayout(info.nodeCount, info.triangleCount, offsets);
+
+    const BVHNode* nodes = reinterpret_cast<const BVHNode*>(base + offsets[0]);
+    const TriangleRef* refs = reinterpret_cast<const TriangleRef*>(base + offsets[1]);
+    const Vec3* vertices = reinterpret_cast<const Vec3*>(base + offsets[2]);
+    const ChunkTriangle* shading = reinterpret_cast<const ChunkTriangle*>(base + offsets[3]);
+
+    std::unique_ptr<Chunk> chunk(new Chunk());
+    chunk->bvh.restore(vertices, std::vector<BVHNode>(nodes, nodes + info.nodeCount),
+        std::vector<TriangleRef>(refs, refs + info.triangleCount));
+    chunk->bvh.setSimdLevel(simdLevel);
+    chunk->shading.assign(shading, shading + info.triangleCount);
+    chunk->bytes = info.nodeCount * sizeof(BVHNode) +
+        info.triangleCount * (sizeof(TriangleRef) + 9 * sizeof(float) + sizeof(ChunkTriangle));
+
+    // Everything was copied, the file pages do not need to stay in memory
+    releasePages(base, size);
+
+    return chunk;
+}
+
+bool ChunkCache::intersect(const Ray& ray, HitRecord& hit) const
+{
+    if (topNodes.empty()) return false;
+
+    Vec3 o = ray.getOrigin();
+    Vec3 d = ray.getDirection();
+    Vec3 invDir(1.0f / d.x, 1.0f / d.y, 1.0f / d.z);
+
+    if (intersectAABB(o, invDir, topNodes[0].boundsMin, topNodes[0].boundsMax, hit.t) >= 1e30f) return false;
+
+    // Near child first like BVH::intersect, chunks are only paged in when the ray reaches their box
+    int stack[64];
+    float stackDist[64];
+    int stackSize = 0;
+    int nodeIndex = 0;
+    bool found = false;
+
+    while (true)
+    {
+        const BVHNode& node = topNodes[nodeIndex];
+
+        if (node.isLeaf())
+        {
+            for (int c = node.leftFirst; c < node.leftFirst + node.triCount; ++c)
+            {
+                const ChunkInfo& info = chunks[c];
+                if (intersectAABB(o, invDir, info.bounds.min, info.bounds.max, hit.t) >= 1e30f) continue;
+
+                Pin chunk = acquire(c);
+                HitRecord local;
+                local.t = hit.t;
+                if (chunk->bvh.intersect(ray, local))
+                {
+                    hit = local;
+                    hit.triIndex += info.firstTriangle;
+                    found = true;
+                }
+            }
+        }
+        else
+        {
+            int near = node.leftFirst;
+            int far = node.leftFirst + 1;
+            float nearDist = intersectAABB(o, invDir, topNodes[near].boundsMin, topNodes[near].boundsMax, hit.t);
+            float farDist = intersectAABB(o, invDir, topNodes[far].boundsMin, topNodes[far].boundsMax, hit.t);
+
+            if (farDist < nearDist)
+            {
+                std::swap(near, far);
+                std::swap(nearDist, farDist);
+            }
+
+            if (nearDist < 1e30f)
+            {
+                if (farDist < 1e30f)
+                {
+                    stack[stackSize] = far;
+                    stackDist[stackSize++] = farDist;
+                }
+                nodeIndex = near;
+                continue;
+            }
+        }
+
+        bool next = false;
+        while (stackSize > 0)
+        {
+            --stackSize;
+            if (stackDist[stackSize] <= hit.t)
+            {
+                nodeIndex = stack[stackSize];
+                next = true;
+                break;
+            }
+        }
+        if (!next) break;
+    }
+
+    return found;
+}
+
+bool ChunkCache::occluded(const Ray& ray, float tMin, float tMax, int& occluder) const
+{
+    if (topNodes.empty()) return false;
+
+    // 1. The chunk of the last occluder first, its BVH tests that triangle before anything else
+    int occluderChunk = occluder >= 0 && occluder < triangleCount ? findChunk(occluder) : -1;
+    if (occluderChunk >= 0)
+    {
+        const ChunkInfo& info = chunks[occluderChunk];
+        int local = occluder - info.firstTriangle;
+        if (acquire(occluderChunk)->bvh.occluded(ray, tMin, tMax, local))
+        {
+            occluder = info.firstTriangle + local;
+            return true;
+        }
+    }
+
+    // 2. Every other chunk the ray passes through
+    Vec3 o = ray.getOrigin();
+    Vec3 d = ray.getDirection();
+    Vec3 invDir(1.0f / d.x, 1.0f / d.y, 1.0f / d.z);
+
+    int stack[64];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+
+    while (stackSize > 0)
+    {
+        const BVHNode& node = topNodes[stack[--stackSize]];
+        if (intersectAABB(o, invDir, node.boundsMin, node.boundsMax, tMax) >= 1e30f) continue;
+
+        if (node.isLeaf())
+        {
+            for (int c = node.leftFirst; c < node.leftFirst + node.triCount; ++c)
+            {
+                const ChunkInfo& info = chunks[c];
+                if (c == occluderChunk || intersectAABB(o, invDir, info.bounds.min, info.bounds.max, tMax) >= 1e30f) continue;
+
+                int local = -1;
+                if (acquire(c)->bvh.occluded(ray, tMin, tMax, local))
+                {
+                    occluder = info.firstTriangle + local;
+                    return true;
+                }
+            }
+        }
+        else
+        {
+            stack[stackSize++] = node.leftFirst + 1;
+            stack[stackSize++] = node.leftFirst;
+        }
+    }
+
+    return false;
+}
+
+ChunkTriangle ChunkCache::getTriangle(int triIndex) const
+{
+    int c = findChunk(triIndex);
+    return acquire(c)->shading[triIndex - chunks[c].firstTriangle];
+}
+
+ChunkCacheStats ChunkCache::getStats() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
@@ -0,0 +1,142 @@
+#ifndef CHUNKCACHE_H
+#define CHUNKCACHE_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include "Scene.h"
+#include "MappedFile.h"
+
+// Shading inputs of one triangle, copied out of the meshes so a chunk needs nothing else
+struct ChunkTriangle
+{
+    int materialId;
+    Vec3 normal;        // normal of the first corner, like the resident path uses
+    Vec2f uv[3];
+    Vec3 edges[2];      // second and third corner minus the first, for texture footprints
+    int meshIndex;      // the face in the scene, which unlike the triangle index does not
+    int faceIndex;      // depend on the BVH; shading seeds its random numbers from it
+};
+
+struct ChunkCacheStats
+{
+    long long pageIns = 0;
+    long long evictions = 0;
+    size_t residentBytes = 0;
+    size_t peakResidentBytes = 0;
+    int residentChunks = 0;
+};
+
+// Out-of-core geometry. The triangles are cut into spatially coherent chunks (subtrees of
+// the scene BVH) and written to <scene>.rtchunks, every chunk with its own BVH, vertices
+// and per triangle shading data. Rendering maps that file and pages chunks in on demand
+// into a cache bounded by a byte budget that drops the chunks not visited for a while
+// (clock order); rays first traverse a small tree over the chunk bounds. Visits to a
+// resident chunk take no lock, only page-ins do. Hits carry global triangle indices, the
+// first index of the chunk plus the index inside the chunk BVH.
+class ChunkCache
+{
+    public:
+        static const int DEFAULT_CHUNK_TRIANGLES = 16384;
+
+        static std::string getChunkPath(const std::string& sceneFile);
+
+        // Writes the chunks of a scene whose BVH is built (call before BVH::buildWide)
+        static bool write(const std::string& chunkFile, uint64_t sourceHash, const Scene& scene,
+            int trianglesPerChunk, int threadCount);
+
+        ChunkCache() = default;
+        ChunkCache(const ChunkCache&) = delete;
+        ChunkCache& operator=(const ChunkCache&) = delete;
+
+        // Maps the chunk file, false when it is missing or was written for another scene.
+        // At most budgetBytes of chunks stay paged in, the chunks in use are never dropped.
+        bool open(const std::string& chunkFile, uint64_t sourceHash, size_t budgetBytes);
+        bool isOpen() const { return mapped.isMapped(); }
+
+        // Same contracts as BVH::intersect and BVH::occluded
+        bool intersect(const Ray& ray, HitRecord& hit) const;
+        bool occluded(const Ray& ray, float tMin, float tMax, int& occluder) const;
+
+        // Shading data of a hit triangle, pages its chunk in again if it was dropped
+        ChunkTriangle getTriangle(int triIndex) const;
+
+        void setSimdLevel(SimdLevel level) { simdLevel = level; }
+
+        int getChunkCount() const { return static_cast<int>(chunks.size()); }
+        int getTriangleCount() const { return triangleCount; }
+        ChunkCacheStats getStats() const;
+
+    private:
+        // Where a chunk lives in the file
+        struct ChunkInfo
+        {
+            AABB bounds;
+            uint64_t offset;
+            int firstTriangle;
+            int triangleCount;
+            int nodeCount;
+        };
+
+        // A paged in chunk, shading[i] belongs to triangle i of the BVH
+        struct Chunk
+        {
+            BVH bvh;
+            std::vector<ChunkTriangle> shading;
+            size_t bytes = 0;
+        };
+
+        // What readers see of a chunk without the lock. A reader pins the slot before it
+        // loads chunk, the sweep clears chunk before it reads pins and puts it back when the
+        // slot is pinned, so a chunk is never freed while a thread traverses it.
+        struct Slot
+        {
+            std::atomic<const Chunk*> chunk;
+            std::atomic<int> pins;
+            std::atomic<bool> referenced;   // visited since the sweep last passed
+        };
+
+        // A pinned chunk, unpinned when the Pin goes out of scope
+        class Pin
+        {
+            public:
+                Pin(const Chunk* chunk, std::atomic<int>* pins) : chunk(chunk), pins(pins) {}
+                Pin(Pin&& other) noexcept : chunk(other.chunk), pins(other.pins) { other.pins = nullptr; }
+                Pin(const Pin&) = delete;
+                Pin& operator=(const Pin&) = delete;
+                ~Pin() { if (pins != nullptr) pins->fetch_sub(1, std::memory_order_release); }
+
+                const Chunk* operator->() const { return chunk; }
+
+            private:
+                const Chunk* chunk;
+                std::atomic<int>* pins;
+        };
+
+        MappedFile mapped;
+        size_t budget = 0;
+        int triangleCount = 0;
+        SimdLevel simdLevel = detectSimdLevel();
+
+        std::vector<ChunkInfo> chunks;
+        std::vector<BVHNode> topNodes;  // leaves hold ranges of chunks
+
+        // Clock over the chunks: the lock guards resident (which owns the chunks), the
+        // hand and the stats, the slots are read without it
+        mutable std::mutex mutex;
+        std::unique_ptr<Slot[]> slots;
+        mutable std::vector<std::unique_ptr<const Chunk>> resident;
+        mutable size_t hand = 0;
+        mutable ChunkCacheStats stats;
+
+        void buildTopLevel(int nodeIndex, int first, int last);
+        int findChunk(int triIndex) const;
+        Pin acquire(int chunkIndex) const;
+        std::unique_ptr<const Chunk> pageIn(int chunkIndex) const;
+        void drop(size_t chunkIndex) const;
+};
+
+#endif // CHUNKCACHE_H
@@ -0,0 +1,77 @@
+#include "CompiledScene.h"
+#include "Scene.h"
+#include <cmath>
+
+namespace
+{
+    // Larger whole exponents still fit the squarings of an int, but no material is that shiny
+    const float MAX_INTEGER_PHONG = 65536.0f;
+}
+
+void CompiledScene::build(const Scene& scene)
+{
+    ambientIntensity = Vec3(0, 0, 0);
+    pointLights = PointLights();
+    areaLights.clear();
+    materials.clear();
+
+    // 1. Lights by type; the first ambient light counts, like the search per hit did before
+    bool hasAmbient = false;
+    for (const auto& light : scene.lights)
+    {
+        if (light->type == LightType::AMBIENT)
+        {
+            if (!hasAmbient)
+                ambientIntensity = light->intensity;
+            hasAmbient = true;
+        }
+        else if (light->type == LightType::POINT)
+        {
+            const auto& pl = static_cast<const PointLight&>(*light);
+            pointLights.x.push_back(pl.position.x);
+            pointLights.y.push_back(pl.position.y);
+            pointLights.z.push_back(pl.position.z);
+            pointLights.intensity.push_back(pl.intensity);
+        }
+        else if (light->type == LightType::TRIANGLE)
+        {
+            const auto& tl = static_cast<const TriangleLight&>(*light);
+            Vec3 cross = (tl.v1 - tl.v0).cross(tl.v2 - tl.v0);
+            float area = cross.length() * 0.5f;
+            if (!(area > 0.0f))
+                continue;   // degenerate, lights nothing
+            areaLights.push_back(AreaLight{ tl.v0, tl.v1, tl.v2, cross.normalized(), area, tl.intensity });
+        }
+    }
+
+    // 2. Materials with their ambient term and flags
+    materials.reserve(scene.materials.size());
+    for (const Material& mat : scene.materials)
+    {
+        ShadingMaterial m;
+        m.ambient = Color(
+            mat.ambient.x * ambientIntensity.x / 255.0f,
+            mat.ambient.y * ambientIntensity.y / 255.0f,
+            mat.ambient.z * ambientIntensity.z / 255.0f
+        );
+        m.diffuse = mat.diffuse;
+        m.specular = mat.specular;
+        m.mirror = mat.mirrorReflectance;
+        m.phongExponent = mat.phongExponent;
+        m.phongPower = 0;
+        m.textureFactor = mat.texturefactor;
+        m.textureId = mat.textureId;
+        m.flags = 0;
+
+        if (mat.mirrorReflectance.x > 0 || mat.mirrorReflectance.y > 0 || mat.mirrorReflectance.z > 0)
+            m.flags |= ShadingMaterial::MIRROR;
+        if (mat.texturefactor != 0.0f)
+            m.flags |= ShadingMaterial::TEXTURED;
+        if (mat.phongExponent >= 0.0f && mat.phongExponent <= MAX_INTEGER_PHONG && std::floor(mat.phongExponent) == mat.phongExponent)
+        {
+            m.flags |= ShadingMaterial::INTEGER_PHONG;
+            m.phongPower = static_cast<int>(mat.phongExponent);
+        }
+        materials.push_back(m);
+    }
+}
@@ -0,0 +1,70 @@
+#ifndef COMPILEDSCENE_H
+#define COMPILEDSCENE_H
+
+#include <vector>
+#include "Vec3.h"
+#include "Color.h"
+
+class Scene;
+
+// Point lights as a structure of arrays, positions apart from intensities
+struct PointLights
+{
+    std::vector<float> x, y, z;
+    std::vector<Vec3> intensity;
+
+    int size() const { return static_cast<int>(x.size()); }
+    Vec3 position(int i) const { return Vec3(x[i], y[i], z[i]); }
+};
+
+// Triangle light with what sampling it needs precomputed
+struct AreaLight
+{
+    Vec3 v0, v1, v2;
+    Vec3 normal;        // unit, the side it shines to: (v1 - v0) x (v2 - v0)
+    float area;
+    Vec3 intensity;
+};
+
+// The shading terms of a Material without its names, and which of them it uses
+struct ShadingMaterial
+{
+    enum Flag
+    {
+        MIRROR = 1,             // some mirrorReflectance channel above 0
+        TEXTURED = 2,           // texture factor not 0, the texture is sampled
+        INTEGER_PHONG = 4       // phongExponent is a whole number, phongPower holds it
+    };
+
+    Color ambient;              // times the scene's ambient light, the whole ambient term
+    Vec3 diffuse, specular, mirror;
+    float phongExponent;
+    int phongPower;
+    float textureFactor;
+    int textureId;
+    unsigned flags;
+
+    bool has(Flag flag) const { return (flags & flag) != 0; }
+};
+
+// The lights and materials of a parsed scene in the form shading reads them, built once
+// before rendering: no shared_ptr, no type checks, no search for the ambient light per hit.
+// Lights are numbered point lights first, then triangle lights; the light tree, shadow
+// slots and the per light occluder cache all use these numbers.
+class CompiledScene
+{
+    public:
+        Vec3 ambientIntensity;      // 0 without an ambient light
+        PointLights pointLights;
+        std::vector<AreaLight> areaLights;
+        std::vector<ShadingMaterial> materials;     // materials[id - 1], like Scene::materials
+
+        // Needs the materials' texture ids, call after they are assigned
+        void build(const Scene& scene);
+
+        int getLightCount() const { return pointLights.size() + static_cast<int>(areaLights.size()); }
+        bool isAreaLight(int light) const { return light >= pointLights.size(); }
+        const AreaLight& getAreaLight(int light) const { return areaLights[light - pointLights.size()]; }
+};
+
+#endif // COMPILEDSCENE_H
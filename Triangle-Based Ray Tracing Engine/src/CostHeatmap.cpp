@@ -0,0 +1,118 @@
+#include "CostHeatmap.h"
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+    // Black - purple - red - orange - white, evenly spaced
+    const float RAMP[5][3] =
+    {
+        { 0.0f, 0.0f, 0.0f },
+        { 0.25f, 0.05f, 0.55f },
+        { 0.85f, 0.15f, 0.35f },
+        { 1.0f, 0.6f, 0.1f },
+        { 1.0f, 1.0f, 1.0f }
+    };
+
+    Color rampColor(double value)
+    {
+        float t = static_cast<float>(std::max(0.0, std::min(1.0, value))) * 4.0f;
+        int i = std::min(3, static_cast<int>(t));
+        float f = t - i;
+        return Color(RAMP[i][0] + (RAMP[i + 1][0] - RAMP[i][0]) * f,
+                     RAMP[i][1] + (RAMP[i + 1][1] - RAMP[i][1]) * f,
+                     RAMP[i][2] + (RAMP[i + 1][2] - RAMP[i][2]) * f);
+    }
+}
+
+bool parseHeatmapMetric(const char* text, HeatmapMetric& metric)
+{
+    if (std::strcmp(text, "triangles") == 0) metric = HEATMAP_TRIANGLES;
+    else if (std::strcmp(text, "nodes") == 0) metric = HEATMAP_NODES;
+    else if (std::strcmp(text, "shadow") == 0) metric = HEATMAP_SHADOW;
+    else if (std::strcmp(text, "time") == 0) metric = HEATMAP_TIME;
+    else return false;
+    return true;
+}
+
+const char* getHeatmapMetricName(HeatmapMetric metric)
+{
+    switch (metric)
+    {
+        case HEATMAP_TRIANGLES: return "triangle tests";
+        case HEATMAP_NODES: return "BVH nodes visited";
+        case HEATMAP_SHADOW: return "shadow rays";
+        case HEATMAP_TIME: return "nanoseconds";
+        default: return "none";
+    }
+}
+
+CostHeatmap::CostHeatmap(int width, int height, HeatmapMetric metric)
+    : width(width), height(height), metric(metric), cost(static_cast<size_t>(width) * height, 0.0)
+{
+}
+
+CostHeatmap::Sample CostHeatmap::begin()
+{
+    Sample sample;
+    sample.counters = RenderStats::local();
+    sample.start = std::chrono::steady_clock::now();
+    return sample;
+}
+
+void CostHeatmap::end(int x, int y, const Sample& sample)
+{
+    const ThreadStats& now = RenderStats::local();
+    double value = 0.0;
+
+    switch (metric)
+    {
+        case HEATMAP_TRIANGLES: value = static_cast<double>(now.triangleTests - sample.counters.triangleTests); break;
+        case HEATMAP_NODES: value = static_cast<double>(now.nodeVisits - sample.counters.nodeVisits); break;
+        case HEATMAP_SHADOW: value = static_cast<double>(now.shadowRays - sample.counters.shadowRays); break;
+        case HEATMAP_TIME:
+            value = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - sample.start).count();
+            break;
+        default: break;
+    }
+    cost[static_cast<size_t>(y) * width + x] = value;
+}
+
+double CostHeatmap::toImage(Image& image) const
+{
+    // 1. White point at the 99th percentile
+    std::vector<double> sorted = cost;
+    size_t rank = sorted.empty() ? 0 : (sorted.size() - 1) * 99 / 100;
+    double scale = 0.0;
+    if (!sorted.empty())
+    {
+        std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+        scale = sorted[rank];
+    }
+    if (scale <= 0.0) scale = std::max(1.0, getMax());
+
+    // 2. Ramp colour per pixel
+    for (int y = 0; y < height; ++y)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            image.setPixel(x, y, rampColor(cost[static_cast<size_t>(y) * width + x] / scale));
+        }
+    }
+    return scale;
+}
+
+double CostHeatmap::getMean() const
+{
+    double sum = 0.0;
+    for (double value : cost)
+    {
+        sum += value;
+    }
+    return cost.empty() ? 0.0 : sum / cost.size();
+}
+
+double CostHeatmap::getMax() const
+{
+    return cost.empty() ? 0.0 : *std::max_element(cost.begin(), cost.end());
+}
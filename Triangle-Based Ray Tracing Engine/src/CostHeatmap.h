@@ -0,0 +1,53 @@
+#ifndef COSTHEATMAP_H
+#define COSTHEATMAP_H
+
+#include <chrono>
+#include <vector>
+#include "Image.h"
+#include "RenderStats.h"
+
+// What a heatmap pixel shows, all of it summed over the whole ray tree of the pixel
+enum HeatmapMetric
+{
+    HEATMAP_NONE,
+    HEATMAP_TRIANGLES,  // ray/triangle tests
+    HEATMAP_NODES,      // BVH nodes visited
+    HEATMAP_SHADOW,     // shadow rays traced
+    HEATMAP_TIME        // wall clock nanoseconds, also works without render statistics
+};
+
+bool parseHeatmapMetric(const char* text, HeatmapMetric& metric);
+const char* getHeatmapMetricName(HeatmapMetric metric);
+
+// Cost of every pixel of a render, written out as a false colour image instead of the
+// shaded one. Render threads measure their own pixels (begin / end around the pixel on
+// the same thread), so no locking is needed; colours are scaled so that the 99th
+// percentile cost is white and a few extreme pixels do not wash out the rest.
+class CostHeatmap
+{
+    public:
+        // Snapshot taken before a pixel is traced
+        struct Sample
+        {
+            ThreadStats counters;
+            std::chrono::steady_clock::time_point start;
+        };
+
+        CostHeatmap(int width, int height, HeatmapMetric metric);
+
+        static Sample begin();
+        void end(int x, int y, const Sample& sample);
+
+        // Fills image with the colour ramp, returns the cost mapped to white
+        double toImage(Image& image) const;
+
+        double getMean() const;
+        double getMax() const;
+
+    private:
+        int width, height;
+        HeatmapMetric metric;
+        std::vector<double> cost;   // row major
+};
+
+#endif // COSTHEATMAP_H
@@ -0,0 +1,189 @@
+#include "GeometryText.h"
+#include "TileScheduler.h"
+#include <atomic>
+#include <charconv>
+#include <cstring>
+
+namespace
+{
+    const size_t CHUNK_BYTES = 1 << 20;
+
+    bool isSpace(char c)
+    {
+        return c == ' ' || (c >= '\t' && c <= '\r');
+    }
+
+    // [begin, end) of the text, the first token of the chunk has index firstToken
+    struct TextChunk
+    {
+        const char* begin;
+        const char* end;
+        size_t firstToken;
+    };
+
+    // Pieces of about CHUNK_BYTES, every boundary moved forward onto whitespace so no
+    // token is cut in two
+    std::vector<TextChunk> splitChunks(const char* text, size_t length)
+    {
+        std::vector<TextChunk> chunks;
+        const char* end = text + length;
+        const char* begin = text;
+
+        while (begin < end)
+        {
+            const char* split = end - begin > static_cast<ptrdiff_t>(CHUNK_BYTES) ? begin + CHUNK_BYTES : end;
+            while (split < end && !isSpace(*split)) ++split;
+            chunks.push_back(TextChunk{begin, split, 0});
+            begin = split;
+        }
+        return chunks;
+    }
+
+    size_t countTokens(const char* p, const char* end)
+    {
+        size_t count = 0;
+        while (true)
+        {
+            while (p < end && isSpace(*p)) ++p;
+            if (p == end) break;
+            ++count;
+            while (p < end && !isSpace(*p)) ++p;
+        }
+        return count;
+    }
+
+    // 1. chunks count their tokens
+    // 2. resize(total) sizes the output and returns how many tokens to decode
+    // 3. chunks call decode(token, tokenEnd, tokenIndex) for their tokens below that
+    template <typename Resize, typename Decode>
+    bool decodeTokens(const char* text, int threadCount, Resize resize, Decode decode)
+    {
+        if (text == nullptr)
+        {
+            resize(0);
+            return true;
+        }
+
+        std::vector<TextChunk> chunks = splitChunks(text, std::strlen(text));
+        int chunkCount = static_cast<int>(chunks.size());
+
+        std::vector<size_t> counts(chunkCount);
+        TileScheduler::parallelFor(chunkCount, 1, threadCount, [&](int first, int last)
+        {
+            for (int c = first; c < last; ++c)
+                counts[c] = countTokens(chunks[c].begin, chunks[c].end);
+        });
+
+        size_t total = 0;
+        for (int c = 0; c < chunkCount; ++c)
+        {
+            chunks[c].firstToken = total;
+            total += counts[c];
+        }
+        size_t limit = resize(total);
+
+        std::atomic<bool> valid(true);
+        TileScheduler::parallelFor(chunkCount, 1, threadCount, [&](int first, int last)
+        {
+            for (int c = first; c < last; ++c)
+            {
+                const char* p = chunks[c].begin;
+                const char* end = chunks[c].end;
+                for (size_t index = chunks[c].firstToken; index < limit; ++index)
+                {
+                    while (p < end && isSpace(*p)) ++p;
+                    if (p == end) break;
+
+                    const char* tokenEnd = p;
+                    while (tokenEnd < end && !isSpace(*tokenEnd)) ++tokenEnd;
+
+                    if (!decode(p, tokenEnd, index))
+                    {
+                        valid.store(false, std::memory_order_relaxed);
+                        return;
+                    }
+                    p = tokenEnd;
+                }
+            }
+        });
+        return valid.load();
+    }
+
+    // The whole token has to be one number, a leading '+' is allowed like in operator>>
+    bool parseFloat(const char* p, const char* end, float& value)
+    {
+        if (p < end && *p == '+') ++p;
+        std::from_chars_result result = std::from_chars(p, end, value);
+        return result.ec == std::errc() && result.ptr == end;
+    }
+
+    // Reads an integer from p on, p is moved past it
+    bool parseInt(const char*& p, const char* end, int& value)
+    {
+        if (p < end && *p == '+') ++p;
+        std::from_chars_result result = std::from_chars(p, end, value);
+        if (result.ec != std::errc()) return false;
+        p = result.ptr;
+        return true;
+    }
+
+    // "v", "v/t", "v//n" or "v/t/n", a missing index reads as 0 (-1 once converted)
+    bool parseFaceIndex(const char* p, const char* end, FaceIndex& index)
+    {
+        index.textureId = 0;
+        index.normalId = 0;
+
+        if (!parseInt(p, end, index.vertexId)) return false;
+        if (p < end && *p == '/')
+        {
+            ++p;
+            if (p < end && *p != '/' && !parseInt(p, end, index.textureId)) return false;
+            if (p < end && *p == '/')
+            {
+                ++p;
+                if (!parseInt(p, end, index.normalId)) return false;
+            }
+        }
+        return p == end;
+    }
+}
+
+bool GeometryText::decodeVec3s(const char* text, std::vector<Vec3>& out, int threadCount)
+{
+    static float Vec3::* const axes[3] = { &Vec3::x, &Vec3::y, &Vec3::z };
+
+    return decodeTokens(text, threadCount,
+        [&](size_t tokens) { out.resize(tokens / 3); return out.size() * 3; },
+        [&](const char* p, const char* end, size_t index)
+        {
+            return parseFloat(p, end, out[index / 3].*axes[index % 3]);
+        });
+}
+
+bool GeometryText::decodeVec2fs(const char* text, std::vector<Vec2f>& out, int threadCount)
+{
+    return decodeTokens(text, threadCount,
+        [&](size_t tokens) { out.resize(tokens / 2); return out.size() * 2; },
+        [&](const char* p, const char* end, size_t index)
+        {
+            Vec2f& uv = out[index / 2];
+            return parseFloat(p, end, index % 2 == 0 ? uv.u : uv.v);
+        });
+}
+
+bool GeometryText::decodeFaces(const char* text, std::vector<std::array<FaceIndex, 3>>& out, int threadCount)
+{
+    return decodeTokens(text, threadCount,
+        [&](size_t tokens) { out.resize(tokens / 3); return out.size() * 3; },
+        [&](const char* p, const char* end, size_t index)
+        {
+            FaceIndex& corner = out[index / 3][index % 3];
+            if (!parseFaceIndex(p, end, corner)) return false;
+
+            // OBJ-like format: index starts at 1, so convert to 0-based
+            corner.vertexId--;
+            corner.textureId--;
+            corner.normalId--;
+            return true;
+        });
+}
@@ -0,0 +1,27 @@
+#ifndef GEOMETRYTEXT_H
+#define GEOMETRYTEXT_H
+
+#include <array>
+#include <vector>
+#include "Vec3.h"
+#include "Scene.h"
+
+// Decoders for the large whitespace separated blocks of a scene file (<vertexdata>,
+// <normaldata>, <texturedata>, <faces>). The text is split into chunks at whitespace,
+// every chunk counts its tokens, the output is sized once from the counts, then every
+// chunk decodes straight into its own slots with std::from_chars. Chunks run on
+// threadCount threads, blocks below a few MB stay on the calling thread.
+//
+// Like the stream extraction they replace, a trailing incomplete group is dropped.
+// They return false on a malformed token; out is then only partly filled.
+class GeometryText
+{
+    public:
+        static bool decodeVec3s(const char* text, std::vector<Vec3>& out, int threadCount = 1);
+        static bool decodeVec2fs(const char* text, std::vector<Vec2f>& out, int threadCount = 1);
+
+        // "v/t/n v/t/n v/t/n" per triangle, converted from 1-based to 0-based indices
+        static bool decodeFaces(const char* text, std::vector<std::array<FaceIndex, 3>>& out, int threadCount = 1);
+};
+
+#endif // GEOMETRYTEXT_H
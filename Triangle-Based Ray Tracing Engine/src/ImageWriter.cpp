@@ -1,6 +1,12 @@
 #include "ImageWriter.h"
 #include <iostream>
 #include <fstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
 
 ImageWriter::ImageWriter() = default;
 ImageWriter::~ImageWriter() = default;
@@ -36,3 +42,155 @@ void ImageWriter::writePPM(const char* filename, const Image& image)
     out.close();
     std::cout << "PPM is written: " << filename << "\n";
 }
+
+void ImageWriter::packRows(const Image& image, int y0, int y1, uint8_t* out)
+{
+    int width = image.getWidth();
+
+    for (int y = y0; y < y1; ++y)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            const Color& c = image.getPixel(x, y);
+            *out++ = static_cast<uint8_t>(c.toInt(c.getColorR()));
+            *out++ = static_cast<uint8_t>(c.toInt(c.getColorG()));
+            *out++ = static_cast<uint8_t>(c.toInt(c.getColorB()));
+        }
+    }
+}
+
+void ImageWriter::writePPMBinary(const char* filename, const Image& image, int threadCount)
+{
+    int width = image.getWidth();
+    int height = image.getHeight();
+    std::string header = "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+
+    // 1. Header and packed pixels in one buffer
+    std::vector<uint8_t> buffer(header.size() + static_cast<size_t>(width) * height * 3);
+    std::copy(header.begin(), header.end(), buffer.begin());
+    uint8_t* pixels = buffer.data() + header.size();
+
+    // 2. Pack bands of rows in parallel
+    threadCount = std::max(1, std::min(threadCount, height));
+    std::vector<std::thread> threads;
+    for (int t = 0; t < threadCount; ++t)
+    {
+        int y0 = height * t / threadCount;
+        int y1 = height * (t + 1) / threadCount;
+        threads.emplace_back(packRows, std::cref(image), y0, y1, pixels + static_cast<size_t>(y0) * width * 3);
+    }
+    for (auto& th : threads)
+    {
+        th.join();
+    }
+
+    // 3. One write for the whole file
+    std::ofstream out(filename, std::ios::binary);
+    if (!out)
+    {
+        std::cerr << "Error opening file for writing: " << filename << std::endl;
+        return;
+    }
+
+    out.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+    out.close();
+    std::cout << "PPM is written: " << filename << "\n";
+}
+
+StreamingPPMWriter::StreamingPPMWriter()
+    : fd(-1), width(0), height(0), bandHeight(0), bandCount(0), headerSize(0), bandsWritten(0), failed(false) {}
+
+StreamingPPMWriter::~StreamingPPMWriter()
+{
+    if (fd >= 0) ::close(fd);
+}
+
+bool StreamingPPMWriter::open(const char* filename, int width, int height, int bandHeight)
+{
+    this->width = width;
+    this->height = height;
+    this->bandHeight = std::max(1, bandHeight);
+    bandCount = (height + this->bandHeight - 1) / this->bandHeight;
+    bandsWritten = 0;
+    failed = false;
+
+    bandPixels.reset(new std::atomic<int>[bandCount]);
+    for (int b = 0; b < bandCount; ++b)
+    {
+        bandPixels[b] = 0;
+    }
+
+    fd = ::open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        std::cerr << "Error opening file for writing: " << filename << std::endl;
+        return false;
+    }
+
+    // Header first, then size the file so bands can land anywhere in it
+    std::string header = "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+    headerSize = static_cast<long>(header.size());
+
+    if (::write(fd, header.data(), header.size()) != static_cast<ssize_t>(header.size()) ||
+        ::ftruncate(fd, headerSize + static_cast<long>(width) * height * 3) != 0)
+    {
+        std::cerr << "Error writing file: " << filename << std::endl;
+        failed = true;
+        return false;
+    }
+
+    return true;
+}
+
+void StreamingPPMWriter::tileFinished(const Image& image, int x0, int y0, int x1, int y1)
+{
+    if (fd < 0) return;
+
+    for (int band = y0 / bandHeight; band * bandHeight < y1; ++band)
+    {
+        int rowStart = std::max(y0, band * bandHeight);
+        int rowEnd = std::min(y1, std::min(height, (band + 1) * bandHeight));
+        int pixels = (x1 - x0) * (rowEnd - rowStart);
+
+        int bandSize = width * (std::min(height, (band + 1) * bandHeight) - band * bandHeight);
+
+        // The thread that completes the band writes it
+        if (bandPixels[band].fetch_add(pixels) + pixels == bandSize)
+        {
+            writeBand(image, band);
+        }
+    }
+}
+
+void StreamingPPMWriter::writeBand(const Image& image, int band)
+{
+    int y0 = band * bandHeight;
+    int y1 = std::min(height, y0 + bandHeight);
+
+    std::vector<uint8_t> buffer(static_cast<size_t>(width) * (y1 - y0) * 3);
+    ImageWriter::packRows(image, y0, y1, buffer.data());
+
+    off_t offset = headerSize + static_cast<off_t>(y0) * width * 3;
+    if (::pwrite(fd, buffer.data(), buffer.size(), offset) != static_cast<ssize_t>(buffer.size()))
+    {
+        failed = true;
+        return;
+    }
+
+    bandsWritten++;
+}
+
+bool StreamingPPMWriter::close()
+{
+    if (fd < 0) return false;
+
+    bool complete = !failed && bandsWritten == bandCount;
+    ::close(fd);
+    fd = -1;
+
+    if (!complete)
+    {
+        std::cerr << "Streaming PPM incomplete: " << bandsWritten << " of " << bandCount << " bands written" << std::endl;
+    }
+    return complete;
+}
@@ -2,6 +2,9 @@
 #define ImageWriter_H
 
 #include "Image.h"
+#include <atomic>
+#include <memory>
+#include <cstdint>
 
 class ImageWriter {
 public:
@@ -10,6 +13,41 @@ public:
 
     void writePPM(const char* filename, const Image& image);
     void writePNG(const char* filename, const Image& image);
+
+    // Binary P6: the image is packed to 8-bit RGB on threadCount threads and written with a single write
+    void writePPMBinary(const char* filename, const Image& image, int threadCount = 1);
+
+    // Packs rows [y0, y1) as 8-bit RGB into out (3 bytes per pixel)
+    static void packRows(const Image& image, int y0, int y1, uint8_t* out);
+};
+
+// Writes a binary P6 file while the image is still being rendered.
+// The file is laid out up front; a band of bandHeight rows is packed and written
+// at its final offset by whichever thread completes the band's last tile.
+class StreamingPPMWriter {
+public:
+    StreamingPPMWriter();
+    ~StreamingPPMWriter();
+
+    bool open(const char* filename, int width, int height, int bandHeight);
+
+    // Reports that pixels [x0, x1) x [y0, y1) of image are final
+    void tileFinished(const Image& image, int x0, int y0, int x1, int y1);
+
+    // Returns false when some band was never completed or a write failed
+    bool close();
+
+    int getBandsWritten() const { return bandsWritten; }
+
+private:
+    int fd;
+    int width, height, bandHeight, bandCount;
+    long headerSize;
+    std::unique_ptr<std::atomic<int>[]> bandPixels;  // finished pixels per band
+    std::atomic<int> bandsWritten;
+    std::atomic<bool> failed;
+
+    void writeBand(const Image& image, int band);
 };
 
-#endif // ImageWriter_H
\ No newline at end of file
+#endif // ImageWriter_H
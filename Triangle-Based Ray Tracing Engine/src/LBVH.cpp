@@ -0,0 +1,298 @@
+#include "BVH.h"
+#include "TileScheduler.h"
+#include "Morton.h"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+
+// Linear BVH after Karras, "Maximizing Parallelism in the Construction of BVHs,
+// Octrees, and k-d Trees" (HPG 2012). The triangles are sorted by the Morton code
+// of their centroid, after which every interior node can find its own range and
+// split independently of all others:
+//   1. Morton codes and a parallel radix sort
+//   2. range, split and parent of every interior node
+//   3. bounds bottom up, the second child to arrive at a node computes its box
+//   4. emission into the flattened node layout, small ranges become leaves
+// There are count - 1 interior nodes (index i) and count leaves (sorted triangle j).
+
+namespace
+{
+    const int CHUNK_SIZE = 4096;
+    const int MORTON_BITS = 21;     // per axis, 63 bits in total
+    const int RADIX_BITS = 11;
+    const int RADIX_PASSES = (3 * MORTON_BITS + RADIX_BITS - 1) / RADIX_BITS;
+    const int RADIX_BUCKETS = 1 << RADIX_BITS;
+
+    // Runs body(block, begin, end) for blockCount equal slices of [0, count).
+    // Unlike the dynamic chunks of parallelFor, block b always gets the same slice.
+    template <typename F>
+    void forEachBlock(int count, int blockCount, F body)
+    {
+        TileScheduler::parallelFor(blockCount, 1, blockCount, [&](int first, int last)
+        {
+            for (int b = first; b < last; ++b)
+            {
+                int begin = static_cast<int>(static_cast<long long>(count) * b / blockCount);
+                int end = static_cast<int>(static_cast<long long>(count) * (b + 1) / blockCount);
+                body(b, begin, end);
+            }
+        });
+    }
+
+    // Stable LSD radix sort of (keys, values), RADIX_BITS per pass. Every block counts
+    // its digits, the counts give every block its own output offsets, then every block
+    // scatters its slice in order.
+    void radixSort(std::vector<uint64_t>& keys, std::vector<int>& values, int threadCount)
+    {
+        int count = static_cast<int>(keys.size());
+        int blockCount = std::max(1, std::min(threadCount, count / CHUNK_SIZE));
+
+        std::vector<uint64_t> keysOut(count);
+        std::vector<int> valuesOut(count);
+        std::vector<int> histograms(static_cast<size_t>(blockCount) * RADIX_BUCKETS);
+
+        for (int pass = 0; pass < RADIX_PASSES; ++pass)
+        {
+            int shift = pass * RADIX_BITS;
+
+            forEachBlock(count, blockCount, [&](int block, int begin, int end)
+            {
+                int* histogram = &histograms[static_cast<size_t>(block) * RADIX_BUCKETS];
+                std::fill(histogram, histogram + RADIX_BUCKETS, 0);
+                for (int i = begin; i < end; ++i)
+                    histogram[(keys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+            });
+
+            // Exclusive prefix sum, digit major so equal digits keep the block order
+            int offset = 0;
+            for (int digit = 0; digit < RADIX_BUCKETS; ++digit)
+            {
+                for (int block = 0; block < blockCount; ++block)
+                {
+                    int& slot = histograms[static_cast<size_t>(block) * RADIX_BUCKETS + digit];
+                    int n = slot;
+                    slot = offset;
+                    offset += n;
+                }
+            }
+
+            forEachBlock(count, blockCount, [&](int block, int begin, int end)
+            {
+                int* next = &histograms[static_cast<size_t>(block) * RADIX_BUCKETS];
+                for (int i = begin; i < end; ++i)
+                {
+                    int target = next[(keys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+                    keysOut[target] = keys[i];
+                    valuesOut[target] = values[i];
+                }
+            });
+
+            keys.swap(keysOut);
+            values.swap(valuesOut);
+        }
+    }
+
+    // Length of the common prefix of the keys of sorted triangles i and j,
+    // equal keys are told apart by their index. -1 outside the array.
+    int commonPrefix(const std::vector<uint64_t>& keys, int i, int j)
+    {
+        if (j < 0 || j >= static_cast<int>(keys.size())) return -1;
+        if (keys[i] == keys[j]) return 64 + __builtin_clz(static_cast<uint32_t>(i ^ j));
+        return __builtin_clzll(keys[i] ^ keys[j]);
+    }
+
+    // Child of an interior node: interior node `index`, or the leaf of sorted triangle `index`
+    struct LBVHChild
+    {
+        int index;
+        bool isLeaf;
+    };
+
+    struct LBVHNode
+    {
+        int first, last;    // range of sorted triangles below the node
+        int prefix;         // common prefix length of that range
+        int parent;
+        LBVHChild left, right;
+    };
+}
+
+void BVH::buildLBVH(int threadCount)
+{
+    int count = static_cast<int>(triOrder.size());
+    nodes.clear();
+
+    // 1. Morton codes of the centroids inside the centroid bounds, sorted
+    AABB centroidBounds;
+    for (const Vec3& c : triCentroids)
+    {
+        centroidBounds.grow(c);
+    }
+    Vec3 extent = centroidBounds.max - centroidBounds.min;
+
+    std::vector<uint64_t> keys(count);
+    TileScheduler::parallelFor(count, CHUNK_SIZE, threadCount, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; ++i)
+        {
+            const Vec3& c = triCentroids[i];
+            keys[i] = mortonCode3(quantizeMorton(c.x, centroidBounds.min.x, extent.x, MORTON_BITS),
+                                  quantizeMorton(c.y, centroidBounds.min.y, extent.y, MORTON_BITS),
+                                  quantizeMorton(c.z, centroidBounds.min.z, extent.z, MORTON_BITS));
+        }
+    });
+    radixSort(keys, triOrder, threadCount);
+
+    if (count <= LBVH_LEAF_SIZE)
+    {
+        BVHNode root;
+        root.leftFirst = 0;
+        root.triCount = count;
+        nodes.push_back(root);
+        updateNodeBounds(0);
+        return;
+    }
+
+    // 2. Every interior node finds the direction of its range from the neighbour it
+    //    shares the longer prefix with, the far end by an exponential then a binary
+    //    search, and the split where the prefix grows by a binary search
+    int interiorCount = count - 1;
+    std::vector<LBVHNode> interior(interiorCount);
+    std::vector<int> leafParent(count);
+    interior[0].parent = -1;
+
+    TileScheduler::parallelFor(interiorCount, CHUNK_SIZE, threadCount, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; ++i)
+        {
+            int d = commonPrefix(keys, i, i + 1) - commonPrefix(keys, i, i - 1) >= 0 ? 1 : -1;
+            int prefixMin = commonPrefix(keys, i, i - d);
+
+            int lengthMax = 2;
+            while (commonPrefix(keys, i, i + lengthMax * d) > prefixMin)
+                lengthMax *= 2;
+
+            int length = 0;
+            for (int t = lengthMax / 2; t >= 1; t /= 2)
+            {
+                if (commonPrefix(keys, i, i + (length + t) * d) > prefixMin)
+                    length += t;
+            }
+            int j = i + length * d;
+            int prefix = commonPrefix(keys, i, j);
+
+            int split = 0;
+            int divisor = 2;
+            int t;
+            do
+            {
+                t = (length + divisor - 1) / divisor;
+                if (commonPrefix(keys, i, i + (split + t) * d) > prefix)
+                    split += t;
+                divisor *= 2;
+            } while (t > 1);
+            split = i + split * d + std::min(d, 0);
+
+            LBVHNode& node = interior[i];
+            node.first = std::min(i, j);
+            node.last = std::max(i, j);
+            node.prefix = prefix;
+            node.left = LBVHChild{split, node.first == split};
+            node.right = LBVHChild{split + 1, node.last == split + 1};
+
+            // Every node is the child of exactly one interior node
+            (node.left.isLeaf ? leafParent[split] : interior[split].parent) = i;
+            (node.right.isLeaf ? leafParent[split + 1] : interior[split + 1].parent) = i;
+        }
+    });
+
+    // 3. Bounds from the leaves up, the first child to arrive stops, the second one
+    //    sees both child boxes and continues with the parent
+    std::vector<AABB> interiorBounds(interiorCount);
+    std::unique_ptr<std::atomic<int>[]> arrivals(new std::atomic<int>[interiorCount]);
+    for (int i = 0; i < interiorCount; ++i)
+    {
+        arrivals[i].store(0, std::memory_order_relaxed);
+    }
+
+    auto childBounds = [&](const LBVHChild& child) -> const AABB&
+    {
+        return child.isLeaf ? triBounds[triOrder[child.index]] : interiorBounds[child.index];
+    };
+
+    TileScheduler::parallelFor(count, CHUNK_SIZE, threadCount, [&](int begin, int end)
+    {
+        for (int j = begin; j < end; ++j)
+        {
+            int nodeIndex = leafParent[j];
+            while (nodeIndex >= 0 && arrivals[nodeIndex].fetch_add(1, std::memory_order_acq_rel) == 1)
+            {
+                const LBVHNode& node = interior[nodeIndex];
+                AABB box = childBounds(node.left);
+                box.grow(childBounds(node.right));
+                interiorBounds[nodeIndex] = box;
+                nodeIndex = node.parent;
+            }
+        }
+    });
+
+    // 4. Flattened layout: an interior node that stays split owns the child pair at
+    //    1 + 2 * (number of split interior nodes before it). A range of at most
+    //    LBVH_LEAF_SIZE triangles, or one deeper than the traversal stack allows,
+    //    becomes a single leaf. Both only get more true further down, so a node that
+    //    stays split never hangs below a collapsed one.
+    int rootPrefix = interior[0].prefix;
+    auto staysSplit = [&](int i)
+    {
+        const LBVHNode& node = interior[i];
+        return node.last - node.first + 1 > LBVH_LEAF_SIZE && node.prefix - rootPrefix < MAX_DEPTH - 1;
+    };
+
+    std::vector<int> pairIndex(interiorCount);
+    int pairCount = 0;
+    for (int i = 0; i < interiorCount; ++i)
+    {
+        pairIndex[i] = pairCount;
+        if (staysSplit(i)) pairCount++;
+    }
+
+    nodes.resize(1 + 2 * static_cast<size_t>(pairCount));
+
+    auto emit = [&](BVHNode& out, const LBVHChild& child)
+    {
+        const AABB& box = childBounds(child);
+        out.boundsMin = box.min;
+        out.boundsMax = box.max;
+
+        if (child.isLeaf)
+        {
+            out.leftFirst = child.index;
+            out.triCount = 1;
+        }
+        else if (staysSplit(child.index))
+        {
+            out.leftFirst = 1 + 2 * pairIndex[child.index];
+            out.triCount = 0;
+        }
+        else
+        {
+            out.leftFirst = interior[child.index].first;
+            out.triCount = interior[child.index].last - interior[child.index].first + 1;
+        }
+    };
+
+    emit(nodes[0], LBVHChild{0, false});
+
+    TileScheduler::parallelFor(interiorCount, CHUNK_SIZE, threadCount, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; ++i)
+        {
+            if (!staysSplit(i)) continue;
+
+            int pair = 1 + 2 * pairIndex[i];
+            emit(nodes[pair], interior[i].left);
+            emit(nodes[pair + 1], interior[i].right);
+        }
+    });
+}
@@ -0,0 +1,174 @@
+#include "LightTree.h"
+#include "CompiledScene.h"
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    // Importance kept by lights behind the surface, relative to one straight above it
+    const float BEHIND_SHARE = 0.05f;
+
+    float axisValue(const Vec3& v, int axis)
+    {
+        return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+    }
+
+    uint32_t hashSample(uint32_t seed, uint32_t index)
+    {
+        uint32_t h = seed ^ index * 0x9e3779b9u;
+        h ^= h >> 16;
+        h *= 0x7feb352du;
+        h ^= h >> 15;
+        h *= 0x846ca68bu;
+        h ^= h >> 16;
+        return h;
+    }
+}
+
+void LightTree::build(const CompiledScene& compiled)
+{
+    nodes.clear();
+    lightCount = compiled.getLightCount();
+    if (lightCount == 0)
+        return;
+
+    // 1. Bounds and power of every point and triangle light
+    std::vector<LightBounds> bounds(lightCount);
+    std::vector<int> order(lightCount);
+    for (int i = 0; i < lightCount; ++i)
+    {
+        LightBounds& b = bounds[i];
+        order[i] = i;
+        if (!compiled.isAreaLight(i))
+        {
+            const Vec3& intensity = compiled.pointLights.intensity[i];
+            b.power = intensity.x + intensity.y + intensity.z;
+            b.min = b.max = compiled.pointLights.position(i);
+        }
+        else
+        {
+            const AreaLight& al = compiled.getAreaLight(i);
+            b.power = al.intensity.x + al.intensity.y + al.intensity.z;
+            b.min = Vec3(std::min(al.v0.x, std::min(al.v1.x, al.v2.x)), std::min(al.v0.y, std::min(al.v1.y, al.v2.y)),
+                         std::min(al.v0.z, std::min(al.v1.z, al.v2.z)));
+            b.max = Vec3(std::max(al.v0.x, std::max(al.v1.x, al.v2.x)), std::max(al.v0.y, std::max(al.v1.y, al.v2.y)),
+                         std::max(al.v0.z, std::max(al.v1.z, al.v2.z)));
+        }
+    }
+
+    // 2. The tree, nodes in depth first order
+    nodes.resize(1);
+    buildNode(0, order, 0, lightCount, bounds);
+}
+
+// Fills node nodeIndex with order[first, first + count) and appends its subtree. Children
+// are split at the median of the longest axis of the node's bounds, so the depth is log2 count.
+void LightTree::buildNode(int nodeIndex, std::vector<int>& order, int first, int count, const std::vector<LightBounds>& bounds)
+{
+    LightNode node;
+    node.boundsMin = Vec3(1e30f, 1e30f, 1e30f);
+    node.boundsMax = Vec3(-1e30f, -1e30f, -1e30f);
+    node.power = 0.0f;
+    for (int i = first; i < first + count; ++i)
+    {
+        const LightBounds& b = bounds[order[i]];
+        node.boundsMin = Vec3(std::min(node.boundsMin.x, b.min.x), std::min(node.boundsMin.y, b.min.y), std::min(node.boundsMin.z, b.min.z));
+        node.boundsMax = Vec3(std::max(node.boundsMax.x, b.max.x), std::max(node.boundsMax.y, b.max.y), std::max(node.boundsMax.z, b.max.z));
+        node.power += b.power;
+    }
+
+    if (count == 1)
+    {
+        node.leftFirst = ~order[first];
+        nodes[nodeIndex] = node;
+        return;
+    }
+
+    Vec3 extent = node.boundsMax - node.boundsMin;
+    int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+    int half = count / 2;
+    std::nth_element(order.begin() + first, order.begin() + first + half, order.begin() + first + count, [&](int a, int b)
+    {
+        return axisValue(bounds[a].min + bounds[a].max, axis) < axisValue(bounds[b].min + bounds[b].max, axis);
+    });
+
+    // Both children are reserved before either subtree is built, so the right one follows the left
+    node.leftFirst = static_cast<int>(nodes.size());
+    nodes[nodeIndex] = node;
+    nodes.resize(nodes.size() + 2);
+
+    buildNode(node.leftFirst, order, first, half, bounds);
+    buildNode(node.leftFirst + 1, order, first + half, count - half, bounds);
+}
+
+float LightTree::importance(int nodeIndex, const Vec3& point, const Vec3& normal) const
+{
+    const LightNode& node = nodes[nodeIndex];
+    Vec3 center = (node.boundsMin + node.boundsMax) * 0.5f;
+    Vec3 toCenter = center - point;
+    float radius = (node.boundsMax - node.boundsMin).length() * 0.5f;
+    float distance = toCenter.length();
+
+    // Cosine of the smallest angle between the normal and a direction into the bounding
+    // sphere of the node, seen from the point
+    float cosBound = 1.0f;
+    if (distance > radius)
+    {
+        float cosTheta = normal.dot(toCenter) / distance;
+        float sinSpread = radius / distance;
+        float cosSpread = std::sqrt(std::max(0.0f, 1.0f - sinSpread * sinSpread));
+        if (cosTheta < cosSpread)
+        {
+            float sinTheta = std::sqrt(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+            cosBound = cosTheta * cosSpread + sinTheta * sinSpread;
+        }
+    }
+    return node.power * (std::max(cosBound, 0.0f) + BEHIND_SHARE);
+}
+
+int LightTree::sample(const Vec3& point, const Vec3& normal, uint32_t seed, int count, LightSample* samples) const
+{
+    if (nodes.empty())
+        return 0;
+    count = std::min(count, MAX_SAMPLES);
+
+    int picked = 0;
+    for (int s = 0; s < count; ++s)
+    {
+        // One random number per sample, stratified over the samples and reused down the
+        // tree by rescaling it into the range of the chosen child
+        double u = (s + (hashSample(seed, s) >> 8) * (1.0 / 16777216.0)) / count;
+        double probability = 1.0;
+        int nodeIndex = 0;
+        while (!nodes[nodeIndex].isLeaf())
+        {
+            int left = nodes[nodeIndex].leftFirst;
+            float leftImportance = importance(left, point, normal);
+            float rightImportance = importance(left + 1, point, normal);
+            float total = leftImportance + rightImportance;
+            if (!(total > 0.0f))
+                break;
+
+            double pLeft = leftImportance / total;
+            if (u < pLeft)
+            {
+                u /= pLeft;
+                probability *= pLeft;
+                nodeIndex = left;
+            }
+            else
+            {
+                u = std::min((u - pLeft) / (1.0 - pLeft), 1.0 - 1e-12);
+                probability *= 1.0 - pLeft;
+                nodeIndex = left + 1;
+            }
+        }
+        if (!nodes[nodeIndex].isLeaf())
+            continue;
+
+        samples[picked].lightIndex = ~nodes[nodeIndex].leftFirst;
+        samples[picked].weight = static_cast<float>(1.0 / (count * probability));
+        picked++;
+    }
+    return picked;
+}
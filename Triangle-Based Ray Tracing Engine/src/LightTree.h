@@ -0,0 +1,70 @@
+#ifndef LIGHTTREE_H
+#define LIGHTTREE_H
+
+#include <vector>
+#include <cstdint>
+#include "Vec3.h"
+
+class CompiledScene;
+
+// One light picked for a shading point: its number in the CompiledScene and the factor of its
+// contribution, 1 / (samples * probability of picking it), so the expected sum over the
+// picked lights is the sum over all of them
+struct LightSample
+{
+    int lightIndex;
+    float weight;
+};
+
+// Flattened light tree node (32 bytes), laid out like BVHNode.
+// Interior node: leftFirst = index of the left child, right child is leftFirst + 1
+// Leaf node:     leftFirst = ~(number of its light in the CompiledScene), negative
+struct LightNode
+{
+    Vec3 boundsMin;     // of the point light positions and triangle light corners below
+    int leftFirst;
+    Vec3 boundsMax;
+    float power;        // summed intensity of the lights below
+
+    bool isLeaf() const { return leftFirst < 0; }
+};
+
+// Bounding hierarchy over the point and triangle lights of a scene, for scenes with more
+// lights than are worth a shadow ray each (lightcuts, Walter et al. 2005; sampled like
+// Conty Estevez and Kulla 2018). Lights are split by the centres of their bounds.
+// A node's importance for a shading point is its power times a bound on the cosine
+// between the surface normal and the directions towards its lights. sample() descends
+// from the root, choosing a child in proportion to its importance, so lights in front
+// of the surface and bright clusters are picked often and the rest rarely; every light
+// keeps a small chance since the specular term reaches slightly behind the surface.
+// The cost per shading point is the depth of the tree per sample, not the light count.
+class LightTree
+{
+    public:
+        static const int MAX_SAMPLES = 64;
+
+        void build(const CompiledScene& compiled);
+
+        int getLightCount() const { return lightCount; }
+        const std::vector<LightNode>& getNodes() const { return nodes; }
+
+        // Picks count lights (at most MAX_SAMPLES) for a point with facing normal n,
+        // stratified over the random number seed gives. Returns the lights picked.
+        int sample(const Vec3& point, const Vec3& normal, uint32_t seed, int count, LightSample* samples) const;
+
+    private:
+        // Bounds and power of every light, while building
+        struct LightBounds
+        {
+            Vec3 min, max;
+            float power;
+        };
+
+        std::vector<LightNode> nodes;
+        int lightCount = 0;
+
+        float importance(int nodeIndex, const Vec3& point, const Vec3& normal) const;
+        void buildNode(int nodeIndex, std::vector<int>& order, int first, int count, const std::vector<LightBounds>& bounds);
+};
+
+#endif // LIGHTTREE_H
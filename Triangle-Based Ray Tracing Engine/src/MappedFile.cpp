@@ -0,0 +1,99 @@
+#include "MappedFile.h"
+#include <iostream>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+MappedFile::MappedFile(MappedFile&& other) noexcept : data(other.data), size(other.size)
+{
+    other.data = nullptr;
+    other.size = 0;
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+    if (this != &other)
+    {
+        unmap();
+        data = other.data;
+        size = other.size;
+        other.data = nullptr;
+        other.size = 0;
+    }
+    return *this;
+}
+
+bool MappedFile::map(const std::string& path)
+{
+    unmap();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    uint64_t fileSize = static_cast<uint64_t>(info.st_size);
+    if (fileSize > 0)
+    {
+        void* mapping = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED)
+        {
+            ::close(fd);
+            return false;
+        }
+        data = static_cast<const char*>(mapping);
+    }
+
+    ::close(fd);
+    size = fileSize;
+    return true;
+}
+
+void MappedFile::unmap()
+{
+    if (data != nullptr)
+        munmap(const_cast<char*>(data), size);
+    data = nullptr;
+    size = 0;
+}
+
+bool MappedFile::write(const std::string& file, const char* what, const std::function<bool(std::ofstream&)>& body)
+{
+    std::string tempFile = getTempPath(file);
+    {
+        std::ofstream out(tempFile, std::ios::binary | std::ios::trunc);
+        if (!out)
+        {
+            std::cerr << "Failed to open " << what << " for writing: " << tempFile << std::endl;
+            return false;
+        }
+
+        bool written = body(out);
+        out.close();
+        if (!written || !out)
+        {
+            std::cerr << "Failed to write " << what << ": " << tempFile << std::endl;
+            std::remove(tempFile.c_str());
+            return false;
+        }
+    }
+    return replace(tempFile, file, what);
+}
+
+bool MappedFile::replace(const std::string& tempFile, const std::string& file, const char* what)
+{
+    if (std::rename(tempFile.c_str(), file.c_str()) != 0)
+    {
+        std::cerr << "Failed to rename " << what << " to " << file << std::endl;
+        std::remove(tempFile.c_str());
+        return false;
+    }
+    return true;
+}
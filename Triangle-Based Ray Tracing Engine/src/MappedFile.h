@@ -0,0 +1,100 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <string>
+#include <fstream>
+#include <functional>
+#include <cstring>
+#include <cstdint>
+
+// Read only mapping of a file, and what the binary cache files (<scene>.rtcache,
+// .rtchunks, .rttex) have in common: a header that starts with an 8 byte magic and a
+// version and holds the size of the whole file, arrays at aligned offsets behind it,
+// and a writer that builds the file under a temporary name and renames it once complete.
+class MappedFile
+{
+    public:
+        MappedFile() = default;
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+        MappedFile(MappedFile&& other) noexcept;
+        MappedFile& operator=(MappedFile&& other) noexcept;
+        ~MappedFile() { unmap(); }
+
+        // Maps a whole file, false when it cannot be read. An empty file maps to no data.
+        bool map(const std::string& path);
+        void unmap();
+
+        // Maps a cache file and copies its header out. Stale or foreign files (another magic
+        // or version, or a size the header does not expect) are not mapped and the caller
+        // writes them again; the caller checks the fields only it knows.
+        template <typename Header>
+        bool map(const std::string& path, const char (&magic)[8], uint32_t version, Header& header)
+        {
+            if (!map(path)) return false;
+            if (size < sizeof(Header))
+            {
+                unmap();
+                return false;
+            }
+
+            std::memcpy(&header, data, sizeof(header));
+            if (std::memcmp(header.magic, magic, sizeof(magic)) != 0 || header.version != version || header.fileSize != size)
+            {
+                unmap();
+                return false;
+            }
+            return true;
+        }
+
+        const char* getData() const { return data; }
+        uint64_t getSize() const { return size; }
+        bool isMapped() const { return data != nullptr; }
+
+        // Whether bytes bytes from offset on lie inside the file
+        bool contains(uint64_t offset, uint64_t bytes) const { return offset <= size && bytes <= size - offset; }
+
+        // count elements of T at offset, nullptr when they do not fit or offset is not a
+        // multiple of alignment
+        template <typename T>
+        const T* getArray(uint64_t offset, uint64_t count, uint64_t alignment) const
+        {
+            if (offset % alignment != 0 || offset > size || count > (size - offset) / sizeof(T))
+                return nullptr;
+            return reinterpret_cast<const T*>(data + offset);
+        }
+
+        // Zeroed header with magic and version filled in
+        template <typename Header>
+        static Header makeHeader(const char (&magic)[8], uint32_t version)
+        {
+            Header header;
+            std::memset(&header, 0, sizeof(header));
+            std::memcpy(header.magic, magic, sizeof(magic));
+            header.version = version;
+            return header;
+        }
+
+        // Writes file through body into <file>.tmp and renames it once body returns true and
+        // the stream is good, so a crash never leaves half a file behind. what names the
+        // file in error messages.
+        static bool write(const std::string& file, const char* what, const std::function<bool(std::ofstream&)>& body);
+
+        // Name a cache file is built under before write renames it
+        static std::string getTempPath(const std::string& file) { return file + ".tmp"; }
+
+        // The last step of write for files filled some other way: renames tempFile to file,
+        // and removes it when that fails
+        static bool replace(const std::string& tempFile, const std::string& file, const char* what);
+
+    private:
+        const char* data = nullptr;
+        uint64_t size = 0;
+};
+
+inline uint64_t alignUp(uint64_t value, uint64_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+#endif // MAPPEDFILE_H
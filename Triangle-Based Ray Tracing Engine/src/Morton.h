@@ -0,0 +1,37 @@
+#ifndef MORTON_H
+#define MORTON_H
+
+#include <algorithm>
+#include <cstdint>
+
+// Morton codes: the bits of three integer coordinates interleaved, so points that are
+// close in space mostly get close codes. Used to order triangles (LBVH) and rays (RaySort).
+
+// Spreads the lower 21 bits of v so that there are two zeros between every bit
+inline uint64_t spreadBits3(uint64_t v)
+{
+    v &= 0x1fffff;
+    v = (v | (v << 32)) & 0x1f00000000ffffULL;
+    v = (v | (v << 16)) & 0x1f0000ff0000ffULL;
+    v = (v | (v << 8)) & 0x100f00f00f00f00fULL;
+    v = (v | (v << 4)) & 0x10c30c30c30c30c3ULL;
+    v = (v | (v << 2)) & 0x1249249249249249ULL;
+    return v;
+}
+
+// Up to 21 bits per coordinate, x in the lowest bit
+inline uint64_t mortonCode3(uint32_t x, uint32_t y, uint32_t z)
+{
+    return spreadBits3(x) | (spreadBits3(y) << 1) | (spreadBits3(z) << 2);
+}
+
+// Maps value from [lo, lo + extent] to an integer in [0, 2^bits)
+inline uint32_t quantizeMorton(float value, float lo, float extent, int bits)
+{
+    float cells = static_cast<float>(1u << bits);
+    float u = extent > 0 ? (value - lo) / extent : 0.0f;
+    int q = static_cast<int>(u * cells);
+    return static_cast<uint32_t>(std::min(std::max(q, 0), (1 << bits) - 1));
+}
+
+#endif // MORTON_H
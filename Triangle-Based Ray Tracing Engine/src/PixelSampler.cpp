@@ -0,0 +1,57 @@
+#include "PixelSampler.h"
+
+namespace
+{
+    uint32_t reverseBits(uint32_t v)
+    {
+        v = ((v >> 1) & 0x55555555u) | ((v & 0x55555555u) << 1);
+        v = ((v >> 2) & 0x33333333u) | ((v & 0x33333333u) << 2);
+        v = ((v >> 4) & 0x0F0F0F0Fu) | ((v & 0x0F0F0F0Fu) << 4);
+        v = ((v >> 8) & 0x00FF00FFu) | ((v & 0x00FF00FFu) << 8);
+        return (v >> 16) | (v << 16);
+    }
+
+    // Second dimension of the Sobol sequence, direction numbers v_k = v_(k-1) ^ (v_(k-1) >> 1)
+    uint32_t sobolSecond(uint32_t index)
+    {
+        uint32_t result = 0;
+        for (uint32_t v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1)
+        {
+            if (index & 1) result ^= v;
+        }
+        return result;
+    }
+
+    uint32_t hashPixel(uint32_t x, uint32_t y, uint32_t salt)
+    {
+        uint32_t h = x * 0x8da6b343u ^ y * 0xd8163841u ^ salt * 0xcb1ab31fu;
+        h ^= h >> 16;
+        h *= 0x7feb352du;
+        h ^= h >> 15;
+        h *= 0x846ca68bu;
+        h ^= h >> 16;
+        return h;
+    }
+
+    float toUnit(uint32_t bits)
+    {
+        return (bits >> 8) * (1.0f / 16777216.0f);
+    }
+}
+
+PixelSampler::PixelSampler(int minSpp, int maxSpp, float threshold)
+    : minSpp(std::max(1, minSpp)), maxSpp(std::max(std::max(1, minSpp), maxSpp)), threshold(threshold)
+{
+}
+
+void PixelSampler::getOffset(int x, int y, uint32_t index, float& dx, float& dy)
+{
+    // XOR with a random number per pixel and dimension keeps the strata of the sequence
+    getPoint(index, hashPixel(x, y, 1), hashPixel(x, y, 2), dx, dy);
+}
+
+void PixelSampler::getPoint(uint32_t index, uint32_t scrambleU, uint32_t scrambleV, float& u, float& v)
+{
+    u = toUnit(reverseBits(index) ^ scrambleU);
+    v = toUnit(sobolSecond(index) ^ scrambleV);
+}
@@ -0,0 +1,90 @@
+#ifndef PIXELSAMPLER_H
+#define PIXELSAMPLER_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include "Camera.h"
+#include "Vec3.h"
+
+// Sub-pixel sampling for anti-aliasing. Sample i of a pixel lies at point i of the 2D
+// Sobol (0,2) sequence, randomised per pixel by an XOR scramble: every power of two
+// prefix of it is stratified, so each batch of samples fills the strata the earlier
+// ones left empty. Every pixel starts with minSpp samples; while the standard error of
+// its luminance is above threshold and it has fewer than maxSpp, the sample count is
+// doubled. Only pixels with contrast inside them (edges, texture, shadow borders) get
+// more rays. minSpp == maxSpp is uniform supersampling, 1 / 1 the single centre ray.
+class PixelSampler
+{
+    public:
+        PixelSampler(int minSpp = 1, int maxSpp = 1, float threshold = 0.01f);
+
+        bool isCentreOnly() const { return maxSpp == 1; }
+        bool isAdaptive() const { return maxSpp > minSpp; }
+        int getMinSpp() const { return minSpp; }
+        int getMaxSpp() const { return maxSpp; }
+
+        // Sub-pixel offset in [0, 1)^2 of sample index of pixel (x, y)
+        static void getOffset(int x, int y, uint32_t index, float& dx, float& dy);
+
+        // Point index in [0, 1)^2 of the sequence XOR scrambled by scrambleU and scrambleV,
+        // for other 2D sample sets (points on area lights)
+        static void getPoint(uint32_t index, uint32_t scrambleU, uint32_t scrambleV, float& u, float& v);
+
+        // Colour of pixel (x, y), trace(ray) returns the colour of one camera ray.
+        // Samples are clamped to [0, 1] first, like the output does, so the average is
+        // the box filtered displayed image. sampleCount receives the rays traced.
+        template <typename Trace>
+        Vec3 render(const Camera& camera, int x, int y, Trace trace, int& sampleCount) const;
+
+    private:
+        int minSpp, maxSpp;
+        float threshold;
+};
+
+template <typename Trace>
+Vec3 PixelSampler::render(const Camera& camera, int x, int y, Trace trace, int& sampleCount) const
+{
+    if (isCentreOnly())
+    {
+        sampleCount = 1;
+        return trace(camera.getRay(x, y));
+    }
+
+    Vec3 sum(0, 0, 0);
+    double lumaSum = 0.0, lumaSquares = 0.0;
+    int count = 0, target = minSpp;
+
+    while (true)
+    {
+        // 1. Bring the pixel up to target samples
+        for (; count < target; ++count)
+        {
+            float dx, dy;
+            getOffset(x, y, static_cast<uint32_t>(count), dx, dy);
+            Vec3 c = trace(camera.getRay(x, y, dx, dy));
+            c = Vec3(std::min(std::max(c.x, 0.0f), 1.0f), std::min(std::max(c.y, 0.0f), 1.0f), std::min(std::max(c.z, 0.0f), 1.0f));
+
+            double luma = 0.2126 * c.x + 0.7152 * c.y + 0.0722 * c.z;
+            sum = sum + c;
+            lumaSum += luma;
+            lumaSquares += luma * luma;
+        }
+
+        // 2. Standard error of the mean luminance decides whether to double the samples,
+        //    a single sample has no variance yet
+        if (count >= maxSpp) break;
+        if (count >= 2)
+        {
+            double mean = lumaSum / count;
+            double variance = std::max(0.0, (lumaSquares - mean * lumaSum) / (count - 1));
+            if (std::sqrt(variance / count) <= threshold) break;
+        }
+        target = std::min(maxSpp, count * 2);
+    }
+
+    sampleCount = count;
+    return sum * (1.0f / count);
+}
+
+#endif // PIXELSAMPLER_H
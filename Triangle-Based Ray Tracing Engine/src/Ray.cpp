@@ -27,7 +27,7 @@ Vec3 Ray::at(float t) const
     return origin + direction*t;
 }
 
-bool Ray::intersectRayWithTriangle(const Vec3& o, const Vec3& d,
+bool intersectRayWithTriangle(const Vec3& o, const Vec3& d,
     const Vec3& a, const Vec3& b, const Vec3& c,
     float& t, float& beta, float& gamma)
 {
@@ -38,12 +38,12 @@ bool Ray::intersectRayWithTriangle(const Vec3& o, const Vec3& d,
 
     // Matrisin columns:
     // A = [ -d | e1 | e2 ] → 3x3 matrix
-    Vec3 col1 = d*-1; // -d → Işın yönü ters çevriliyor
+    Vec3 col1 = d*-1; // -d
     Vec3 col2 = e1;
     Vec3 col3 = e2;
 
     // det(A) → determinant calc: |A| = col1 · (col2 × col3)
-    float det = col1.dot(col2.cross(col3)); // cross product ile çarpım
+    float det = col1.dot(col2.cross(col3)); // cross product
 
     // if determinant too close to zero, return false
     if (fabs(det) < 1e-8) return false;
@@ -73,4 +73,4 @@ bool Ray::intersectRayWithTriangle(const Vec3& o, const Vec3& d,
     gamma = gammaVal;
 
     return true;
-}
\ No newline at end of file
+}
@@ -8,20 +8,34 @@ class Ray
         Ray();
         Ray(const Vec3& origin, const Vec3& direction);
         Ray(const Ray& other);
+        Ray& operator=(const Ray& other) = default;
         ~Ray();
 
         Vec3 getOrigin() const;
         Vec3 getDirection() const;
         Vec3 at(float t) const;
-
-        bool intersectRayWithTriangle(const Vec3& o, const Vec3& d,
-                const Vec3& a, const Vec3& b, const Vec3& c,
-                float& t, float& beta, float& gamma);
     
     private:
         Vec3 origin;
         Vec3 direction;
 };
 
+// Ray differentials (Igehy, "Tracing Ray Differentials"): how origin and direction of a
+// ray change towards the neighbouring pixel in x and in y. Carried along camera and
+// reflection rays, they give the size of a pixel's footprint at every hit.
+struct RayDifferential
+{
+    Vec3 dOdx, dOdy;
+    Vec3 dDdx, dDdy;
+
+    RayDifferential scaled(float s) const { return RayDifferential{dOdx * s, dOdy * s, dDdx * s, dDdy * s}; }
+};
+
+// Reference ray / triangle test (Cramer's rule). The renderer uses the
+// Möller–Trumbore kernels in TriangleBuffer.cpp, see bench/IntersectBench.cpp
+bool intersectRayWithTriangle(const Vec3& o, const Vec3& d,
+    const Vec3& a, const Vec3& b, const Vec3& c,
+    float& t, float& beta, float& gamma);
+
 
 #endif // RAH_H
\ No newline at end of file
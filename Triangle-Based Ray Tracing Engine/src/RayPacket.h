@@ -0,0 +1,28 @@
+#ifndef RAYPACKET_H
+#define RAYPACKET_H
+
+#include <cstdint>
+#include "Vec3.h"
+
+const int PACKET_WIDTH = 4;                          // packets cover 4x4 pixels
+const int PACKET_SIZE = PACKET_WIDTH * PACKET_WIDTH;
+
+// Rays traced together through the BVH, stored per component so the
+// per-lane loops vectorize. Bit i of active marks lane i as in use.
+struct RayPacket
+{
+    float ox[PACKET_SIZE], oy[PACKET_SIZE], oz[PACKET_SIZE];
+    float dx[PACKET_SIZE], dy[PACKET_SIZE], dz[PACKET_SIZE];
+    float invDx[PACKET_SIZE], invDy[PACKET_SIZE], invDz[PACKET_SIZE];
+    uint32_t active = 0;
+
+    void setRay(int lane, const Vec3& o, const Vec3& d)
+    {
+        ox[lane] = o.x; oy[lane] = o.y; oz[lane] = o.z;
+        dx[lane] = d.x; dy[lane] = d.y; dz[lane] = d.z;
+        invDx[lane] = 1.0f / d.x; invDy[lane] = 1.0f / d.y; invDz[lane] = 1.0f / d.z;
+        active |= 1u << lane;
+    }
+};
+
+#endif // RAYPACKET_H
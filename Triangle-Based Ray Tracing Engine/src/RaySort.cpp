@@ -0,0 +1,44 @@
+#include "RaySort.h"
+#include "Morton.h"
+#include <algorithm>
+
+uint64_t rayMortonKey(const Vec3& origin, const Vec3& direction, const AABB& bounds)
+{
+    const int ORIGIN_BITS = 12, DIRECTION_BITS = 6;
+
+    uint64_t originCode = mortonCode3(
+        quantizeMorton(origin.x, bounds.min.x, bounds.max.x - bounds.min.x, ORIGIN_BITS),
+        quantizeMorton(origin.y, bounds.min.y, bounds.max.y - bounds.min.y, ORIGIN_BITS),
+        quantizeMorton(origin.z, bounds.min.z, bounds.max.z - bounds.min.z, ORIGIN_BITS));
+
+    // Directions are unit vectors, every component lies in [-1, 1]
+    uint64_t directionCode = mortonCode3(
+        quantizeMorton(direction.x, -1.0f, 2.0f, DIRECTION_BITS),
+        quantizeMorton(direction.y, -1.0f, 2.0f, DIRECTION_BITS),
+        quantizeMorton(direction.z, -1.0f, 2.0f, DIRECTION_BITS));
+
+    return (originCode << (3 * DIRECTION_BITS)) | directionCode;
+}
+
+std::vector<int> sortRaysByMorton(const std::vector<Ray>& rays)
+{
+    AABB bounds;
+    for (const Ray& ray : rays)
+    {
+        bounds.grow(ray.getOrigin());
+    }
+
+    std::vector<std::pair<uint64_t, int>> keys(rays.size());
+    for (size_t i = 0; i < rays.size(); ++i)
+    {
+        keys[i] = {rayMortonKey(rays[i].getOrigin(), rays[i].getDirection(), bounds), static_cast<int>(i)};
+    }
+    std::sort(keys.begin(), keys.end());
+
+    std::vector<int> order(rays.size());
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        order[i] = keys[i].second;
+    }
+    return order;
+}
@@ -0,0 +1,17 @@
+#ifndef RAYSORT_H
+#define RAYSORT_H
+
+#include <vector>
+#include <cstdint>
+#include "Ray.h"
+#include "BVH.h"
+
+// Sort key of a ray: the Morton code of its origin inside bounds (12 bits per axis)
+// followed by the Morton code of its direction (6 bits per axis). Rays with close keys
+// start near each other and point the same way, so they visit the same BVH nodes.
+uint64_t rayMortonKey(const Vec3& origin, const Vec3& direction, const AABB& bounds);
+
+// Indices of rays ordered by rayMortonKey, the bounds are those of the origins
+std::vector<int> sortRaysByMorton(const std::vector<Ray>& rays);
+
+#endif // RAYSORT_H
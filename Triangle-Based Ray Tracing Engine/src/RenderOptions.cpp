@@ -0,0 +1,291 @@
+#include "RenderOptions.h"
+#include <iostream>
+#include <cstdlib>
+#include <algorithm>
+#include <thread>
+
+namespace
+{
+    // Value following a flag, exits with the usage text when it is missing
+    const char* nextArgument(int argc, char* argv[], int& i)
+    {
+        if (i + 1 >= argc)
+        {
+            std::cerr << "Missing value for " << argv[i] << std::endl;
+            RenderOptions::printUsage(argv[0]);
+            exit(1);
+        }
+        return argv[++i];
+    }
+
+    int positiveInt(const char* flag, const char* text)
+    {
+        int value = std::atoi(text);
+        if (value <= 0)
+        {
+            std::cerr << "Invalid value for " << flag << ": " << text << std::endl;
+            exit(1);
+        }
+        return value;
+    }
+
+    double positiveDouble(const char* flag, const char* text)
+    {
+        double value = std::atof(text);
+        if (value <= 0)
+        {
+            std::cerr << "Invalid value for " << flag << ": " << text << std::endl;
+            exit(1);
+        }
+        return value;
+    }
+}
+
+RenderOptions RenderOptions::parse(int argc, char* argv[])
+{
+    RenderOptions options;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+
+        if (arg == "--scene")
+            options.sceneFile = nextArgument(argc, argv, i);
+        else if (arg == "--output")
+            options.outputFile = nextArgument(argc, argv, i);
+        else if (arg == "--threads")
+            options.threadCount = positiveInt("--threads", nextArgument(argc, argv, i));
+        else if (arg == "--tile")
+            options.tileSize = positiveInt("--tile", nextArgument(argc, argv, i));
+        else if (arg == "--ascii")
+            options.asciiOutput = true;
+        else if (arg == "--stream")
+            options.streamOutput = true;
+        else if (arg == "--packets")
+            options.packets = true;
+        else if (arg == "--no-cache")
+            options.sceneCache = false;
+        else if (arg == "--bvh8")
+            options.wideBVH = true;
+        else if (arg == "--wavefront")
+            options.wavefront = true;
+        else if (arg == "--out-of-core")
+            options.outOfCoreMB = positiveInt("--out-of-core", nextArgument(argc, argv, i));
+        else if (arg == "--texture-cache")
+            options.textureCacheMB = positiveInt("--texture-cache", nextArgument(argc, argv, i));
+        else if (arg == "--texture-filter")
+        {
+            const char* filter = nextArgument(argc, argv, i);
+            if (!parseTextureFilter(filter, options.textureFilter))
+            {
+                std::cerr << "Invalid value for --texture-filter: " << filter << std::endl;
+                exit(1);
+            }
+        }
+        else if (arg == "--stats")
+            options.workerStats = true;
+        else if (arg == "--trace")
+            options.traceFile = nextArgument(argc, argv, i);
+        else if (arg == "--simd")
+        {
+            const char* level = nextArgument(argc, argv, i);
+            if (!parseSimdLevel(level, options.simdLevel))
+            {
+                std::cerr << "Invalid value for --simd: " << level << std::endl;
+                exit(1);
+            }
+        }
+        else if (arg == "--bvh")
+        {
+            const char* builder = nextArgument(argc, argv, i);
+            if (!parseBVHBuilder(builder, options.bvhBuilder))
+            {
+                std::cerr << "Invalid value for --bvh: " << builder << std::endl;
+                exit(1);
+            }
+        }
+        else if (arg == "--progressive")
+            options.progressiveSeconds = positiveDouble("--progressive", nextArgument(argc, argv, i));
+        else if (arg == "--converge")
+            options.convergence = positiveDouble("--converge", nextArgument(argc, argv, i));
+        else if (arg == "--snapshots")
+            options.progressiveSnapshots = true;
+        else if (arg == "--spp")
+            options.minSpp = positiveInt("--spp", nextArgument(argc, argv, i));
+        else if (arg == "--spp-max")
+            options.maxSpp = positiveInt("--spp-max", nextArgument(argc, argv, i));
+        else if (arg == "--aa-threshold")
+            options.sampleThreshold = static_cast<float>(positiveDouble("--aa-threshold", nextArgument(argc, argv, i)));
+        else if (arg == "--aa-compare")
+            options.compareSampling = true;
+        else if (arg == "--min-throughput")
+        {
+            const char* text = nextArgument(argc, argv, i);
+            options.minThroughput = static_cast<float>(std::atof(text));
+            if (options.minThroughput < 0 || (options.minThroughput == 0 && text[0] != '0'))
+            {
+                std::cerr << "Invalid value for --min-throughput: " << text << std::endl;
+                exit(1);
+            }
+        }
+        else if (arg == "--roulette")
+            options.roulette = true;
+        else if (arg == "--light-samples")
+            options.lightSamples = positiveInt("--light-samples", nextArgument(argc, argv, i));
+        else if (arg == "--area-samples")
+            options.areaSamples = positiveInt("--area-samples", nextArgument(argc, argv, i));
+        else if (arg == "--area-coarse")
+            options.areaCoarseSamples = positiveInt("--area-coarse", nextArgument(argc, argv, i));
+        else if (arg == "--generic-shading")
+            options.genericShading = true;
+        else if (arg == "--heatmap")
+        {
+            const char* metric = nextArgument(argc, argv, i);
+            if (!parseHeatmapMetric(metric, options.heatmap))
+            {
+                std::cerr << "Invalid value for --heatmap: " << metric << std::endl;
+                exit(1);
+            }
+        }
+        else if (arg == "--help" || arg == "-h")
+        {
+            printUsage(argv[0]);
+            exit(0);
+        }
+        else
+        {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            printUsage(argv[0]);
+            exit(1);
+        }
+    }
+
+    if (options.asciiOutput && options.streamOutput)
+    {
+        std::cerr << "--stream writes binary P6 and cannot be combined with --ascii" << std::endl;
+        exit(1);
+    }
+
+    if (options.wavefront && (options.packets || options.streamOutput))
+    {
+        std::cerr << "--wavefront renders the image as a whole and cannot be combined with --packets or --stream" << std::endl;
+        exit(1);
+    }
+
+    if (options.outOfCoreMB > 0 && (options.packets || options.wavefront || options.wideBVH))
+    {
+        std::cerr << "--out-of-core traces through the chunk cache and cannot be combined with --packets, --wavefront or --bvh8" << std::endl;
+        exit(1);
+    }
+
+    if (options.heatmap != HEATMAP_NONE && (options.packets || options.wavefront || options.streamOutput))
+    {
+        std::cerr << "--heatmap measures pixel by pixel and cannot be combined with --packets, --wavefront or --stream" << std::endl;
+        exit(1);
+    }
+
+    bool progressive = options.progressiveSeconds > 0;
+    if (progressive && (options.packets || options.wavefront || options.streamOutput || options.heatmap != HEATMAP_NONE))
+    {
+        std::cerr << "--progressive cannot be combined with --packets, --wavefront, --stream or --heatmap" << std::endl;
+        exit(1);
+    }
+
+    if (!progressive && (options.convergence > 0 || options.progressiveSnapshots))
+    {
+        std::cerr << "--converge and --snapshots need --progressive" << std::endl;
+        exit(1);
+    }
+
+    if (options.maxSpp == 0)
+        options.maxSpp = options.minSpp;
+    if (options.maxSpp < options.minSpp)
+    {
+        std::cerr << "--spp-max must not be below --spp" << std::endl;
+        exit(1);
+    }
+
+    if (options.maxSpp > 1 && (options.packets || options.wavefront || progressive))
+    {
+        std::cerr << "--spp and --spp-max sample in the per pixel tile path and cannot be combined with --packets, --wavefront or --progressive" << std::endl;
+        exit(1);
+    }
+
+    if (options.compareSampling && options.maxSpp <= options.minSpp)
+    {
+        std::cerr << "--aa-compare needs adaptive sampling (--spp-max above --spp)" << std::endl;
+        exit(1);
+    }
+
+    if (options.lightSamples > LightTree::MAX_SAMPLES)
+    {
+        std::cerr << "--light-samples must not be above " << LightTree::MAX_SAMPLES << std::endl;
+        exit(1);
+    }
+
+    if (options.areaSamples > MAX_AREA_SAMPLES)
+    {
+        std::cerr << "--area-samples must not be above " << MAX_AREA_SAMPLES << std::endl;
+        exit(1);
+    }
+
+    if (options.areaCoarseSamples == 0)
+        options.areaCoarseSamples = std::min(static_cast<int>(DEFAULT_AREA_COARSE), options.areaSamples);
+    if (options.areaCoarseSamples > options.areaSamples)
+    {
+        std::cerr << "--area-coarse must not be above --area-samples" << std::endl;
+        exit(1);
+    }
+
+    if (options.heatmap != HEATMAP_NONE && options.heatmap != HEATMAP_TIME && !RT_STATS)
+    {
+        std::cerr << "This build has no render statistics (RT_NO_STATS), --heatmap only supports time" << std::endl;
+        exit(1);
+    }
+
+    return options;
+}
+
+void RenderOptions::printUsage(const char* program)
+{
+    std::cout << "Usage: " << program << " [options]\n"
+              << "  --scene <file>     scene description (default scene.xml)\n"
+              << "  --output <file>    output image (default output.ppm)\n"
+              << "  --threads <n>      render threads (default: all hardware threads)\n"
+              << "  --tile <n>         tile size in pixels (default 16)\n"
+              << "  --ascii            write a P3 text PPM instead of binary P6\n"
+              << "  --stream           write finished rows of tiles while rendering (P6)\n"
+              << "  --simd <level>     triangle kernel: auto, scalar, sse4, avx2, avx512 (default auto)\n"
+              << "  --bvh <builder>    acceleration structure builder: sah, lbvh (default sah)\n"
+              << "  --no-cache         always parse the XML, do not read or write <scene>.rtcache\n"
+              << "  --bvh8             collapse the BVH into 8-wide nodes with quantized boxes\n"
+              << "  --packets          trace primary and shadow rays as 4x4 packets\n"
+              << "  --wavefront        trace bounce by bounce over ray queues, reflection rays sorted\n"
+              << "  --out-of-core <mb> page geometry in from <scene>.rtchunks, keeping at most <mb> MB resident\n"
+              << "  --texture-cache <mb> page tiled textures in from <scene>.rttex, keeping at most <mb> MB resident\n"
+              << "  --texture-filter <f> texture sampling: nearest, trilinear (mip level from ray differentials, default)\n"
+              << "  --stats            print ray and traversal counters per render thread and the slowest tiles\n"
+              << "  --progressive <s>  coarse to fine passes (8x8 blocks down to pixels) within a time budget in seconds\n"
+              << "  --converge <c>     progressive: stop once a pass changes pixels by less than c on average\n"
+              << "  --snapshots        progressive: also write the image after every pass (<output>.pass<n>.ppm)\n"
+              << "  --spp <n>          stratified camera rays per pixel (default 1, the pixel centre)\n"
+              << "  --spp-max <n>      adaptive anti-aliasing: double the rays of noisy pixels up to n\n"
+              << "  --aa-threshold <t> adaptive: standard error of the pixel luminance to reach (default 0.01)\n"
+              << "  --aa-compare       adaptive: also render uniform supersampling and print spp, time and error\n"
+              << "  --min-throughput <t> end reflection paths whose mirror product is below t (default 1/510, 0 traces all)\n"
+              << "  --roulette         Russian roulette on reflections weighted below 0.05 instead of the hard cut\n"
+              << "  --light-samples <n> with more than n point and triangle lights, shade n per hit picked from a light tree\n"
+              << "  --area-samples <n> shadow rays per triangle light in its penumbra (default 16, at most 64)\n"
+              << "  --area-coarse <m>  shadow rays per triangle light to find its penumbra, n everywhere when m = n (default 4, or n when below)\n"
+              << "  --generic-shading  shade all materials with one kernel that tests their features per hit (for comparison)\n"
+              << "  --heatmap <metric> write the cost per pixel instead of colours: triangles, nodes, shadow, time\n"
+              << "  --trace <file>     write a Chrome trace (chrome://tracing, Perfetto) of the tiles or stages per thread\n";
+}
+
+int RenderOptions::resolveThreadCount() const
+{
+    if (threadCount > 0) return threadCount;
+
+    int hardware = static_cast<int>(std::thread::hardware_concurrency());
+    return hardware > 0 ? hardware : 1;
+}
@@ -0,0 +1,56 @@
+#ifndef RENDEROPTIONS_H
+#define RENDEROPTIONS_H
+
+#include <string>
+#include "TriangleBuffer.h"
+#include "BVH.h"
+#include "CostHeatmap.h"
+#include "TextureCache.h"
+#include "LightTree.h"
+
+// Command line settings of the renderer
+class RenderOptions
+{
+    public:
+        static const int MAX_AREA_SAMPLES = 64;
+        static const int DEFAULT_AREA_COARSE = 4;
+
+        std::string sceneFile = "scene.xml";
+        std::string outputFile = "output.ppm";
+        int threadCount = 0;    // 0 = one per hardware thread
+        int tileSize = 16;      // edge length of a scheduler tile in pixels
+        bool asciiOutput = false;   // P3 text instead of binary P6
+        bool streamOutput = false;  // write finished tile rows while rendering
+        SimdLevel simdLevel = detectSimdLevel(); // triangle intersection kernel
+        BVHBuilder bvhBuilder = BUILD_SAH;       // SAH for quality, LBVH for fast start up
+        bool sceneCache = true;     // reuse / write <scene>.rtcache
+        bool wideBVH = false;       // collapse the BVH into quantized 8-wide nodes
+        bool packets = false;       // trace primary and shadow rays as 4x4 packets
+        bool wavefront = false;     // stage by stage over ray queues instead of per tile
+        int outOfCoreMB = 0;        // > 0: geometry paged in from <scene>.rtchunks, at most this many MB resident
+        int textureCacheMB = 0;     // > 0: textures paged in from <scene>.rttex, at most this many MB resident
+        TextureFilter textureFilter = FILTER_TRILINEAR; // nearest texel or mip mapped by the pixel footprint
+        bool workerStats = false;   // print counters per render thread and the slowest tiles
+        std::string traceFile;      // Chrome trace_event JSON of the render spans, empty = none
+        HeatmapMetric heatmap = HEATMAP_NONE;   // write the per pixel cost instead of colours
+        double progressiveSeconds = 0.0;    // > 0: coarse to fine passes until this time budget is used
+        double convergence = 0.0;           // progressive: stop once a pass changes pixels less than this on average
+        bool progressiveSnapshots = false;  // progressive: write the image after every pass
+        int minSpp = 1;                 // camera rays per pixel, stratified inside the pixel when > 1
+        int maxSpp = 0;                 // > minSpp: adaptive, up to this many where the pixel is noisy; 0 = minSpp
+        float sampleThreshold = 0.01f;  // adaptive: standard error of the pixel luminance to reach
+        bool compareSampling = false;   // adaptive: also render uniform supersampling and report the error
+        float minThroughput = 0.5f / 255.0f;    // reflections weighted less than this are not traced, 0 = all
+        bool roulette = false;                  // Russian roulette on low throughput reflections
+        int lightSamples = 0;   // > 0: lights shaded per hit, importance sampled when the scene has more
+        int areaSamples = 16;           // shadow rays per triangle light and hit where it is partly hidden
+        int areaCoarseSamples = 0;      // shadow rays per triangle light and hit to find its penumbra; 0 = DEFAULT_AREA_COARSE, at most areaSamples
+        bool genericShading = false;    // one shading kernel testing the material features per hit, for comparison
+
+        static RenderOptions parse(int argc, char* argv[]);
+        static void printUsage(const char* program);
+
+        int resolveThreadCount() const;
+};
+
+#endif // RENDEROPTIONS_H
@@ -0,0 +1,219 @@
+#include "RenderStats.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+
+namespace
+{
+    // One finished span, times in microseconds since RenderStats::reset
+    struct SpanRecord
+    {
+        const char* name;
+        int worker;
+        Tile tile;              // tile.index < 0 when the span is not a tile
+        double start;
+        double duration;
+        ThreadStats counters;
+    };
+
+    std::mutex statsMutex;
+    std::vector<ThreadStats> workerStats;
+    std::vector<SpanRecord> spanRecords;
+    std::string traceFile;
+    std::atomic<bool> recording(true);
+    std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+
+    ThreadStats difference(const ThreadStats& a, const ThreadStats& b)
+    {
+        ThreadStats d;
+        d.primaryRays = a.primaryRays - b.primaryRays;
+        d.shadowRays = a.shadowRays - b.shadowRays;
+        d.shadowOccluded = a.shadowOccluded - b.shadowOccluded;
+        d.occluderCacheHits = a.occluderCacheHits - b.occluderCacheHits;
+        d.reflectionRays = a.reflectionRays - b.reflectionRays;
+        d.reflectionsCut = a.reflectionsCut - b.reflectionsCut;
+        d.bvhQueries = a.bvhQueries - b.bvhQueries;
+        d.nodeVisits = a.nodeVisits - b.nodeVisits;
+        d.triangleTests = a.triangleTests - b.triangleTests;
+        d.textureLookups = a.textureLookups - b.textureLookups;
+        d.chunkLookups = a.chunkLookups - b.chunkLookups;
+        d.areaLightHits = a.areaLightHits - b.areaLightHits;
+        d.areaLightRays = a.areaLightRays - b.areaLightRays;
+        d.penumbraHits = a.penumbraHits - b.penumbraHits;
+        return d;
+    }
+}
+
+thread_local ThreadStats RenderStats::threadStats;
+
+void ThreadStats::add(const ThreadStats& other)
+{
+    primaryRays += other.primaryRays;
+    shadowRays += other.shadowRays;
+    shadowOccluded += other.shadowOccluded;
+    occluderCacheHits += other.occluderCacheHits;
+    reflectionRays += other.reflectionRays;
+    reflectionsCut += other.reflectionsCut;
+    bvhQueries += other.bvhQueries;
+    nodeVisits += other.nodeVisits;
+    triangleTests += other.triangleTests;
+    textureLookups += other.textureLookups;
+    chunkLookups += other.chunkLookups;
+    areaLightHits += other.areaLightHits;
+    areaLightRays += other.areaLightRays;
+    penumbraHits += other.penumbraHits;
+    spans += other.spans;
+    busySeconds += other.busySeconds;
+}
+
+void RenderStats::reset(int workerCount, const std::string& file)
+{
+    std::lock_guard<std::mutex> lock(statsMutex);
+    workerStats.assign(std::max(1, workerCount), ThreadStats());
+    spanRecords.clear();
+    traceFile = file;
+    origin = std::chrono::steady_clock::now();
+    recording = true;
+}
+
+void RenderStats::setRecording(bool record)
+{
+    recording = record;
+}
+
+void RenderStats::endSpan(const char* name, const Tile* tile, std::chrono::steady_clock::time_point start,
+    const ThreadStats& before)
+{
+    if (!recording) return;
+
+    auto end = std::chrono::steady_clock::now();
+    ThreadStats counters = difference(threadStats, before);
+    counters.spans = 1;
+    counters.busySeconds = std::chrono::duration<double>(end - start).count();
+    int worker = TileScheduler::getWorkerIndex();
+
+    std::lock_guard<std::mutex> lock(statsMutex);
+    if (worker >= static_cast<int>(workerStats.size()))
+        workerStats.resize(worker + 1);
+    workerStats[worker].add(counters);
+
+    // Tiles are kept for the slowest tile list, everything else only for the trace
+    if (tile != nullptr || !traceFile.empty())
+    {
+        SpanRecord record;
+        record.name = name;
+        record.worker = worker;
+        record.tile = tile != nullptr ? *tile : Tile{-1, 0, 0, 0, 0};
+        record.start = std::chrono::duration<double, std::micro>(start - origin).count();
+        record.duration = counters.busySeconds * 1e6;
+        record.counters = counters;
+        spanRecords.push_back(record);
+    }
+}
+
+std::vector<ThreadStats> RenderStats::getWorkers()
+{
+    std::lock_guard<std::mutex> lock(statsMutex);
+    return workerStats;
+}
+
+ThreadStats RenderStats::getTotal()
+{
+    ThreadStats total;
+    for (const ThreadStats& worker : getWorkers())
+    {
+        total.add(worker);
+    }
+    return total;
+}
+
+void RenderStats::printWorkers()
+{
+#if RT_STATS
+    std::vector<ThreadStats> workers = getWorkers();
+
+    std::printf("worker  spans   busy s    primary     shadow reflection   nodes/ray  tris/ray   textures\n");
+    double busyMax = 0.0, busySum = 0.0;
+    for (size_t w = 0; w < workers.size(); ++w)
+    {
+        const ThreadStats& s = workers[w];
+        double queries = s.bvhQueries > 0 ? static_cast<double>(s.bvhQueries) : 1.0;
+        std::printf("%6zu %6lld %8.3f %10lld %10lld %10lld %11.2f %9.2f %10lld\n", w, s.spans, s.busySeconds,
+            s.primaryRays, s.shadowRays, s.reflectionRays, s.nodeVisits / queries, s.triangleTests / queries, s.textureLookups);
+        busyMax = std::max(busyMax, s.busySeconds);
+        busySum += s.busySeconds;
+    }
+    if (busySum > 0)
+        std::printf("load imbalance (busiest / mean worker): %.2f\n", busyMax * workers.size() / busySum);
+
+    // Slowest tiles, the ones worth looking at first in the trace
+    std::vector<SpanRecord> tiles;
+    {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        for (const SpanRecord& record : spanRecords)
+        {
+            if (record.tile.index >= 0) tiles.push_back(record);
+        }
+    }
+    size_t shown = std::min<size_t>(5, tiles.size());
+    std::partial_sort(tiles.begin(), tiles.begin() + shown, tiles.end(), [](const SpanRecord& a, const SpanRecord& b)
+    {
+        return a.duration > b.duration;
+    });
+    for (size_t i = 0; i < shown; ++i)
+    {
+        const SpanRecord& r = tiles[i];
+        std::printf("slow tile %d [%d,%d]-[%d,%d] on worker %d: %.3f ms, %lld rays\n", r.tile.index, r.tile.x0, r.tile.y0,
+            r.tile.x1, r.tile.y1, r.worker, r.duration / 1000.0,
+            r.counters.primaryRays + r.counters.shadowRays + r.counters.reflectionRays);
+    }
+#else
+    std::cout << "Render statistics are compiled out (RT_NO_STATS)" << std::endl;
+#endif
+}
+
+bool RenderStats::writeTrace()
+{
+#if RT_STATS
+    std::lock_guard<std::mutex> lock(statsMutex);
+    if (traceFile.empty()) return false;
+
+    FILE* file = std::fopen(traceFile.c_str(), "w");
+    if (file == nullptr)
+    {
+        std::cerr << "Failed to open trace file: " << traceFile << std::endl;
+        return false;
+    }
+
+    // One track per worker, named by metadata events, every span a complete ("X") event
+    std::fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (size_t w = 0; w < workerStats.size(); ++w)
+    {
+        std::fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,\"args\":{\"name\":\"worker %zu\"}}",
+            w > 0 ? ",\n" : "", w, w);
+    }
+
+    for (const SpanRecord& r : spanRecords)
+    {
+        const ThreadStats& c = r.counters;
+        std::fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"render\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{",
+            r.name, r.worker, r.start, r.duration);
+        if (r.tile.index >= 0)
+            std::fprintf(file, "\"tile\":%d,\"x\":%d,\"y\":%d,", r.tile.index, r.tile.x0, r.tile.y0);
+        std::fprintf(file, "\"primary\":%lld,\"shadow\":%lld,\"reflection\":%lld,\"nodes\":%lld,\"triangles\":%lld,\"textures\":%lld}}",
+            c.primaryRays, c.shadowRays, c.reflectionRays, c.nodeVisits, c.triangleTests, c.textureLookups);
+    }
+    std::fprintf(file, "\n]}\n");
+
+    bool written = std::ferror(file) == 0;
+    if (std::fclose(file) != 0) written = false;
+    if (!written)
+        std::cerr << "Failed to write trace file: " << traceFile << std::endl;
+    return written;
+#else
+    std::cerr << "--trace needs a build with render statistics (without RT_NO_STATS)" << std::endl;
+    return false;
+#endif
+}
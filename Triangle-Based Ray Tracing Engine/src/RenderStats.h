@@ -0,0 +1,105 @@
+#ifndef RENDERSTATS_H
+#define RENDERSTATS_H
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include "TileScheduler.h"
+
+// Per thread render counters. Every thread counts into its own ThreadStats without
+// atomics or locks; a StatsSpan around a tile (or a chunk of wavefront rays) adds
+// them to the totals of its worker when it ends and, when a trace was asked for,
+// becomes an event on that worker's track of a Chrome trace_event timeline.
+// Building with -DRT_NO_STATS (make release) compiles the counters and spans out.
+#ifdef RT_NO_STATS
+#define RT_STATS 0
+#else
+#define RT_STATS 1
+#endif
+
+struct ThreadStats
+{
+    long long primaryRays = 0;
+    long long shadowRays = 0;
+    long long shadowOccluded = 0;
+    long long occluderCacheHits = 0;   // shadow rays blocked by the last occluder again
+    long long reflectionRays = 0;
+    long long reflectionsCut = 0;      // reflections not traced, their throughput was too low
+    long long bvhQueries = 0;          // intersect and occluded calls
+    long long nodeVisits = 0;
+    long long triangleTests = 0;
+    long long textureLookups = 0;
+    long long chunkLookups = 0;        // chunk visits of --out-of-core traversals
+    long long areaLightHits = 0;       // triangle lights shaded at a hit
+    long long areaLightRays = 0;       // shadow rays towards points on them
+    long long penumbraHits = 0;        // of those, the ones the coarse samples found partly shadowed
+    long long spans = 0;
+    double busySeconds = 0.0;          // time inside spans
+
+    void add(const ThreadStats& other);
+};
+
+#if RT_STATS
+#define RT_COUNT(counter, amount) (RenderStats::local().counter += (amount))
+#else
+#define RT_COUNT(counter, amount) ((void)0)
+#endif
+
+class RenderStats
+{
+    public:
+        // Clears all totals, traceFile empty records no timeline
+        static void reset(int workerCount, const std::string& traceFile);
+
+        // While not recording, ending spans are dropped: renders that are not part of the
+        // measured one (the --aa-compare references) leave the totals and the trace alone
+        static void setRecording(bool recording);
+
+        static ThreadStats& local() { return threadStats; }
+
+        // Totals per TileScheduler worker index and over all workers
+        static std::vector<ThreadStats> getWorkers();
+        static ThreadStats getTotal();
+
+        // Per worker table, load imbalance and the slowest tiles
+        static void printWorkers();
+
+        // Writes the recorded spans as Chrome trace_event JSON (chrome://tracing, Perfetto)
+        static bool writeTrace();
+
+    private:
+        friend class StatsSpan;
+
+        static thread_local ThreadStats threadStats;
+
+        static void endSpan(const char* name, const Tile* tile, std::chrono::steady_clock::time_point start,
+            const ThreadStats& before);
+};
+
+// Times the work of the calling thread until it goes out of scope and adds what the
+// thread counted meanwhile to its worker. Counts made outside of any span are not
+// reported. Spans over an image tile also feed the slowest tile list.
+class StatsSpan
+{
+    public:
+#if RT_STATS
+        explicit StatsSpan(const char* name, const Tile* tile = nullptr)
+            : name(name), tile(tile), before(RenderStats::local()), start(std::chrono::steady_clock::now()) {}
+        ~StatsSpan() { RenderStats::endSpan(name, tile, start, before); }
+#else
+        explicit StatsSpan(const char*, const Tile* = nullptr) {}
+#endif
+
+        StatsSpan(const StatsSpan&) = delete;
+        StatsSpan& operator=(const StatsSpan&) = delete;
+
+#if RT_STATS
+    private:
+        const char* name;
+        const Tile* tile;
+        ThreadStats before;
+        std::chrono::steady_clock::time_point start;
+#endif
+};
+
+#endif // RENDERSTATS_H
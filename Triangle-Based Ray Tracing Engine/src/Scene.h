@@ -5,9 +5,16 @@
 #include "Camera.h"
 #include "Vec3.h"
 #include "Color.h"
+#include "BVH.h"
+#include "LightTree.h"
+#include "CompiledScene.h"
 #include <memory>
+#include <array>
 #include <vector>
 
+class ChunkCache;
+class TextureCache;
+
 // FaceIndex: 1 vertex için id'ler
 struct FaceIndex {
     int vertexId;
@@ -32,6 +39,8 @@ class Material
         Vec3 ambient, diffuse, specular, mirrorReflectance;
         float phongExponent;
         float texturefactor = -1;
+        std::string textureImageName;   // own <textureimage>, empty = the scene's
+        int textureId = -1;             // index in the TextureCache, set before rendering
 };
 
 // Light
@@ -98,6 +107,11 @@ class Scene
         std::vector<Vec2f> textureData;
         std::string textureImageName;
         std::vector<std::shared_ptr<Light>> lights;
+        BVH bvh; // built after parsing, see BVH::build
+        CompiledScene compiled; // built after parsing, the lights and materials as shading reads them
+        LightTree lightTree; // built over compiled's point and triangle lights
+        const ChunkCache* chunks = nullptr; // out-of-core geometry, replaces bvh, meshes and vertex data when set
+        const TextureCache* textures = nullptr; // texture images of the materials, see Material::textureId
 };
 
 
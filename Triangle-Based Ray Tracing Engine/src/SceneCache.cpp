@@ -0,0 +1,327 @@
+#include "SceneCache.h"
+#include "MappedFile.h"
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+
+namespace
+{
+    const char MAGIC[8] = {'R', 'T', 'S', 'C', 'E', 'N', 'E', '\0'};
+    const uint32_t VERSION = 2;
+    const uint64_t ALIGNMENT = 64;
+
+    enum SectionId
+    {
+        SECTION_LIGHTS,
+        SECTION_MATERIALS,
+        SECTION_VERTICES,
+        SECTION_NORMALS,
+        SECTION_UVS,
+        SECTION_MESHES,
+        SECTION_FACES,
+        SECTION_TEXTURE_NAME,
+        SECTION_BVH_NODES,
+        SECTION_BVH_TRIANGLES,
+        SECTION_MATERIAL_TEXTURES,  // per material texture name, each ended by '\0'
+        SECTION_COUNT
+    };
+
+    struct Section
+    {
+        uint64_t offset;
+        uint64_t count;     // elements, not bytes
+    };
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t bvhBuilder;
+        uint64_t sourceHash;
+        uint64_t fileSize;
+        int32_t maxRayTraceDepth;
+        float background[3];
+        float nearPlane[5];     // distance, left, right, bottom, top
+        int32_t nx, ny;
+        float position[3], gaze[3], up[3];
+        Section sections[SECTION_COUNT];
+    };
+
+    struct LightRecord
+    {
+        int32_t type;
+        int32_t id;
+        Vec3 intensity;
+        Vec3 points[3];         // position of a point light, corners of a triangle light
+    };
+
+    struct MaterialRecord
+    {
+        int32_t id;
+        Vec3 ambient, diffuse, specular, mirrorReflectance;
+        float phongExponent;
+        float textureFactor;
+    };
+
+    struct MeshRecord
+    {
+        int32_t id;
+        int32_t materialId;
+        uint64_t firstFace;
+        uint64_t faceCount;
+    };
+
+    typedef std::array<FaceIndex, 3> Face;
+
+    // Everything copied as raw bytes must not depend on constructors or pointers
+    static_assert(std::is_trivially_copyable<Vec3>::value && sizeof(Vec3) == 12, "Vec3 layout");
+    static_assert(std::is_trivially_copyable<Vec2f>::value && sizeof(Vec2f) == 8, "Vec2f layout");
+    static_assert(std::is_trivially_copyable<Face>::value && sizeof(Face) == 36, "face layout");
+    static_assert(std::is_trivially_copyable<BVHNode>::value && sizeof(BVHNode) == 32, "BVHNode layout");
+    static_assert(std::is_trivially_copyable<TriangleRef>::value, "TriangleRef layout");
+
+    // Collects the sections in memory, then writes header and payload in one go
+    class CacheWriter
+    {
+        public:
+            std::vector<char> payload;
+            Header header;
+
+            CacheWriter() : header(MappedFile::makeHeader<Header>(MAGIC, VERSION)) {}
+
+            template <typename T>
+            void addSection(SectionId id, const T* data, size_t count)
+            {
+                uint64_t offset = alignUp(sizeof(Header) + payload.size(), ALIGNMENT);
+                payload.resize(offset - sizeof(Header));
+                const char* bytes = reinterpret_cast<const char*>(data);
+                payload.insert(payload.end(), bytes, bytes + count * sizeof(T));
+                header.sections[id] = Section{offset, count};
+            }
+    };
+
+    // Pointer to a section inside the mapped file, nullptr when it does not fit
+    template <typename T>
+    const T* sectionData(const MappedFile& file, const Section& section)
+    {
+        return file.getArray<T>(section.offset, section.count, ALIGNMENT);
+    }
+}
+
+std::string SceneCache::getCachePath(const std::string& sceneFile)
+{
+    return sceneFile + ".rtcache";
+}
+
+bool SceneCache::hashFile(const std::string& filename, uint64_t& hash)
+{
+    MappedFile file;
+    if (!file.map(filename)) return false;
+
+    hash = 14695981039346656037ULL;
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(file.getData());
+    for (uint64_t i = 0; i < file.getSize(); ++i)
+    {
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    }
+    return true;
+}
+
+bool SceneCache::load(const std::string& cacheFile, uint64_t sourceHash, BVHBuilder builder,
+    int threadCount, Scene& scene, bool& bvhLoaded, bool withGeometry)
+{
+    bvhLoaded = false;
+
+    // 1. A cache of another XML is as stale as one of another version
+    MappedFile file;
+    Header header;
+    if (!file.map(cacheFile, MAGIC, VERSION, header) || header.sourceHash != sourceHash)
+        return false;
+
+    const Section* sections = header.sections;
+    auto lights = sectionData<LightRecord>(file, sections[SECTION_LIGHTS]);
+    auto materials = sectionData<MaterialRecord>(file, sections[SECTION_MATERIALS]);
+    auto vertices = sectionData<Vec3>(file, sections[SECTION_VERTICES]);
+    auto normals = sectionData<Vec3>(file, sections[SECTION_NORMALS]);
+    auto uvs = sectionData<Vec2f>(file, sections[SECTION_UVS]);
+    auto meshes = sectionData<MeshRecord>(file, sections[SECTION_MESHES]);
+    auto faces = sectionData<Face>(file, sections[SECTION_FACES]);
+    auto textureName = sectionData<char>(file, sections[SECTION_TEXTURE_NAME]);
+    auto bvhNodes = sectionData<BVHNode>(file, sections[SECTION_BVH_NODES]);
+    auto bvhTriangles = sectionData<TriangleRef>(file, sections[SECTION_BVH_TRIANGLES]);
+    auto materialTextures = sectionData<char>(file, sections[SECTION_MATERIAL_TEXTURES]);
+
+    if (!lights || !materials || !vertices || !normals || !uvs || !meshes || !faces || !textureName || !bvhNodes || !bvhTriangles ||
+        !materialTextures)
+        return false;
+
+    // 2. Scalars and camera
+    scene.maxRayTraceDepth = header.maxRayTraceDepth;
+    scene.backgroundColor = Color(header.background[0], header.background[1], header.background[2]);
+    scene.camera = Camera(header.nearPlane[0], header.nearPlane[1], header.nearPlane[2], header.nearPlane[3], header.nearPlane[4],
+        header.nx, header.ny,
+        Vec3(header.gaze[0], header.gaze[1], header.gaze[2]),
+        Vec3(header.up[0], header.up[1], header.up[2]),
+        Vec3(header.position[0], header.position[1], header.position[2]));
+
+    // 3. Small polymorphic or non trivial objects one by one
+    scene.lights.clear();
+    for (uint64_t i = 0; i < sections[SECTION_LIGHTS].count; ++i)
+    {
+        const LightRecord& light = lights[i];
+        if (light.type == LightType::AMBIENT)
+            scene.lights.push_back(std::make_shared<AmbientLight>(light.intensity));
+        else if (light.type == LightType::POINT)
+            scene.lights.push_back(std::make_shared<PointLight>(light.id, light.points[0], light.intensity));
+        else
+            scene.lights.push_back(std::make_shared<TriangleLight>(light.id, light.points[0], light.points[1], light.points[2], light.intensity));
+    }
+
+    scene.materials.clear();
+    const char* textureNames = materialTextures;
+    const char* textureNamesEnd = materialTextures + sections[SECTION_MATERIAL_TEXTURES].count;
+    for (uint64_t i = 0; i < sections[SECTION_MATERIALS].count; ++i)
+    {
+        const MaterialRecord& record = materials[i];
+        Material material;
+        material.id = record.id;
+        material.ambient = record.ambient;
+        material.diffuse = record.diffuse;
+        material.specular = record.specular;
+        material.mirrorReflectance = record.mirrorReflectance;
+        material.phongExponent = record.phongExponent;
+        material.texturefactor = record.textureFactor;
+
+        const char* nameEnd = std::find(textureNames, textureNamesEnd, '\0');
+        if (nameEnd == textureNamesEnd)
+            return false;
+        material.textureImageName.assign(textureNames, nameEnd);
+        textureNames = nameEnd + 1;
+        scene.materials.push_back(material);
+    }
+
+    scene.textureImageName.assign(textureName, sections[SECTION_TEXTURE_NAME].count);
+
+    if (!withGeometry)
+        return true;
+
+    // 4. Bulk arrays straight out of the mapping
+    scene.vertexData.assign(vertices, vertices + sections[SECTION_VERTICES].count);
+    scene.normalData.assign(normals, normals + sections[SECTION_NORMALS].count);
+    scene.textureData.assign(uvs, uvs + sections[SECTION_UVS].count);
+
+    uint64_t faceCount = sections[SECTION_FACES].count;
+    scene.objects.meshes.clear();
+    scene.objects.meshes.resize(sections[SECTION_MESHES].count);
+    for (uint64_t i = 0; i < sections[SECTION_MESHES].count; ++i)
+    {
+        const MeshRecord& record = meshes[i];
+        if (record.firstFace > faceCount || record.faceCount > faceCount - record.firstFace)
+            return false;
+
+        Mesh& mesh = scene.objects.meshes[i];
+        mesh.id = record.id;
+        mesh.materialId = record.materialId;
+        mesh.faces.assign(faces + record.firstFace, faces + record.firstFace + record.faceCount);
+    }
+
+    // 5. The BVH, only when it was built the way this render asks for
+    if (header.bvhBuilder == static_cast<uint32_t>(builder) && sections[SECTION_BVH_NODES].count > 0)
+    {
+        std::vector<BVHNode> savedNodes(bvhNodes, bvhNodes + sections[SECTION_BVH_NODES].count);
+        std::vector<TriangleRef> savedTriangles(bvhTriangles, bvhTriangles + sections[SECTION_BVH_TRIANGLES].count);
+        scene.bvh.restore(scene, std::move(savedNodes), std::move(savedTriangles), threadCount);
+        bvhLoaded = true;
+    }
+
+    return true;
+}
+
+bool SceneCache::save(const std::string& cacheFile, uint64_t sourceHash, BVHBuilder builder, const Scene& scene)
+{
+    CacheWriter writer;
+    Header& header = writer.header;
+
+    header.bvhBuilder = static_cast<uint32_t>(builder);
+    header.sourceHash = sourceHash;
+    header.maxRayTraceDepth = scene.maxRayTraceDepth;
+    header.background[0] = scene.backgroundColor.getColorR();
+    header.background[1] = scene.backgroundColor.getColorG();
+    header.background[2] = scene.backgroundColor.getColorB();
+
+    const Camera& camera = scene.camera;
+    float nearPlane[5] = {camera.getDistance(), camera.getLeft(), camera.getRight(), camera.getBottom(), camera.getTop()};
+    std::memcpy(header.nearPlane, nearPlane, sizeof(nearPlane));
+    header.nx = camera.getNx();
+    header.ny = camera.getNy();
+    Vec3 position = camera.getOriginVector(), gaze = camera.getGazeVector(), up = camera.getUpVector();
+    std::memcpy(header.position, &position, sizeof(header.position));
+    std::memcpy(header.gaze, &gaze, sizeof(header.gaze));
+    std::memcpy(header.up, &up, sizeof(header.up));
+
+    std::vector<LightRecord> lights;
+    for (const auto& light : scene.lights)
+    {
+        LightRecord record = LightRecord();
+        record.type = light->type;
+        record.id = light->id;
+        record.intensity = light->intensity;
+        if (light->type == LightType::POINT)
+        {
+            record.points[0] = static_cast<const PointLight&>(*light).position;
+        }
+        else if (light->type == LightType::TRIANGLE)
+        {
+            const auto& triangle = static_cast<const TriangleLight&>(*light);
+            record.points[0] = triangle.v0;
+            record.points[1] = triangle.v1;
+            record.points[2] = triangle.v2;
+        }
+        lights.push_back(record);
+    }
+
+    std::vector<MaterialRecord> materials;
+    std::string materialTextures;
+    for (const Material& material : scene.materials)
+    {
+        MaterialRecord record = MaterialRecord();
+        record.id = material.id;
+        record.ambient = material.ambient;
+        record.diffuse = material.diffuse;
+        record.specular = material.specular;
+        record.mirrorReflectance = material.mirrorReflectance;
+        record.phongExponent = material.phongExponent;
+        record.textureFactor = material.texturefactor;
+        materials.push_back(record);
+        materialTextures += material.textureImageName;
+        materialTextures += '\0';
+    }
+
+    std::vector<MeshRecord> meshes;
+    std::vector<Face> faces;
+    for (const Mesh& mesh : scene.objects.meshes)
+    {
+        meshes.push_back(MeshRecord{mesh.id, mesh.materialId, faces.size(), mesh.faces.size()});
+        faces.insert(faces.end(), mesh.faces.begin(), mesh.faces.end());
+    }
+
+    writer.addSection(SECTION_LIGHTS, lights.data(), lights.size());
+    writer.addSection(SECTION_MATERIALS, materials.data(), materials.size());
+    writer.addSection(SECTION_VERTICES, scene.vertexData.data(), scene.vertexData.size());
+    writer.addSection(SECTION_NORMALS, scene.normalData.data(), scene.normalData.size());
+    writer.addSection(SECTION_UVS, scene.textureData.data(), scene.textureData.size());
+    writer.addSection(SECTION_MESHES, meshes.data(), meshes.size());
+    writer.addSection(SECTION_FACES, faces.data(), faces.size());
+    writer.addSection(SECTION_TEXTURE_NAME, scene.textureImageName.data(), scene.textureImageName.size());
+    writer.addSection(SECTION_BVH_NODES, scene.bvh.getNodes().data(), scene.bvh.getNodes().size());
+    writer.addSection(SECTION_BVH_TRIANGLES, scene.bvh.getTriangles().data(), scene.bvh.getTriangles().size());
+    writer.addSection(SECTION_MATERIAL_TEXTURES, materialTextures.data(), materialTextures.size());
+    header.fileSize = sizeof(Header) + writer.payload.size();
+
+    return MappedFile::write(cacheFile, "scene cache", [&](std::ofstream& out)
+    {
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(writer.payload.data(), writer.payload.size());
+        return true;
+    });
+}
@@ -0,0 +1,33 @@
+#ifndef SCENECACHE_H
+#define SCENECACHE_H
+
+#include <string>
+#include <cstdint>
+#include "Scene.h"
+
+// Binary copy of a parsed scene and its BVH so that rendering the same XML again
+// skips parsing and the build. The file is a fixed header followed by 64-byte
+// aligned arrays (lights, materials, vertices, normals, UVs, meshes, faces, texture
+// name, BVH nodes and triangle order) and is read back through mmap with one copy
+// per array. The header holds a hash of the XML, a changed XML makes it stale.
+class SceneCache
+{
+    public:
+        // Cache file used for a scene file
+        static std::string getCachePath(const std::string& sceneFile);
+
+        // FNV-1a hash of the file contents, false when the file cannot be read
+        static bool hashFile(const std::string& filename, uint64_t& hash);
+
+        // Fills scene from the cache when it exists and matches sourceHash. The BVH is
+        // restored too when it was built with the same builder, bvhLoaded tells which.
+        // Without withGeometry only the camera, lights, materials and texture name are
+        // read (the geometry comes from a ChunkCache then).
+        static bool load(const std::string& cacheFile, uint64_t sourceHash, BVHBuilder builder,
+            int threadCount, Scene& scene, bool& bvhLoaded, bool withGeometry = true);
+
+        // Writes scene and its binary BVH (call before BVH::buildWide)
+        static bool save(const std::string& cacheFile, uint64_t sourceHash, BVHBuilder builder, const Scene& scene);
+};
+
+#endif // SCENECACHE_H
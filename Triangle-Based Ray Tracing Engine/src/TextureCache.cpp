@@ -0,0 +1,495 @@
+#include "TextureCache.h"
+#include "TileScheduler.h"
+#include "stb_image.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace
+{
+    const char MAGIC[8] = {'R', 'T', 'T', 'E', 'X', 'T', 'R', '\0'};
+    const uint32_t VERSION = 2;
+    const uint64_t PAGE_ALIGNMENT = 4096;  // textures, and so their blocks, start on a page: dropping one never touches another
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t textureCount;
+        uint64_t fileSize;
+    };
+
+    // One texture, followed after the table by its name and then its tiles at offset
+    struct TextureRecord
+    {
+        int32_t width;
+        int32_t height;
+        int64_t sourceSize;
+        int64_t sourceTime;
+        uint64_t offset;
+        uint64_t nameOffset;
+        uint64_t nameLength;
+    };
+
+    bool statSource(const std::string& file, int64_t& size, int64_t& time)
+    {
+        struct stat info;
+        if (stat(file.c_str(), &info) != 0) return false;
+        size = static_cast<int64_t>(info.st_size);
+        time = static_cast<int64_t>(info.st_mtime);
+        return true;
+    }
+
+    int blocksAcross(int texels)
+    {
+        return (texels + TextureCache::BLOCK_SIZE - 1) / TextureCache::BLOCK_SIZE;
+    }
+
+    // Texel coordinate limited to [-1, size - 1], also for NaN, so it converts to int safely
+    float clampCoordinate(float value, int size)
+    {
+        if (!(value >= -1.0f)) return -1.0f;
+        return value > size - 1 ? static_cast<float>(size - 1) : value;
+    }
+
+    // Weighted texel in 0-255 units, scaled to colours once per lookup
+    Vec3 weigh(uint32_t texel, float weight)
+    {
+        return Vec3((texel & 0xff) * weight, ((texel >> 8) & 0xff) * weight, ((texel >> 16) & 0xff) * weight);
+    }
+}
+
+bool parseTextureFilter(const std::string& name, TextureFilter& filter)
+{
+    if (name == "nearest") filter = FILTER_NEAREST;
+    else if (name == "trilinear") filter = FILTER_TRILINEAR;
+    else return false;
+    return true;
+}
+
+const char* getTextureFilterName(TextureFilter filter)
+{
+    return filter == FILTER_NEAREST ? "nearest" : "trilinear";
+}
+
+std::string TextureCache::getTexturePath(const std::string& sceneFile)
+{
+    return sceneFile + ".rttex";
+}
+
+TextureCache::~TextureCache()
+{
+    unmap();
+}
+
+int TextureCache::add(const std::string& file)
+{
+    auto found = std::find(files.begin(), files.end(), file);
+    if (found != files.end())
+        return static_cast<int>(found - files.begin());
+
+    files.push_back(file);
+    return static_cast<int>(files.size()) - 1;
+}
+
+size_t TextureCache::getTiledBytes(int width, int height)
+{
+    Texture layout;
+    return setLevels(layout, width, height, nullptr, 0);
+}
+
+size_t TextureCache::setLevels(Texture& texture, int width, int height, const uint32_t* texels, size_t firstBlock)
+{
+    // Halved (rounded down) until 1x1, every level starts on a block
+    size_t blocks = 0;
+    texture.levelCount = 0;
+    while (texture.levelCount < MAX_LEVELS)
+    {
+        Level& level = texture.levels[texture.levelCount++];
+        level.width = width;
+        level.height = height;
+        level.blocksX = blocksAcross(width);
+        level.texels = texels != nullptr ? texels + blocks * (BLOCK_BYTES / sizeof(uint32_t)) : nullptr;
+        level.firstBlock = firstBlock + blocks;
+        blocks += static_cast<size_t>(level.blocksX) * blocksAcross(height);
+
+        if (width == 1 && height == 1) break;
+        width = std::max(1, width / 2);
+        height = std::max(1, height / 2);
+    }
+    texture.bytes = blocks * BLOCK_BYTES;
+    return texture.bytes;
+}
+
+void TextureCache::buildLevels(const unsigned char* rgb, int width, int height, uint32_t* texels)
+{
+    Texture layout;
+    setLevels(layout, width, height, nullptr, 0);
+
+    std::vector<unsigned char> current, next;
+    const unsigned char* source = rgb;
+    for (int l = 0; l < layout.levelCount; ++l)
+    {
+        const Level& level = layout.levels[l];
+        tile(source, level.width, level.height, texels + level.firstBlock * (BLOCK_BYTES / sizeof(uint32_t)));
+        if (l + 1 == layout.levelCount) break;
+
+        // 2x2 box filter, the last row or column of an odd sized level is folded into its neighbour
+        const Level& smaller = layout.levels[l + 1];
+        next.resize(static_cast<size_t>(smaller.width) * smaller.height * 3);
+        for (int y = 0; y < smaller.height; ++y)
+        {
+            const unsigned char* row0 = source + static_cast<size_t>(std::min(2 * y, level.height - 1)) * level.width * 3;
+            const unsigned char* row1 = source + static_cast<size_t>(std::min(2 * y + 1, level.height - 1)) * level.width * 3;
+            unsigned char* out = next.data() + static_cast<size_t>(y) * smaller.width * 3;
+            for (int x = 0; x < smaller.width; ++x)
+            {
+                int x0 = std::min(2 * x, level.width - 1) * 3, x1 = std::min(2 * x + 1, level.width - 1) * 3;
+                for (int c = 0; c < 3; ++c)
+                {
+                    out[x * 3 + c] = static_cast<unsigned char>((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) / 4);
+                }
+            }
+        }
+        current.swap(next);
+        source = current.data();
+    }
+}
+
+void TextureCache::tile(const unsigned char* rgb, int width, int height, uint32_t* texels)
+{
+    int blocksX = blocksAcross(width);
+    int paddedWidth = blocksX * BLOCK_SIZE;
+    int paddedHeight = blocksAcross(height) * BLOCK_SIZE;
+
+    // Blocks past the right and bottom edge repeat the edge texels, lookups clamp before them anyway
+    for (int y = 0; y < paddedHeight; ++y)
+    {
+        const unsigned char* row = rgb + static_cast<size_t>(std::min(y, height - 1)) * width * 3;
+        uint32_t* blockRow = texels + (static_cast<size_t>(y >> 6) * blocksX << 12) + ((y >> 3 & 7) << 9) + ((y & 7) << 3);
+
+        // A row of one tile is 8 consecutive texels
+        for (int x0 = 0; x0 < paddedWidth; x0 += TILE_SIZE)
+        {
+            uint32_t* out = blockRow + (static_cast<size_t>(x0 >> 6) << 12) + ((x0 >> 3 & 7) << 6);
+            for (int k = 0; k < TILE_SIZE; ++k)
+            {
+                const unsigned char* p = row + std::min(x0 + k, width - 1) * 3;
+                out[k] = p[0] | (p[1] << 8) | (p[2] << 16) | 0xff000000u;
+            }
+        }
+    }
+}
+
+bool TextureCache::load(int threadCount, std::string& failed)
+{
+    unmap();
+    int count = static_cast<int>(files.size());
+    textures.assign(count, Texture());
+    memory.assign(count, std::vector<uint32_t>());
+    std::atomic<int> failedIndex(-1);
+
+    // One image per task, the decode dominates and images differ a lot in size
+    TileScheduler::parallelFor(count, 1, threadCount, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; ++i)
+        {
+            int width = 0, height = 0, channels = 0;
+            unsigned char* rgb = stbi_load(files[i].c_str(), &width, &height, &channels, 3);
+            if (rgb == nullptr)
+            {
+                failedIndex = i;
+                continue;
+            }
+
+            memory[i].resize(getTiledBytes(width, height) / sizeof(uint32_t));
+            buildLevels(rgb, width, height, memory[i].data());
+            stbi_image_free(rgb);
+            setLevels(textures[i], width, height, memory[i].data(), 0);
+        }
+    });
+
+    if (failedIndex >= 0)
+    {
+        failed = files[failedIndex];
+        return false;
+    }
+    return true;
+}
+
+bool TextureCache::open(const std::string& textureFile, size_t budgetBytes, bool reuse, int threadCount, std::string& failed)
+{
+    if (!reuse || !map(textureFile))
+    {
+        if (!write(textureFile, threadCount, failed))
+            return false;
+        if (!map(textureFile))
+        {
+            failed = textureFile;
+            return false;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    budget = budgetBytes;
+    referenced.reset(new std::atomic<bool>[blockCount]);
+    for (size_t i = 0; i < blockCount; ++i)
+    {
+        referenced[i] = false;
+    }
+    resident.assign(blockCount, false);
+    hand = 0;
+    stats = TextureCacheStats();
+    return true;
+}
+
+bool TextureCache::write(const std::string& textureFile, int threadCount, std::string& failed) const
+{
+    // 1. Sizes from the image headers, so the file can be laid out before anything is decoded
+    int count = static_cast<int>(files.size());
+    std::vector<TextureRecord> records(count);
+    uint64_t namesOffset = sizeof(Header) + count * sizeof(TextureRecord);
+    uint64_t offset = namesOffset;
+    for (int i = 0; i < count; ++i)
+    {
+        TextureRecord& record = records[i];
+        int channels = 0;
+        if (!statSource(files[i], record.sourceSize, record.sourceTime) ||
+            !stbi_info(files[i].c_str(), &record.width, &record.height, &channels))
+        {
+            failed = files[i];
+            return false;
+        }
+        record.nameOffset = offset;
+        record.nameLength = files[i].size();
+        offset += files[i].size();
+    }
+    for (int i = 0; i < count; ++i)
+    {
+        offset = alignUp(offset, PAGE_ALIGNMENT);
+        records[i].offset = offset;
+        offset += getTiledBytes(records[i].width, records[i].height);
+    }
+
+    Header header = MappedFile::makeHeader<Header>(MAGIC, VERSION);
+    header.textureCount = static_cast<uint32_t>(count);
+    header.fileSize = offset;
+
+    // 2. Every image is decoded straight into its place in the mapped file, so only one
+    //    decoded image per thread is in memory at a time
+    std::string tempFile = MappedFile::getTempPath(textureFile);
+    int fd = ::open(tempFile.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, static_cast<off_t>(header.fileSize)) != 0)
+    {
+        std::cerr << "Failed to open texture file for writing: " << tempFile << std::endl;
+        if (fd >= 0) ::close(fd);
+        std::remove(tempFile.c_str());
+        failed = textureFile;
+        return false;
+    }
+
+    void* mapping = mmap(nullptr, header.fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        std::remove(tempFile.c_str());
+        failed = textureFile;
+        return false;
+    }
+
+    char* base = static_cast<char*>(mapping);
+    std::memcpy(base, &header, sizeof(header));
+    std::memcpy(base + sizeof(Header), records.data(), count * sizeof(TextureRecord));
+    for (int i = 0; i < count; ++i)
+    {
+        std::memcpy(base + records[i].nameOffset, files[i].data(), files[i].size());
+    }
+
+    std::atomic<int> failedIndex(-1);
+    TileScheduler::parallelFor(count, 1, threadCount, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; ++i)
+        {
+            int width = 0, height = 0, channels = 0;
+            unsigned char* rgb = stbi_load(files[i].c_str(), &width, &height, &channels, 3);
+            if (rgb == nullptr || width != records[i].width || height != records[i].height)
+            {
+                failedIndex = i;
+            }
+            else
+            {
+                buildLevels(rgb, width, height, reinterpret_cast<uint32_t*>(base + records[i].offset));
+            }
+            stbi_image_free(rgb);
+        }
+    });
+
+    // 3. Renamed only when complete, a crash never leaves half a file behind
+    munmap(mapping, header.fileSize);
+    if (failedIndex >= 0)
+    {
+        std::remove(tempFile.c_str());
+        failed = files[failedIndex];
+        return false;
+    }
+    if (!MappedFile::replace(tempFile, textureFile, "texture file"))
+    {
+        failed = textureFile;
+        return false;
+    }
+    return true;
+}
+
+bool TextureCache::map(const std::string& textureFile)
+{
+    // 1. A file of other images is as stale as one of another version
+    MappedFile file;
+    Header header;
+    if (!file.map(textureFile, MAGIC, VERSION, header)) return false;
+
+    const char* base = file.getData();
+    bool valid = header.textureCount == files.size() && file.contains(sizeof(Header), files.size() * sizeof(TextureRecord));
+
+    // 2. The same images, unchanged since the file was written, all inside the file
+    std::vector<Texture> infos;
+    size_t blocks = 0;
+    for (uint32_t i = 0; valid && i < header.textureCount; ++i)
+    {
+        TextureRecord record;
+        std::memcpy(&record, base + sizeof(Header) + i * sizeof(TextureRecord), sizeof(record));
+
+        int64_t size = 0, time = 0;
+        size_t bytes = record.width > 0 && record.height > 0 ? getTiledBytes(record.width, record.height) : 0;
+        valid = bytes > 0 && record.nameLength == files[i].size() && file.contains(record.nameOffset, record.nameLength) &&
+            std::memcmp(base + record.nameOffset, files[i].data(), files[i].size()) == 0 &&
+            statSource(files[i], size, time) && size == record.sourceSize && time == record.sourceTime &&
+            record.offset % PAGE_ALIGNMENT == 0 && file.contains(record.offset, bytes);
+
+        if (!valid) break;
+
+        Texture texture;
+        setLevels(texture, record.width, record.height, reinterpret_cast<const uint32_t*>(base + record.offset), blocks);
+        texture.offset = record.offset;
+        blocks += texture.bytes / BLOCK_BYTES;
+        infos.push_back(texture);
+    }
+
+    if (!valid) return false;
+
+    unmap();
+    mapped = std::move(file);
+    textures.swap(infos);
+    blockCount = blocks;
+    return true;
+}
+
+void TextureCache::unmap()
+{
+    mapped.unmap();
+    budget = 0;
+    blockCount = 0;
+    textures.clear();
+    memory.clear();
+}
+
+Color TextureCache::sample(int textureId, const Vec2f& uv, const Vec2f& duvdx, const Vec2f& duvdy) const
+{
+    const Texture& texture = textures[textureId];
+    const Level& base = texture.levels[0];
+
+    // 1. Level of detail: log2 of the longer pixel footprint axis in base level texels,
+    //    magnified footprints (and degenerate ones) use the base level
+    float xu = duvdx.u * base.width, xv = duvdx.v * base.height;
+    float yu = duvdy.u * base.width, yv = duvdy.v * base.height;
+    float footprint = std::max(xu * xu + xv * xv, yu * yu + yv * yv);
+    float lod = footprint > 1.0f ? 0.5f * std::log2(footprint) : 0.0f;
+    lod = std::min(lod, static_cast<float>(texture.levelCount - 1));
+
+    // 2. Bilinear on the two levels around it
+    int level = static_cast<int>(lod);
+    float blend = lod - level;
+    Vec3 color = bilinear(texture.levels[level], uv, (1.0f - blend) / 255.0f);
+    if (blend > 0.0f)
+        color = color + bilinear(texture.levels[level + 1], uv, blend / 255.0f);
+    return Color(color.x, color.y, color.z);
+}
+
+Vec3 TextureCache::bilinear(const Level& level, const Vec2f& uv, float scale) const
+{
+    // Texel centres sit at half integers, outside the level the edge texels repeat
+    float x = clampCoordinate(uv.u * level.width - 0.5f, level.width);
+    float y = clampCoordinate((1.0f - uv.v) * level.height - 0.5f, level.height);
+    float fx = std::floor(x), fy = std::floor(y);
+    float tx = x - fx, ty = y - fy;
+
+    int x0 = static_cast<int>(fx), y0 = static_cast<int>(fy);
+    int x1 = std::min(x0 + 1, level.width - 1), y1 = std::min(y0 + 1, level.height - 1);
+    x0 = std::max(x0, 0);
+    y0 = std::max(y0, 0);
+
+    float top = (1.0f - ty) * scale, bottom = ty * scale;
+    return weigh(fetch(level, x0, y0), (1.0f - tx) * top) + weigh(fetch(level, x1, y0), tx * top)
+         + weigh(fetch(level, x0, y1), (1.0f - tx) * bottom) + weigh(fetch(level, x1, y1), tx * bottom);
+}
+
+void TextureCache::touch(size_t block) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    referenced[block] = true;
+    if (resident[block]) return;
+
+    resident[block] = true;
+    stats.pageIns++;
+    stats.residentBlocks++;
+    stats.residentBytes += BLOCK_BYTES;
+
+    // Second chance: a block sampled since the hand last passed keeps its pages for
+    // another round. Only touch() sets the bits and it holds the lock, so the sweep ends.
+    while (stats.residentBytes > budget && stats.residentBlocks > 1)
+    {
+        hand = (hand + 1) % blockCount;
+        if (hand == block || !resident[hand]) continue;
+        if (referenced[hand].exchange(false, std::memory_order_relaxed)) continue;
+        drop(hand);
+    }
+    stats.peakResidentBytes = std::max(stats.peakResidentBytes, stats.residentBytes);
+}
+
+void TextureCache::drop(size_t block) const
+{
+    auto after = std::upper_bound(textures.begin(), textures.end(), block, [](size_t index, const Texture& texture)
+    {
+        return index < texture.levels[0].firstBlock;
+    });
+    const Texture& texture = *(after - 1);
+
+    // Threads still sampling the block fault its pages back in from the file
+    madvise(const_cast<char*>(mapped.getData()) + texture.offset + (block - texture.levels[0].firstBlock) * BLOCK_BYTES, BLOCK_BYTES, MADV_DONTNEED);
+
+    resident[block] = false;
+    stats.residentBytes -= BLOCK_BYTES;
+    stats.residentBlocks--;
+    stats.evictions++;
+}
+
+size_t TextureCache::getTotalBytes() const
+{
+    size_t bytes = 0;
+    for (const Texture& texture : textures)
+    {
+        bytes += texture.bytes;
+    }
+    return bytes;
+}
+
+TextureCacheStats TextureCache::getStats() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
@@ -0,0 +1,148 @@
+#ifndef TEXTURECACHE_H
+#define TEXTURECACHE_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include "Color.h"
+#include "Vec3.h"
+#include "MappedFile.h"
+
+struct TextureCacheStats
+{
+    long long pageIns = 0;
+    long long evictions = 0;
+    size_t residentBytes = 0;
+    size_t peakResidentBytes = 0;
+    int residentBlocks = 0;
+};
+
+// How shading samples textures
+enum TextureFilter
+{
+    FILTER_NEAREST,     // the base level texel under the hit, aliases when minified
+    FILTER_TRILINEAR    // mip level from the ray differentials, bilinear on the two nearest levels
+};
+
+bool parseTextureFilter(const std::string& name, TextureFilter& filter);
+const char* getTextureFilterName(TextureFilter filter);
+
+// The texture images of a scene, converted once to packed RGBA8 texels in 8x8 tiles,
+// and the tiles grouped 8x8 into blocks of 64x64 texels. A tile is 256 bytes, four cache
+// lines, and neighbouring texels in both directions share it, where a row-major RGB image
+// needs a new line for every row it steps down; a block is 16 KB, four pages.
+// Every image carries its mip pyramid, each level half the size of the one above and
+// box filtered from it, stored the same way after the base level.
+// Images are decoded in parallel at startup and by default stay in memory. With a byte
+// budget they are written to <scene>.rttex instead and mapped; at most that many bytes
+// stay paged in, blocks not sampled for a while are dropped (clock order) and fault back
+// in from the file the next time a ray hits them.
+class TextureCache
+{
+    public:
+        static const int TILE_SIZE = 8;             // texels
+        static const int BLOCK_SIZE = 64;           // texels, 8x8 tiles
+        static const size_t BLOCK_BYTES = BLOCK_SIZE * BLOCK_SIZE * sizeof(uint32_t);
+        static const int MAX_LEVELS = 16;           // mip levels, enough for 32768 texels across
+
+        static std::string getTexturePath(const std::string& sceneFile);
+
+        TextureCache() = default;
+        TextureCache(const TextureCache&) = delete;
+        TextureCache& operator=(const TextureCache&) = delete;
+        ~TextureCache();
+
+        // Index of an image file for sample(), the same file keeps its index
+        int add(const std::string& file);
+
+        // Decodes every added image on threadCount threads into memory. On failure
+        // returns false with the image that could not be read in failed.
+        bool load(int threadCount, std::string& failed);
+
+        // Maps the tiled images from textureFile, which is (re)written first when it is missing,
+        // was made from other images or reuse is false. At most budgetBytes stay paged in.
+        bool open(const std::string& textureFile, size_t budgetBytes, bool reuse, int threadCount, std::string& failed);
+
+        // Nearest base level texel of texture textureId at uv: u to the right, v up, clamped to the edges
+        Color sample(int textureId, const Vec2f& uv) const
+        {
+            const Level& level = textures[textureId].levels[0];
+            int x = static_cast<int>(uv.u * level.width);
+            int y = static_cast<int>((1.0f - uv.v) * level.height);
+            x = x < 0 ? 0 : (x >= level.width ? level.width - 1 : x);
+            y = y < 0 ? 0 : (y >= level.height ? level.height - 1 : y);
+
+            uint32_t texel = fetch(level, x, y);
+            return Color((texel & 0xff) / 255.0f, ((texel >> 8) & 0xff) / 255.0f, ((texel >> 16) & 0xff) / 255.0f);
+        }
+
+        // Trilinear filtered colour at uv. duvdx and duvdy are the uv offsets to the neighbouring
+        // pixels in x and y; the longer one, in base level texels, selects the mip level.
+        Color sample(int textureId, const Vec2f& uv, const Vec2f& duvdx, const Vec2f& duvdy) const;
+
+        int getTextureCount() const { return static_cast<int>(textures.size()); }
+        size_t getTotalBytes() const;
+        TextureCacheStats getStats() const;
+
+        // Blocked RGBA8 size of a width x height image with all its mip levels, and the
+        // conversion from row-major RGB8
+        static size_t getTiledBytes(int width, int height);
+        static void buildLevels(const unsigned char* rgb, int width, int height, uint32_t* texels);
+
+    private:
+        struct Level
+        {
+            int width = 0, height = 0;
+            int blocksX = 0;
+            const uint32_t* texels = nullptr;
+            size_t firstBlock = 0;  // in the cache wide block list
+        };
+
+        struct Texture
+        {
+            Level levels[MAX_LEVELS];
+            int levelCount = 0;
+            uint64_t offset = 0;    // in the mapped file
+            size_t bytes = 0;
+        };
+
+        std::vector<std::string> files;
+        std::vector<Texture> textures;
+        std::vector<std::vector<uint32_t>> memory;  // load(): the texels of each texture
+
+        MappedFile mapped;
+        size_t budget = 0;
+
+        // Clock over the blocks of all mapped textures: a lookup sets referenced, the sweep
+        // clears it once and drops a block whose bit is still clear on the next round
+        mutable std::mutex mutex;
+        size_t blockCount = 0;
+        std::unique_ptr<std::atomic<bool>[]> referenced;
+        mutable std::vector<bool> resident;
+        mutable size_t hand = 0;
+        mutable TextureCacheStats stats;
+
+        uint32_t fetch(const Level& level, int x, int y) const
+        {
+            size_t block = static_cast<size_t>(y >> 6) * level.blocksX + (x >> 6);
+            if (budget > 0 && !referenced[level.firstBlock + block].load(std::memory_order_relaxed))
+                touch(level.firstBlock + block);
+
+            // Inside a block: tile row, tile column, texel row, texel column, 3 bits each
+            return level.texels[(block << 12) | ((y >> 3 & 7) << 9) | ((x >> 3 & 7) << 6) | ((y & 7) << 3) | (x & 7)];
+        }
+
+        Vec3 bilinear(const Level& level, const Vec2f& uv, float scale) const;  // colour times scale * 255
+        static size_t setLevels(Texture& texture, int width, int height, const uint32_t* texels, size_t firstBlock);
+        static void tile(const unsigned char* rgb, int width, int height, uint32_t* texels);
+        void touch(size_t block) const;
+        void drop(size_t block) const;
+        void unmap();
+        bool write(const std::string& textureFile, int threadCount, std::string& failed) const;
+        bool map(const std::string& textureFile);
+};
+
+#endif // TEXTURECACHE_H
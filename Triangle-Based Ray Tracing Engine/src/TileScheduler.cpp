@@ -0,0 +1,174 @@
+#include "TileScheduler.h"
+#include <algorithm>
+#include <thread>
+#include <cstdint>
+
+namespace
+{
+    // Spreads the lower 16 bits of v so that there is a zero between every bit
+    uint32_t spreadBits(uint32_t v)
+    {
+        v &= 0x0000ffff;
+        v = (v | (v << 8)) & 0x00ff00ff;
+        v = (v | (v << 4)) & 0x0f0f0f0f;
+        v = (v | (v << 2)) & 0x33333333;
+        v = (v | (v << 1)) & 0x55555555;
+        return v;
+    }
+
+    uint32_t mortonCode(uint32_t x, uint32_t y)
+    {
+        return spreadBits(x) | (spreadBits(y) << 1);
+    }
+}
+
+thread_local int TileScheduler::workerIndex = 0;
+
+TileScheduler::TileScheduler(int width, int height, int tileSize, int threadCount)
+    : threadCount(std::max(1, threadCount)), steals(0)
+{
+    tileSize = std::max(1, tileSize);
+    int tilesX = (width + tileSize - 1) / tileSize;
+    int tilesY = (height + tileSize - 1) / tileSize;
+
+    // 1. Tile grid
+    std::vector<std::pair<uint32_t, Tile>> ordered;
+    ordered.reserve(tilesX * tilesY);
+    for (int ty = 0; ty < tilesY; ++ty)
+    {
+        for (int tx = 0; tx < tilesX; ++tx)
+        {
+            Tile tile;
+            tile.x0 = tx * tileSize;
+            tile.y0 = ty * tileSize;
+            tile.x1 = std::min(width, tile.x0 + tileSize);
+            tile.y1 = std::min(height, tile.y0 + tileSize);
+            ordered.push_back({mortonCode(tx, ty), tile});
+        }
+    }
+
+    // 2. Morton order keeps consecutive tiles close together on screen (and in the BVH)
+    std::stable_sort(ordered.begin(), ordered.end(),
+        [](const std::pair<uint32_t, Tile>& a, const std::pair<uint32_t, Tile>& b) { return a.first < b.first; });
+
+    tiles.reserve(ordered.size());
+    for (auto& entry : ordered)
+    {
+        entry.second.index = static_cast<int>(tiles.size());
+        tiles.push_back(entry.second);
+    }
+}
+
+bool TileScheduler::popLocal(int worker, int& tileIndex)
+{
+    WorkerQueue& queue = *queues[worker];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+
+    if (queue.tiles.empty()) return false;
+    tileIndex = queue.tiles.front();
+    queue.tiles.pop_front();
+    return true;
+}
+
+bool TileScheduler::steal(int thief, int& tileIndex)
+{
+    // Take from the back of the fullest other queue, farthest away from where its owner works
+    while (true)
+    {
+        int victim = -1;
+        size_t victimSize = 0;
+
+        for (int i = 1; i < threadCount; ++i)
+        {
+            int candidate = (thief + i) % threadCount;
+            std::lock_guard<std::mutex> lock(queues[candidate]->mutex);
+            if (queues[candidate]->tiles.size() > victimSize)
+            {
+                victim = candidate;
+                victimSize = queues[candidate]->tiles.size();
+            }
+        }
+
+        if (victim < 0) return false;
+
+        std::lock_guard<std::mutex> lock(queues[victim]->mutex);
+        if (queues[victim]->tiles.empty()) continue; // emptied in the meantime, look again
+
+        tileIndex = queues[victim]->tiles.back();
+        queues[victim]->tiles.pop_back();
+        steals++;
+        return true;
+    }
+}
+
+void TileScheduler::workerLoop(int worker, const std::function<void(const Tile&, int)>& renderTile)
+{
+    workerIndex = worker;
+    int tileIndex;
+    while (popLocal(worker, tileIndex) || steal(worker, tileIndex))
+    {
+        renderTile(tiles[tileIndex], worker);
+    }
+}
+
+void TileScheduler::run(const std::function<void(const Tile&, int)>& renderTile)
+{
+    // Every worker starts with a contiguous run of the Morton ordered tiles
+    queues.clear();
+    steals = 0;
+    int tileCount = getTileCount();
+    for (int w = 0; w < threadCount; ++w)
+    {
+        queues.push_back(std::make_unique<WorkerQueue>());
+
+        int first = static_cast<int>(static_cast<long long>(tileCount) * w / threadCount);
+        int last = static_cast<int>(static_cast<long long>(tileCount) * (w + 1) / threadCount);
+        for (int t = first; t < last; ++t)
+        {
+            queues[w]->tiles.push_back(t);
+        }
+    }
+
+    std::vector<std::thread> threads;
+    for (int w = 1; w < threadCount; ++w)
+    {
+        threads.emplace_back(&TileScheduler::workerLoop, this, w, std::cref(renderTile));
+    }
+
+    // The calling thread is worker 0
+    workerLoop(0, renderTile);
+
+    for (auto& th : threads)
+    {
+        th.join();
+    }
+}
+
+void TileScheduler::parallelFor(int count, int chunkSize, int threadCount, const std::function<void(int, int)>& body)
+{
+    chunkSize = std::max(1, chunkSize);
+    threadCount = std::max(1, std::min(threadCount, (count + chunkSize - 1) / chunkSize));
+    std::atomic<int> next(0);
+
+    auto worker = [&](int index)
+    {
+        workerIndex = index;
+        int begin;
+        while ((begin = next.fetch_add(chunkSize)) < count)
+        {
+            body(begin, std::min(count, begin + chunkSize));
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int t = 1; t < threadCount; ++t)
+    {
+        threads.emplace_back(worker, t);
+    }
+    worker(0);
+
+    for (auto& th : threads)
+    {
+        th.join();
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef TILESCHEDULER_H
+#define TILESCHEDULER_H
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include <functional>
+
+// Rectangle of pixels [x0, x1) x [y0, y1)
+struct Tile
+{
+    int index;
+    int x0, y0, x1, y1;
+};
+
+// Splits the image into square tiles in Morton (Z-curve) order and hands them to
+// worker threads. Every worker owns a deque holding a contiguous run of tiles,
+// takes work from its front, and steals from the back of another worker's deque
+// when its own runs dry, so no core idles while tiles are left.
+class TileScheduler
+{
+    public:
+        TileScheduler(int width, int height, int tileSize, int threadCount);
+
+        // Calls renderTile(tile, workerIndex) for every tile, returns when all are done
+        void run(const std::function<void(const Tile&, int)>& renderTile);
+
+        // Calls body(begin, end) for chunks of [0, count) on threadCount threads. Chunks are
+        // taken from a shared counter so uneven work balances out, the caller is one of the threads.
+        static void parallelFor(int count, int chunkSize, int threadCount, const std::function<void(int, int)>& body);
+
+        // Worker index of the calling thread inside run or parallelFor, 0 on the calling thread
+        static int getWorkerIndex() { return workerIndex; }
+
+        int getTileCount() const { return static_cast<int>(tiles.size()); }
+        int getThreadCount() const { return threadCount; }
+        long long getStealCount() const { return steals; }
+
+    private:
+        struct WorkerQueue
+        {
+            std::mutex mutex;
+            std::deque<int> tiles;
+        };
+
+        int threadCount;
+        std::vector<Tile> tiles;
+        std::vector<std::unique_ptr<WorkerQueue>> queues;
+        std::atomic<long long> steals;
+
+        static thread_local int workerIndex;
+
+        bool popLocal(int worker, int& tileIndex);
+        bool steal(int thief, int& tileIndex);
+        void workerLoop(int worker, const std::function<void(const Tile&, int)>& renderTile);
+};
+
+#endif // TILESCHEDULER_H
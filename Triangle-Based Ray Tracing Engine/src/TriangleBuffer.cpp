@@ -0,0 +1,298 @@
+#include "TriangleBuffer.h"
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TRIANGLE_KERNELS_X86 1
+#endif
+
+void TriangleBuffer::clear()
+{
+    for (AlignedFloats* a : {&v0x, &v0y, &v0z, &e1x, &e1y, &e1z, &e2x, &e2y, &e2z})
+    {
+        a->clear();
+    }
+    count = 0;
+}
+
+void TriangleBuffer::reserve(int triangleCount)
+{
+    for (AlignedFloats* a : {&v0x, &v0y, &v0z, &e1x, &e1y, &e1z, &e2x, &e2y, &e2z})
+    {
+        a->reserve(triangleCount + PADDING);
+    }
+}
+
+void TriangleBuffer::add(const Vec3& a, const Vec3& b, const Vec3& c)
+{
+    Vec3 e1 = b - a;
+    Vec3 e2 = c - a;
+
+    v0x.push_back(a.x);  v0y.push_back(a.y);  v0z.push_back(a.z);
+    e1x.push_back(e1.x); e1y.push_back(e1.y); e1z.push_back(e1.z);
+    e2x.push_back(e2.x); e2y.push_back(e2.y); e2z.push_back(e2.z);
+    count++;
+}
+
+void TriangleBuffer::finalize()
+{
+    // Zero edges give a zero determinant, so padding lanes never report a hit
+    for (AlignedFloats* a : {&v0x, &v0y, &v0z, &e1x, &e1y, &e1z, &e2x, &e2y, &e2z})
+    {
+        a->resize(count + PADDING, 0.0f);
+    }
+}
+
+void TriangleBuffer::resize(int triangleCount)
+{
+    for (AlignedFloats* a : {&v0x, &v0y, &v0z, &e1x, &e1y, &e1z, &e2x, &e2y, &e2z})
+    {
+        a->assign(triangleCount + PADDING, 0.0f);
+    }
+    count = triangleCount;
+}
+
+void TriangleBuffer::set(int index, const Vec3& a, const Vec3& b, const Vec3& c)
+{
+    Vec3 e1 = b - a;
+    Vec3 e2 = c - a;
+
+    v0x[index] = a.x;  v0y[index] = a.y;  v0z[index] = a.z;
+    e1x[index] = e1.x; e1y[index] = e1.y; e1z[index] = e1.z;
+    e2x[index] = e2.x; e2y[index] = e2.y; e2z[index] = e2.z;
+}
+
+void TriangleBuffer::reorder(const std::vector<int>& order)
+{
+    for (AlignedFloats* a : {&v0x, &v0y, &v0z, &e1x, &e1y, &e1z, &e2x, &e2y, &e2z})
+    {
+        AlignedFloats reordered(a->size(), 0.0f);
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            reordered[i] = (*a)[order[i]];
+        }
+        a->swap(reordered);
+    }
+}
+
+namespace
+{
+    // Möller–Trumbore, one triangle at a time
+    uint32_t intersectScalar(const TriangleBuffer& tris, int first, int count,
+        const Vec3& o, const Vec3& d, float tMin, float tMax, float* t, float* beta, float* gamma)
+    {
+        uint32_t mask = 0;
+
+        for (int k = 0; k < count; ++k)
+        {
+            int i = first + k;
+            float e1x = tris.e1x[i], e1y = tris.e1y[i], e1z = tris.e1z[i];
+            float e2x = tris.e2x[i], e2y = tris.e2y[i], e2z = tris.e2z[i];
+
+            // p = d x e2
+            float px = d.y * e2z - d.z * e2y;
+            float py = d.z * e2x - d.x * e2z;
+            float pz = d.x * e2y - d.y * e2x;
+
+            float det = e1x * px + e1y * py + e1z * pz;
+            if (std::fabs(det) < TriangleBuffer::DET_EPSILON) continue;
+            float invDet = 1.0f / det;
+
+            float sx = o.x - tris.v0x[i], sy = o.y - tris.v0y[i], sz = o.z - tris.v0z[i];
+            float u = (sx * px + sy * py + sz * pz) * invDet;
+            if (u < 0.0f || u > 1.0f) continue;
+
+            // q = s x e1
+            float qx = sy * e1z - sz * e1y;
+            float qy = sz * e1x - sx * e1z;
+            float qz = sx * e1y - sy * e1x;
+
+            float v = (d.x * qx + d.y * qy + d.z * qz) * invDet;
+            if (v < 0.0f || u + v > 1.0f) continue;
+
+            float tt = (e2x * qx + e2y * qy + e2z * qz) * invDet;
+            if (tt < tMin || tt > tMax) continue;
+
+            t[k] = tt;
+            beta[k] = u;
+            gamma[k] = v;
+            mask |= 1u << k;
+        }
+
+        return mask;
+    }
+
+#ifdef TRIANGLE_KERNELS_X86
+    // The SIMD kernels are the scalar code above, one triangle per lane
+
+    __attribute__((target("sse4.1")))
+    uint32_t intersectSSE4(const TriangleBuffer& tris, int first, int count,
+        const Vec3& o, const Vec3& d, float tMin, float tMax, float* t, float* beta, float* gamma)
+    {
+        __m128 dx = _mm_set1_ps(d.x), dy = _mm_set1_ps(d.y), dz = _mm_set1_ps(d.z);
+        __m128 e1x = _mm_loadu_ps(&tris.e1x[first]), e1y = _mm_loadu_ps(&tris.e1y[first]), e1z = _mm_loadu_ps(&tris.e1z[first]);
+        __m128 e2x = _mm_loadu_ps(&tris.e2x[first]), e2y = _mm_loadu_ps(&tris.e2y[first]), e2z = _mm_loadu_ps(&tris.e2z[first]);
+
+        __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+        __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+        __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+
+        __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+        __m128 absDet = _mm_andnot_ps(_mm_set1_ps(-0.0f), det);
+        __m128 valid = _mm_cmpge_ps(absDet, _mm_set1_ps(TriangleBuffer::DET_EPSILON));
+        __m128 invDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+        __m128 sx = _mm_sub_ps(_mm_set1_ps(o.x), _mm_loadu_ps(&tris.v0x[first]));
+        __m128 sy = _mm_sub_ps(_mm_set1_ps(o.y), _mm_loadu_ps(&tris.v0y[first]));
+        __m128 sz = _mm_sub_ps(_mm_set1_ps(o.z), _mm_loadu_ps(&tris.v0z[first]));
+        __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), invDet);
+
+        __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+        __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+        __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+
+        __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), invDet);
+        __m128 tt = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+
+        __m128 zero = _mm_setzero_ps();
+        valid = _mm_and_ps(valid, _mm_cmpge_ps(u, zero));
+        valid = _mm_and_ps(valid, _mm_cmpge_ps(v, zero));
+        valid = _mm_and_ps(valid, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f)));
+        valid = _mm_and_ps(valid, _mm_cmpge_ps(tt, _mm_set1_ps(tMin)));
+        valid = _mm_and_ps(valid, _mm_cmple_ps(tt, _mm_set1_ps(tMax)));
+
+        _mm_storeu_ps(t, tt);
+        _mm_storeu_ps(beta, u);
+        _mm_storeu_ps(gamma, v);
+        return static_cast<uint32_t>(_mm_movemask_ps(valid)) & ((1u << count) - 1);
+    }
+
+    __attribute__((target("avx2")))
+    uint32_t intersectAVX2(const TriangleBuffer& tris, int first, int count,
+        const Vec3& o, const Vec3& d, float tMin, float tMax, float* t, float* beta, float* gamma)
+    {
+        __m256 dx = _mm256_set1_ps(d.x), dy = _mm256_set1_ps(d.y), dz = _mm256_set1_ps(d.z);
+        __m256 e1x = _mm256_loadu_ps(&tris.e1x[first]), e1y = _mm256_loadu_ps(&tris.e1y[first]), e1z = _mm256_loadu_ps(&tris.e1z[first]);
+        __m256 e2x = _mm256_loadu_ps(&tris.e2x[first]), e2y = _mm256_loadu_ps(&tris.e2y[first]), e2z = _mm256_loadu_ps(&tris.e2z[first]);
+
+        __m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+        __m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+        __m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+
+        __m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+        __m256 absDet = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), det);
+        __m256 valid = _mm256_cmp_ps(absDet, _mm256_set1_ps(TriangleBuffer::DET_EPSILON), _CMP_GE_OQ);
+        __m256 invDet = _mm256_div_ps(_mm256_set1_ps(1.0f), det);
+
+        __m256 sx = _mm256_sub_ps(_mm256_set1_ps(o.x), _mm256_loadu_ps(&tris.v0x[first]));
+        __m256 sy = _mm256_sub_ps(_mm256_set1_ps(o.y), _mm256_loadu_ps(&tris.v0y[first]));
+        __m256 sz = _mm256_sub_ps(_mm256_set1_ps(o.z), _mm256_loadu_ps(&tris.v0z[first]));
+        __m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, px), _mm256_mul_ps(sy, py)), _mm256_mul_ps(sz, pz)), invDet);
+
+        __m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(sz, e1y));
+        __m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(sx, e1z));
+        __m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(sy, e1x));
+
+        __m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)), invDet);
+        __m256 tt = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)), invDet);
+
+        __m256 zero = _mm256_setzero_ps();
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(u, zero, _CMP_GE_OQ));
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(_mm256_add_ps(u, v), _mm256_set1_ps(1.0f), _CMP_LE_OQ));
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(tt, _mm256_set1_ps(tMin), _CMP_GE_OQ));
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(tt, _mm256_set1_ps(tMax), _CMP_LE_OQ));
+
+        _mm256_storeu_ps(t, tt);
+        _mm256_storeu_ps(beta, u);
+        _mm256_storeu_ps(gamma, v);
+        return static_cast<uint32_t>(_mm256_movemask_ps(valid)) & ((1u << count) - 1);
+    }
+
+    __attribute__((target("avx512f")))
+    uint32_t intersectAVX512(const TriangleBuffer& tris, int first, int count,
+        const Vec3& o, const Vec3& d, float tMin, float tMax, float* t, float* beta, float* gamma)
+    {
+        __m512 dx = _mm512_set1_ps(d.x), dy = _mm512_set1_ps(d.y), dz = _mm512_set1_ps(d.z);
+        __m512 e1x = _mm512_loadu_ps(&tris.e1x[first]), e1y = _mm512_loadu_ps(&tris.e1y[first]), e1z = _mm512_loadu_ps(&tris.e1z[first]);
+        __m512 e2x = _mm512_loadu_ps(&tris.e2x[first]), e2y = _mm512_loadu_ps(&tris.e2y[first]), e2z = _mm512_loadu_ps(&tris.e2z[first]);
+
+        __m512 px = _mm512_sub_ps(_mm512_mul_ps(dy, e2z), _mm512_mul_ps(dz, e2y));
+        __m512 py = _mm512_sub_ps(_mm512_mul_ps(dz, e2x), _mm512_mul_ps(dx, e2z));
+        __m512 pz = _mm512_sub_ps(_mm512_mul_ps(dx, e2y), _mm512_mul_ps(dy, e2x));
+
+        __m512 det = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(e1x, px), _mm512_mul_ps(e1y, py)), _mm512_mul_ps(e1z, pz));
+        __mmask16 valid = _mm512_cmp_ps_mask(_mm512_abs_ps(det), _mm512_set1_ps(TriangleBuffer::DET_EPSILON), _CMP_GE_OQ);
+        __m512 invDet = _mm512_div_ps(_mm512_set1_ps(1.0f), det);
+
+        __m512 sx = _mm512_sub_ps(_mm512_set1_ps(o.x), _mm512_loadu_ps(&tris.v0x[first]));
+        __m512 sy = _mm512_sub_ps(_mm512_set1_ps(o.y), _mm512_loadu_ps(&tris.v0y[first]));
+        __m512 sz = _mm512_sub_ps(_mm512_set1_ps(o.z), _mm512_loadu_ps(&tris.v0z[first]));
+        __m512 u = _mm512_mul_ps(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(sx, px), _mm512_mul_ps(sy, py)), _mm512_mul_ps(sz, pz)), invDet);
+
+        __m512 qx = _mm512_sub_ps(_mm512_mul_ps(sy, e1z), _mm512_mul_ps(sz, e1y));
+        __m512 qy = _mm512_sub_ps(_mm512_mul_ps(sz, e1x), _mm512_mul_ps(sx, e1z));
+        __m512 qz = _mm512_sub_ps(_mm512_mul_ps(sx, e1y), _mm512_mul_ps(sy, e1x));
+
+        __m512 v = _mm512_mul_ps(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dx, qx), _mm512_mul_ps(dy, qy)), _mm512_mul_ps(dz, qz)), invDet);
+        __m512 tt = _mm512_mul_ps(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(e2x, qx), _mm512_mul_ps(e2y, qy)), _mm512_mul_ps(e2z, qz)), invDet);
+
+        __m512 zero = _mm512_setzero_ps();
+        valid &= _mm512_cmp_ps_mask(u, zero, _CMP_GE_OQ);
+        valid &= _mm512_cmp_ps_mask(v, zero, _CMP_GE_OQ);
+        valid &= _mm512_cmp_ps_mask(_mm512_add_ps(u, v), _mm512_set1_ps(1.0f), _CMP_LE_OQ);
+        valid &= _mm512_cmp_ps_mask(tt, _mm512_set1_ps(tMin), _CMP_GE_OQ);
+        valid &= _mm512_cmp_ps_mask(tt, _mm512_set1_ps(tMax), _CMP_LE_OQ);
+
+        _mm512_storeu_ps(t, tt);
+        _mm512_storeu_ps(beta, u);
+        _mm512_storeu_ps(gamma, v);
+        return static_cast<uint32_t>(valid) & ((1u << count) - 1);
+    }
+#endif
+
+    const TriangleKernel KERNELS[] =
+    {
+        { SIMD_SCALAR, "scalar", 16, intersectScalar },
+#ifdef TRIANGLE_KERNELS_X86
+        { SIMD_SSE4, "sse4", 4, intersectSSE4 },
+        { SIMD_AVX2, "avx2", 8, intersectAVX2 },
+        { SIMD_AVX512, "avx512", 16, intersectAVX512 },
+#endif
+    };
+}
+
+SimdLevel detectSimdLevel()
+{
+#ifdef TRIANGLE_KERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return SIMD_AVX512;
+    if (__builtin_cpu_supports("avx2")) return SIMD_AVX2;
+    if (__builtin_cpu_supports("sse4.1")) return SIMD_SSE4;
+#endif
+    return SIMD_SCALAR;
+}
+
+const TriangleKernel& getTriangleKernel(SimdLevel level)
+{
+    level = std::min(level, detectSimdLevel());
+
+    for (const TriangleKernel& kernel : KERNELS)
+    {
+        if (kernel.level == level) return kernel;
+    }
+    return KERNELS[0];
+}
+
+bool parseSimdLevel(const char* text, SimdLevel& level)
+{
+    if (std::strcmp(text, "auto") == 0) level = detectSimdLevel();
+    else if (std::strcmp(text, "scalar") == 0) level = SIMD_SCALAR;
+    else if (std::strcmp(text, "sse4") == 0) level = SIMD_SSE4;
+    else if (std::strcmp(text, "avx2") == 0) level = SIMD_AVX2;
+    else if (std::strcmp(text, "avx512") == 0) level = SIMD_AVX512;
+    else return false;
+    return true;
+}
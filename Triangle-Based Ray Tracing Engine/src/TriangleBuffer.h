@@ -0,0 +1,99 @@
+#ifndef TRIANGLEBUFFER_H
+#define TRIANGLEBUFFER_H
+
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include "Vec3.h"
+
+// 64-byte aligned storage so SIMD loads never split a cache line
+template <typename T>
+struct AlignedAllocator
+{
+    typedef T value_type;
+
+    AlignedAllocator() = default;
+    template <typename U> AlignedAllocator(const AlignedAllocator<U>&) {}
+
+    T* allocate(size_t n)
+    {
+        size_t bytes = (n * sizeof(T) + 63) / 64 * 64;
+        void* p = std::aligned_alloc(64, bytes);
+        if (p == nullptr) throw std::bad_alloc();
+        return static_cast<T*>(p);
+    }
+
+    void deallocate(T* p, size_t) { std::free(p); }
+
+    template <typename U> bool operator==(const AlignedAllocator<U>&) const { return true; }
+    template <typename U> bool operator!=(const AlignedAllocator<U>&) const { return false; }
+};
+
+typedef std::vector<float, AlignedAllocator<float>> AlignedFloats;
+
+enum SimdLevel
+{
+    SIMD_SCALAR,
+    SIMD_SSE4,
+    SIMD_AVX2,
+    SIMD_AVX512
+};
+
+// Triangles as a structure of arrays with the Möller–Trumbore edges already
+// subtracted: v0, e1 = v1 - v0, e2 = v2 - v0. The arrays are padded with
+// degenerate triangles so a kernel may always load a full SIMD width.
+class TriangleBuffer
+{
+    public:
+        static const int PADDING = 16; // widest kernel
+        static constexpr float DET_EPSILON = 1e-8f; // smaller |determinant|: ray parallel to the triangle, no hit
+
+        AlignedFloats v0x, v0y, v0z;
+        AlignedFloats e1x, e1y, e1z;
+        AlignedFloats e2x, e2y, e2z;
+
+        void clear();
+        void reserve(int count);
+        void add(const Vec3& a, const Vec3& b, const Vec3& c);
+        void finalize(); // appends the padding, call once after the last add
+
+        // Alternative to add/finalize: size the buffer (padding included), then fill
+        // every index with set, which different threads may do for different indices
+        void resize(int triangleCount);
+        void set(int index, const Vec3& a, const Vec3& b, const Vec3& c);
+
+        // Entry i becomes the old entry order[i], the padding stays in place
+        void reorder(const std::vector<int>& order);
+
+        int size() const { return count; }
+        size_t memoryBytes() const { return 9 * v0x.capacity() * sizeof(float); }
+
+    private:
+        int count = 0;
+};
+
+// Tests one ray against the triangles [first, first + count), count <= width.
+// Writes t, beta, gamma per lane and returns a bit mask of the lanes hit with tMin <= t <= tMax.
+// Every kernel, and the packet test in BVH.cpp, rounds each operation the same way, so they
+// agree to the bit; this needs a build without fused multiply-adds (-ffp-contract=off).
+typedef uint32_t (*TriangleKernelFn)(const TriangleBuffer& tris, int first, int count,
+    const Vec3& o, const Vec3& d, float tMin, float tMax, float* t, float* beta, float* gamma);
+
+struct TriangleKernel
+{
+    SimdLevel level;
+    const char* name;
+    int width;
+    TriangleKernelFn intersect;
+};
+
+// Widest level the CPU running the program supports
+SimdLevel detectSimdLevel();
+
+// Kernel for a level; falls back to the best supported one when the CPU lacks it
+const TriangleKernel& getTriangleKernel(SimdLevel level);
+
+bool parseSimdLevel(const char* text, SimdLevel& level);
+
+#endif // TRIANGLEBUFFER_H
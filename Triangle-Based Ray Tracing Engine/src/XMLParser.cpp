@@ -1,4 +1,5 @@
 #include "XMLParser.h"
+#include "GeometryText.h"
 
 Vec3 parseVec3(const std::string& text) 
 {
@@ -118,47 +119,50 @@ void XMLParser::parseMaterials(tinyxml2::XMLElement* materialsElem, Scene& scene
             texFactorElem->QueryFloatText(&material.texturefactor); // veya float ise `QueryFloatText`
         }
 
+        // Material's own texture, otherwise the scene's <textureimage>
+        if (auto texImageElem = materialElem->FirstChildElement("textureimage")) {
+            if (const char* name = texImageElem->GetText())
+                material.textureImageName = name;
+        }
+
         scene.materials.push_back(material);
     }
 }
 
-void XMLParser::parseGeometryData(XMLElement* root, Scene& scene)
+void XMLParser::parseGeometryData(XMLElement* root, Scene& scene, int threadCount)
 {
     // VERTEX DATA
     if (auto vertexElem = root->FirstChildElement("vertexdata"))
     {
-        std::istringstream ss(vertexElem->GetText());
-        float x, y, z;
-        while (ss >> x >> y >> z)
+        if (!GeometryText::decodeVec3s(vertexElem->GetText(), scene.vertexData, threadCount))
         {
-            scene.vertexData.push_back(Vec3(x, y, z));
+            std::cerr << "Malformed number in <vertexdata>" << std::endl;
+            exit(1);
         }
     }
 
     // NORMAL DATA
     if (auto normalElem = root->FirstChildElement("normaldata"))
     {
-        std::istringstream ss(normalElem->GetText());
-        float x, y, z;
-        while (ss >> x >> y >> z)
+        if (!GeometryText::decodeVec3s(normalElem->GetText(), scene.normalData, threadCount))
         {
-            scene.normalData.push_back(Vec3(x, y, z));
+            std::cerr << "Malformed number in <normaldata>" << std::endl;
+            exit(1);
         }
     }
 
     // TEXTURE DATA
     if (auto texElem = root->FirstChildElement("texturedata"))
     {
-        std::istringstream ss(texElem->GetText());
-        float u, v;
-        while (ss >> u >> v)
+        if (!GeometryText::decodeVec2fs(texElem->GetText(), scene.textureData, threadCount))
         {
-            scene.textureData.push_back(Vec2f{u, v});
+            std::cerr << "Malformed number in <texturedata>" << std::endl;
+            exit(1);
         }
     }
 }
 
-void XMLParser::parseObjects(tinyxml2::XMLElement* root, Scene& scene)
+void XMLParser::parseObjects(tinyxml2::XMLElement* root, Scene& scene, int threadCount)
 {
     if (auto objectsElem = root->FirstChildElement("objects"))
     {
@@ -172,43 +176,20 @@ void XMLParser::parseObjects(tinyxml2::XMLElement* root, Scene& scene)
             if (matElem)
                 mesh.materialId = std::stoi(matElem->GetText());
 
-            // faces
+            // faces, 3 "v/t/n" vertices per triangle
             auto facesElem = meshElem->FirstChildElement("faces");
-            if (facesElem)
+            if (facesElem && !GeometryText::decodeFaces(facesElem->GetText(), mesh.faces, threadCount))
             {
-                std::istringstream faceStream(facesElem->GetText());
-                std::string faceToken;
-
-                while (faceStream >> faceToken)
-                {
-                    std::array<FaceIndex, 3> triangle;
-
-                    // parse 3 vertices per triangle
-                    for (int i = 0; i < 3; ++i)
-                    {
-                        if (i > 0) faceStream >> faceToken;
-
-                        FaceIndex idx;
-                        sscanf(faceToken.c_str(), "%d/%d/%d", &idx.vertexId, &idx.textureId, &idx.normalId);
-
-                        // OBJ-like format: index starts at 1, so convert to 0-based
-                        idx.vertexId--;
-                        idx.textureId--;
-                        idx.normalId--;
-
-                        triangle[i] = idx;
-                    }
-
-                    mesh.faces.emplace_back(triangle);
-                }
+                std::cerr << "Malformed face in mesh " << mesh.id << std::endl;
+                exit(1);
             }
 
-            scene.objects.meshes.push_back(mesh);
+            scene.objects.meshes.push_back(std::move(mesh));
         }
     }
 }
 
-Scene XMLParser::parseScene(const std::string& filename) 
+Scene XMLParser::parseScene(const std::string& filename, int threadCount)
 {
     Scene scene;
 
@@ -254,7 +235,7 @@ Scene XMLParser::parseScene(const std::string& filename)
     // Parse geometry data
     if (root)
     {
-        parseGeometryData(root, scene);
+        parseGeometryData(root, scene, threadCount);
     }
     
     // Parse texture image name
@@ -268,7 +249,7 @@ Scene XMLParser::parseScene(const std::string& filename)
     // Parse objects
     if (root)
     {
-        parseObjects(root, scene);
+        parseObjects(root, scene, threadCount);
     }
    
     return scene;
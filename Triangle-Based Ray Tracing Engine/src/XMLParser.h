@@ -16,12 +16,13 @@ using namespace tinyxml2;
 class XMLParser 
 {
     public:
-        static Scene parseScene(const std::string& filename);
+        // The vertex, normal, texture and face blocks are decoded on threadCount threads
+        static Scene parseScene(const std::string& filename, int threadCount = 1);
         static void parseCamera(tinyxml2::XMLElement* camElem, Scene& scene);
         static void parseLights(XMLElement* lightsElem, Scene& scene);
         static void parseMaterials(tinyxml2::XMLElement* materialsElem, Scene& scene);
-        static void parseGeometryData(XMLElement* root, Scene& scene);
-        static void parseObjects(tinyxml2::XMLElement* root, Scene& scene);
+        static void parseGeometryData(XMLElement* root, Scene& scene, int threadCount = 1);
+        static void parseObjects(tinyxml2::XMLElement* root, Scene& scene, int threadCount = 1);
 };
 
 #endif // XMLPARSER_H
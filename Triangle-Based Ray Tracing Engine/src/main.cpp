@@ -5,27 +5,54 @@
 #include "Camera.h"
 #include "Scene.h"
 #include "XMLParser.h"
+#include "TileScheduler.h"
+#include "RenderOptions.h"
+#include "RaySort.h"
+#include "SceneCache.h"
+#include "ChunkCache.h"
+#include "RenderStats.h"
+#include "CostHeatmap.h"
+#include "PixelSampler.h"
+#include "TextureCache.h"
 #define STB_IMAGE_IMPLEMENTATION
-#include "./Include/stb_image.h"
+#include "stb_image.h"
 #include <bits/algorithmfwd.h>
 #include <thread>
 #include <chrono>
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <cstdio>
 
 using namespace std;
 
 // define all the functions
-const Light* getAmbientLight(const Scene& scene);
 Color getTextureColor(const Scene& scene, const FaceIndex& f0, const FaceIndex& f1, const FaceIndex& f2,
     float alpha, float beta, float gamma);
-bool isInShadow(const Scene& scene, const Vec3& origin, const Vec3& direction, float maxDistance);
-Color computeLighting(const Scene& scene, const Vec3& hitPoint, const Vec3& normal,
-    const Material& mat, const Ray& ray);
+bool isInShadow(const Scene& scene, const Vec3& origin, const Vec3& direction, float maxDistance, int lightIndex);
+void getLightDirection(const PointLights& lights, int light, const Vec3& hitPoint, Vec3& lightDir, float& lightDistance);
+template <unsigned Features>
+Color computeLighting(const Scene& scene, const Vec3& hitPoint, const Vec3& normal, uint32_t seed,
+    const ShadingMaterial& mat, const Ray& ray, const bool* shadowed);
 Color computeReflection(const Scene& scene, const Ray& ray, const Vec3& hitPoint,
     const Vec3& normal, const Material& mat, const Color& baseColor, int depth);
-bool intersectRayWithTriangle(const Vec3& o, const Vec3& d,
-    const Vec3& a, const Vec3& b, const Vec3& c,
-    float& t, float& beta, float& gamma);
-Vec3 computeColorTriangle(const Ray& ray, const Scene& scene, int depth);
+Vec3 computeColorTriangle(const Ray& ray, const Scene& scene, int depth, const RayDifferential* differential = nullptr);
+void intersectScene(const Scene& scene, const Ray& ray, HitRecord& hit);
+bool continueReflection(const Vec3& throughput, uint32_t seed, float& weight);
+Vec3 shadeHit(const Ray& ray, const HitRecord& hit, const Scene& scene, int depth, const bool* shadowed,
+    const RayDifferential* differential = nullptr);
+bool shadeSurface(const Ray& ray, const HitRecord& hit, const Scene& scene, int depth, const bool* shadowed,
+    Color& baseColor, Vec3& mirror, Ray& reflectedRay,
+    const RayDifferential* differential = nullptr, RayDifferential* reflectedDifferential = nullptr);
+Vec3 combineReflection(const Color& baseColor, const Vec3& mirror, const Vec3& reflectedColor);
+Vec3 getBackgroundColor(const Scene& scene);
+Vec3 getShadowOrigin(const Scene& scene, const Ray& ray, const HitRecord& hit, Vec3& hitPoint, Vec3& normal);
+bool isSamplingLights(const Scene& scene);
+int getShadowSlots(const Scene& scene);
+int sampleLights(const Scene& scene, const Vec3& hitPoint, const Vec3& normal, uint32_t seed, LightSample* samples);
+template <unsigned Features>
+Color shadeAreaLight(const Scene& scene, const AreaLight& light, int lightIndex, uint32_t seed, const Vec3& hitPoint,
+    const Vec3& adjustedNormal, const ShadingMaterial& mat, const Ray& ray);
 Vec2f computeInterpolatedUV(
     const Scene& scene,
     const FaceIndex& f0,
@@ -43,59 +70,62 @@ T myClamp(T value, T minVal, T maxVal)
     return value;
 }
 
-struct TextureImage
+// When a reflection path ends, set from the options in main. A reflection adds at most
+// its throughput (the product of the mirror reflectances above it) to the pixel, since
+// colours are clamped to [0, 1] at every bounce.
+struct ReflectionSettings
 {
-    unsigned char* data = nullptr;
-    int width, height, channels;
+    float minThroughput = 0.5f / 255.0f;    // below half an 8-bit step the rest of the path is cut
+    bool roulette = false;                  // Russian roulette instead of the hard cut
+    float rouletteThroughput = 0.05f;       // roulette: survival chance throughput / this below it
+};
 
-    // Returns the RGB float color of the (x,y) pixel
-    Color getColor(int x, int y) const
-    {
-        // 1. Check if texture data is loaded
-        if (data == nullptr)
-        {
-            return Color(1, 0, 1); // Magenta → error color
-        }
-    
-        // 2. Clamp x and y to stay within valid range
-        x = myClamp(x, 0, width - 1);
-        y = myClamp(y, 0, height - 1);
-    
-        // 3. Compute the index in the data array
-        int index = (y * width + x) * channels;
-    
-        int dataLength = width * height * channels;
-
-        // 4. Check if index goes out of bounds
-        int maxIndex = width * height * channels;
-
-        if (index + 2 >= maxIndex)
-        {
-            return Color(1, 0, 1); // Error → return magenta
-        }
-    
-        // 5. Read RGB values and normalize them from 0–255 to 0–1
-        float r = data[index]     / 255.0f;
-        float g = data[index + 1] / 255.0f;
-        float b = data[index + 2] / 255.0f;
+ReflectionSettings reflectionSettings;
 
-        return Color(r, g, b);
-    }
+TextureFilter textureFilter = FILTER_TRILINEAR;  // set from the options in main
+
+int lightSamples = 0;   // > 0: shadow rays per hit, lights picked from scene.lightTree when there are more
+
+// Shadow rays towards one triangle light, set from the options in main. The coarse ones
+// are traced first; only when they disagree (a penumbra) are the rest traced as well.
+struct AreaLightSettings
+{
+    int samples = 16;
+    int coarseSamples = 4;
 };
 
+AreaLightSettings areaLightSettings;
 
-TextureImage textureData; // Global texture data
+// Shading kernels are compiled per set of material features (the ShadingMaterial flags), so
+// a kernel has no branches on them and no pow for whole phong exponents. GENERIC_KERNEL
+// tests the flags of the material per hit and always calls pow, like shading did before.
+const unsigned GENERIC_KERNEL = 8;
 
-Color computeAmbientComponent(const Light* ambientLight, const Material& mat)
+template <unsigned Features>
+bool hasFeature(const ShadingMaterial& mat, ShadingMaterial::Flag flag)
 {
-    if (ambientLight == nullptr)
-        return Color(0.0f, 0.0f, 0.0f);
+    return Features == GENERIC_KERNEL ? mat.has(flag) : (Features & flag) != 0;
+}
 
-    return Color(
-        mat.ambient.x * ambientLight->intensity.x / 255.0f,
-        mat.ambient.y * ambientLight->intensity.y / 255.0f,
-        mat.ambient.z * ambientLight->intensity.z / 255.0f
-    );
+// x to a whole power by repeated squaring, a few multiplies instead of pow's log and exp
+float powInt(float x, int n)
+{
+    float result = 1.0f;
+    while (n > 0)
+    {
+        if (n & 1) result *= x;
+        x *= x;
+        n >>= 1;
+    }
+    return result;
+}
+
+template <unsigned Features>
+float specularPower(float specAngle, const ShadingMaterial& mat)
+{
+    if (Features != GENERIC_KERNEL && (Features & ShadingMaterial::INTEGER_PHONG) != 0)
+        return powInt(specAngle, mat.phongPower);
+    return pow(specAngle, mat.phongExponent);
 }
 
 Vec2f computeInterpolatedUV(
@@ -118,60 +148,246 @@ Vec2f computeInterpolatedUV(
     return uv0 * alpha + uv1 * beta + uv2 * gamma;
 }
 
-// 1. Ambient light
-const Light* getAmbientLight(const Scene& scene) 
+// 1. Ambient light: premultiplied into every ShadingMaterial by CompiledScene::build
+
+// 2. UV interpolasyonu and texture color, filtered over the pixel footprint duv (x and y) when given
+Color getTextureColor(const Scene& scene, const ShadingMaterial& mat, const Vec2f& uv, const Vec2f* duv)
+{
+    RT_COUNT(textureLookups, 1);
+    if (duv != nullptr)
+        return scene.textures->sample(mat.textureId, uv, duv[0], duv[1]);
+    return scene.textures->sample(mat.textureId, uv);
+}
+
+// Differentials of the camera rays, false when textures are point sampled and none are traced.
+// The spp rays of a pixel each stand for 1 / spp of its area, a footprint sqrt(spp) times smaller.
+bool getCameraDifferential(const Scene& scene, int spp, RayDifferential& differential)
+{
+    if (textureFilter == FILTER_NEAREST)
+        return false;
+    differential = scene.camera.getRayDifferential().scaled(1.0f / std::sqrt(static_cast<float>(spp)));
+    return true;
+}
+
+// Offsets in x and y of the hit point (dP) and of its uv (duv) for the rays of the neighbouring
+// pixels, which hit the plane of the triangle at other t. edges run from the first corner to
+// the other two, uvs are the corner uvs.
+void transferDifferential(const Ray& ray, const RayDifferential& differential, float t,
+                          const Vec3* edges, const Vec2f* uvs, Vec3* dP, Vec2f* duv)
 {
-    for (const auto& light : scene.lights) 
+    Vec3 d = ray.getDirection();
+    Vec3 planeNormal = edges[0].cross(edges[1]);
+    float dn = d.dot(planeNormal);
+
+    // Barycentric coordinates of an offset inside the plane, in the basis of the two edges
+    float a = edges[0].dot(edges[0]), b = edges[0].dot(edges[1]), c = edges[1].dot(edges[1]);
+    float det = a * c - b * b;
+    Vec2f du1{uvs[1].u - uvs[0].u, uvs[1].v - uvs[0].v}, du2{uvs[2].u - uvs[0].u, uvs[2].v - uvs[0].v};
+
+    const Vec3* dO[2] = {&differential.dOdx, &differential.dOdy};
+    const Vec3* dD[2] = {&differential.dDdx, &differential.dDdy};
+    for (int k = 0; k < 2; ++k)
     {
-        if (light->type == LightType::AMBIENT) 
-        {
-            return light.get();
-        }
+        Vec3 offset = *dO[k] + *dD[k] * t;
+        float dt = dn != 0.0f ? -offset.dot(planeNormal) / dn : 0.0f;
+        dP[k] = offset + d * dt;
+
+        float p0 = edges[0].dot(dP[k]), p1 = edges[1].dot(dP[k]);
+        float dBeta = det != 0.0f ? (c * p0 - b * p1) / det : 0.0f;
+        float dGamma = det != 0.0f ? (a * p1 - b * p0) / det : 0.0f;
+        duv[k] = du1 * dBeta + du2 * dGamma;
     }
-    return nullptr;
 }
 
-// 2. UV interpolasyonu and texture color
-Color getTextureColor(const Scene& scene, Vec2f& uv) 
+// Differentials of the normalised mirror direction of a ray with direction d about the facing
+// normal n, constant over the triangle, starting at the hit point offsets dP
+RayDifferential reflectDifferential(const Vec3& d, const RayDifferential& differential, const Vec3& n, const Vec3* dP)
 {
-    // 4. (u, v)
-    int texX = static_cast<int>(uv.u * textureData.width);
-    int texY = static_cast<int>((1.0f - uv.v) * textureData.height);
-    // clamp (safety)
-    texX = myClamp(texX, 0, textureData.width - 1);
-    texY = myClamp(texY, 0, textureData.height - 1);
+    Vec3 r = d - n * (2.0f * d.dot(n));
+    float length = r.length();
+    Vec3 direction = r * (1.0f / length);
 
-    return textureData.getColor(texX, texY);
+    Vec3 dR[2];
+    const Vec3* dD[2] = {&differential.dDdx, &differential.dDdy};
+    for (int k = 0; k < 2; ++k)
+    {
+        Vec3 dr = *dD[k] - n * (2.0f * dD[k]->dot(n));
+        dR[k] = (dr - direction * direction.dot(dr)) * (1.0f / length);
+    }
+    return RayDifferential{dP[0], dP[1], dR[0], dR[1]};
 }
 
 // 3. Shadow check
-bool isInShadow(const Scene& scene, const Vec3& origin, const Vec3& direction, float maxDistance) {
-    
+// Every render thread remembers, per light, the last triangle that blocked it.
+// Neighbouring pixels are usually shadowed by the same triangle, so it is tested first.
+thread_local std::vector<int> lastOccluder;  // indexed by light number in scene.compiled
+
+// The calling thread's cache, one entry (-1: none yet) per light of the scene
+std::vector<int>& getLastOccluders(const Scene& scene)
+{
+    if (lastOccluder.size() != static_cast<size_t>(scene.compiled.getLightCount()))
+    {
+        lastOccluder.assign(scene.compiled.getLightCount(), -1);
+    }
+    return lastOccluder;
+}
+
+bool isInShadow(const Scene& scene, const Vec3& origin, const Vec3& direction, float maxDistance, int lightIndex)
+{
     Ray shadowRay(origin, direction);
-    
-    for (const auto& mesh : scene.objects.meshes) 
+    int& occluder = getLastOccluders(scene)[lightIndex];
+    int cached = occluder;
+
+    RT_COUNT(shadowRays, 1);
+    bool blocked = scene.chunks != nullptr ? scene.chunks->occluded(shadowRay, 1e-4f, maxDistance, occluder)
+                                           : scene.bvh.occluded(shadowRay, 1e-4f, maxDistance, occluder);
+    if (!blocked)
+        return false;
+
+    RT_COUNT(shadowOccluded, 1);
+    if (cached >= 0 && occluder == cached) RT_COUNT(occluderCacheHits, 1);
+    return true;
+}
+
+// Direction from hitPoint towards point light number light and the distance to it. Triangle
+// lights have no single direction, shadeAreaLight samples them.
+void getLightDirection(const PointLights& lights, int light, const Vec3& hitPoint, Vec3& lightDir, float& lightDistance)
+{
+    lightDir = lights.position(light) - hitPoint;
+    lightDistance = lightDir.length();
+    lightDir = lightDir.normalized();
+}
+
+// Whether hits shade a few lights picked from the light tree instead of every light
+bool isSamplingLights(const Scene& scene)
+{
+    return lightSamples > 0 && scene.lightTree.getLightCount() > lightSamples;
+}
+
+// Shadow results per hit: one per picked light when sampling, otherwise one per point light
+// (triangle lights trace their own). shadowed arrays are laid out [hit * slots + slot].
+int getShadowSlots(const Scene& scene)
+{
+    return isSamplingLights(scene) ? lightSamples : scene.compiled.pointLights.size();
+}
+
+// Random number of a hit on face faceIndex of mesh meshIndex, the same whichever BVH and
+// traversal found it: from the face in the scene (hit.triIndex is its place in the BVH,
+// which every builder orders differently) and the barycentrics rounded to 2^-16, not
+// from the bits of the position, which move with the last bits of t
+uint32_t hashHit(int meshIndex, int faceIndex, const HitRecord& hit)
+{
+    uint32_t beta = static_cast<uint32_t>(std::max(hit.beta, 0.0f) * 65536.0f);
+    uint32_t gamma = static_cast<uint32_t>(std::max(hit.gamma, 0.0f) * 65536.0f);
+    uint32_t h = static_cast<uint32_t>(meshIndex) * 0x7feb352du ^ static_cast<uint32_t>(faceIndex) * 0x9e3779b1u ^
+                 beta * 0x85ebca6bu ^ gamma * 0xc2b2ae35u;
+    h ^= h >> 15;
+    h *= 0x2c1b3c6du;
+    h ^= h >> 12;
+    return h;
+}
+
+// The same, looking the face of the hit up
+uint32_t hashHit(const Scene& scene, const HitRecord& hit)
+{
+    if (scene.chunks != nullptr)
     {
-        for (const auto& tri : mesh.faces) 
+        ChunkTriangle triangle = scene.chunks->getTriangle(hit.triIndex);
+        return hashHit(triangle.meshIndex, triangle.faceIndex, hit);
+    }
+    const TriangleRef& ref = scene.bvh.getTriangle(hit.triIndex);
+    return hashHit(ref.meshIndex, ref.faceIndex, hit);
+}
+
+// The lights a hit point with facing normal n shades when sampling. seed is hashHit of the
+// hit, so the packet and wavefront shadow passes pick the lights shading does.
+int sampleLights(const Scene& scene, const Vec3& hitPoint, const Vec3& normal, uint32_t seed, LightSample* samples)
+{
+    return scene.lightTree.sample(hitPoint, normal, seed, lightSamples, samples);
+}
+
+// Diffuse and specular light of one unshadowed light of the given intensity arriving from lightDir
+template <unsigned Features>
+Color shadeLight(const Vec3& intensity, const Vec3& hitPoint, const Vec3& adjustedNormal, const Vec3& lightDir,
+                 const ShadingMaterial& mat, const Ray& ray)
+{
+    float diff = std::max(0.0f, adjustedNormal.dot(lightDir));
+
+    Color diffuse(
+        mat.diffuse.x * intensity.x * diff / 255.0f,
+        mat.diffuse.y * intensity.y * diff / 255.0f,
+        mat.diffuse.z * intensity.z * diff / 255.0f
+    );
+
+    Vec3 viewDir = (ray.getOrigin() - hitPoint).normalized();
+    Vec3 halfDir = (viewDir + lightDir).normalized();
+
+    float specAngle = std::max(0.0f, adjustedNormal.dot(halfDir));
+    float spec = specularPower<Features>(specAngle, mat);
+
+    Color specular(
+        mat.specular.x * intensity.x * spec / 255.0f,
+        mat.specular.y * intensity.y * spec / 255.0f,
+        mat.specular.z * intensity.z * spec / 255.0f
+    );
+    return diffuse + specular;
+}
+
+// Light of a triangle light, averaged over points spread evenly across it with the shadow
+// rays to them. The light leaves the side its normal points to and, like a point light,
+// does not fall off with distance. The points are a scrambled (0,2) sequence mapped
+// uniformly onto the triangle, scrambled by the hit's seed (hashHit) and the light.
+template <unsigned Features>
+Color shadeAreaLight(const Scene& scene, const AreaLight& light, int lightIndex, uint32_t seed, const Vec3& hitPoint,
+                     const Vec3& adjustedNormal, const ShadingMaterial& mat, const Ray& ray)
+{
+    Vec3 origin = hitPoint + adjustedNormal * 0.001f;
+
+    uint32_t scrambleU = seed ^ static_cast<uint32_t>(lightIndex) * 0x27d4eb2fu;
+    uint32_t scrambleV = scrambleU * 0x165667b1u ^ (scrambleU >> 15);
+
+    // 1. The coarse samples, then the rest only where they found a penumbra
+    Color sum(0.0f, 0.0f, 0.0f);
+    int traced = 0, visible = 0;
+    int count = areaLightSettings.coarseSamples;
+    for (int i = 0; i < count; ++i)
+    {
+        float u, v;
+        PixelSampler::getPoint(i, scrambleU, scrambleV, u, v);
+        float s = std::sqrt(u);
+        Vec3 point = light.v0 * (1.0f - s) + light.v1 * (s * (1.0f - v)) + light.v2 * (s * v);
+
+        Vec3 lightDir = point - hitPoint;
+        float lightDistance = lightDir.length();
+        lightDir = lightDir.normalized();
+        traced++;
+
+        // 2. Points the light does not shine towards and blocked ones add nothing
+        if (lightDir.dot(light.normal) < 0.0f && !isInShadow(scene, origin, lightDir, lightDistance, lightIndex))
         {
-            Vec3 a = scene.vertexData[tri[0].vertexId];
-            Vec3 b = scene.vertexData[tri[1].vertexId];
-            Vec3 c = scene.vertexData[tri[2].vertexId];
-            
-            float t, beta, gamma;
-            
-            if (intersectRayWithTriangle(shadowRay.getOrigin(), shadowRay.getDirection(), a, b, c, t, beta, gamma)) 
-            {
-                if (t > 1e-4f && t < maxDistance) return true;
-            }
+            sum += shadeLight<Features>(light.intensity, hitPoint, adjustedNormal, lightDir, mat, ray);
+            visible++;
+        }
+
+        if (traced == areaLightSettings.coarseSamples && visible > 0 && visible < traced)
+        {
+            count = areaLightSettings.samples;
+            RT_COUNT(penumbraHits, 1);
         }
     }
-    return false;
+    RT_COUNT(areaLightHits, 1);
+    RT_COUNT(areaLightRays, traced);
+
+    return sum * (1.0f / traced);
 }
 
 // 4. Calculate lighting
-Color computeLighting(const Scene& scene, const Vec3& hitPoint, const Vec3& normal,
-                      const Material& mat, const Ray& ray) 
+// shadowed[slot] holds shadow results already traced by a packet, nullptr traces them here
+template <unsigned Features>
+Color computeLighting(const Scene& scene, const Vec3& hitPoint, const Vec3& normal, uint32_t seed,
+                      const ShadingMaterial& mat, const Ray& ray, const bool* shadowed) 
 {
+    const CompiledScene& compiled = scene.compiled;
     Color result(0, 0, 0.0);
 
     Vec3 adjustedNormal = normal;
@@ -180,67 +396,55 @@ Color computeLighting(const Scene& scene, const Vec3& hitPoint, const Vec3& norm
     {
         adjustedNormal = Vec3(-normal.x, -normal.y, -normal.z);
     }
-        
-    for (const auto& lightPtr : scene.lights) 
-    {
-        if (lightPtr->type == LightType::AMBIENT) continue;
 
-        float lightDistance;
-        Vec3 lightDir;
-
-        if (lightPtr->type == LightType::POINT) 
-        {
-            auto* pl = static_cast<const PointLight*>(lightPtr.get());
-            lightDir = (pl->position - hitPoint);
-            lightDistance = lightDir.length();
-            lightDir = lightDir.normalized();
-        }
-        else if (lightPtr->type == LightType::TRIANGLE) 
+    if (isSamplingLights(scene))
+    {
+        // A few lights, each weighted by how unlikely it was to be picked
+        LightSample samples[LightTree::MAX_SAMPLES];
+        int sampleCount = sampleLights(scene, hitPoint, adjustedNormal, seed, samples);
+        for (int slot = 0; slot < sampleCount; ++slot)
         {
-            auto* tl = static_cast<const TriangleLight*>(lightPtr.get());
-            Vec3 edge1 = tl->v1 - tl->v0;
-            Vec3 edge2 = tl->v2 - tl->v0;
-            lightDir = (edge1.cross(edge2).normalized()) * -1.0f;
-            lightDistance = 1e9f;
-
-            // auto* tl = static_cast<const TriangleLight*>(lightPtr.get());
-
-            // Vec3 edge1 = tl->v0 - tl->v1; // vertex1 - vertex2
-            // Vec3 edge2 = tl->v0 - tl->v2; // vertex1 - vertex3
+            int light = samples[slot].lightIndex;
+            if (compiled.isAreaLight(light))
+            {
+                result += shadeAreaLight<Features>(scene, compiled.getAreaLight(light), light, seed, hitPoint, adjustedNormal, mat, ray)
+                          * samples[slot].weight;
+                continue;
+            }
 
-            // lightDir = (edge1.cross(edge2)).normalized();
-            // lightDir = lightDir * -1.0f; // light dir
+            float lightDistance;
+            Vec3 lightDir;
+            getLightDirection(compiled.pointLights, light, hitPoint, lightDir, lightDistance);
 
-            // lightDistance = 1e9f; // infinite distance
-        } 
-        else 
-            continue;
+            if (shadowed != nullptr ? shadowed[slot]
+                                    : isInShadow(scene, hitPoint + adjustedNormal * 0.001f, lightDir, lightDistance, light)) continue;
 
-       if (isInShadow(scene, hitPoint + adjustedNormal * 0.001f, lightDir, lightDistance)) continue;
+            result += shadeLight<Features>(compiled.pointLights.intensity[light], hitPoint, adjustedNormal, lightDir, mat, ray)
+                      * samples[slot].weight;
+        }
+    }
+    else
+    {
+        int pointCount = compiled.pointLights.size();
+        for (int light = 0; light < pointCount; ++light)
+        {
+            float lightDistance;
+            Vec3 lightDir;
+            getLightDirection(compiled.pointLights, light, hitPoint, lightDir, lightDistance);
 
-        float diff = std::max(0.0f, adjustedNormal.dot(lightDir));
-        
-        Color diffuse(
-            mat.diffuse.x * lightPtr->intensity.x * diff / 255.0f,
-            mat.diffuse.y * lightPtr->intensity.y * diff / 255.0f,
-            mat.diffuse.z * lightPtr->intensity.z * diff / 255.0f
-        );
+            if (shadowed != nullptr ? shadowed[light]
+                                    : isInShadow(scene, hitPoint + adjustedNormal * 0.001f, lightDir, lightDistance, light)) continue;
 
-        Vec3 viewDir = (ray.getOrigin() - hitPoint).normalized();
-        Vec3 halfDir = (viewDir + lightDir).normalized();
-        
-        float specAngle = std::max(0.0f, adjustedNormal.dot(halfDir));
-        float spec = pow(specAngle, mat.phongExponent);
+            result += shadeLight<Features>(compiled.pointLights.intensity[light], hitPoint, adjustedNormal, lightDir, mat, ray);
+        }
 
-        Color specular(
-            mat.specular.x * lightPtr->intensity.x * spec / 255.0f,
-            mat.specular.y * lightPtr->intensity.y * spec / 255.0f,
-            mat.specular.z * lightPtr->intensity.z * spec / 255.0f
-        );
-        result += diffuse + specular;
+        // Area lights trace their own shadow rays, the packet passes leave them out
+        for (int i = 0; i < static_cast<int>(compiled.areaLights.size()); ++i)
+        {
+            result += shadeAreaLight<Features>(scene, compiled.areaLights[i], pointCount + i, seed, hitPoint, adjustedNormal, mat, ray);
+        }
     }
 
-    
     result = Color(
         myClamp(result.getColorR(), 0.0f, 1.0f),
         myClamp(result.getColorG(), 0.0f, 1.0f),
@@ -285,242 +489,1207 @@ Color computeReflection(const Scene& scene, const Ray& ray, const Vec3& hitPoint
 }
 
 
-bool intersectRayWithTriangle(const Vec3& o, const Vec3& d,
-    const Vec3& a, const Vec3& b, const Vec3& c,
-    float& t, float& beta, float& gamma)
+void intersectScene(const Scene& scene, const Ray& ray, HitRecord& hit)
+{
+    if (scene.chunks != nullptr)
+        scene.chunks->intersect(ray, hit);
+    else
+        scene.bvh.intersect(ray, hit);
+}
+
+Vec3 computeColorTriangle(const Ray& ray, const Scene& scene, int depth, const RayDifferential* differential)
+{
+    HitRecord hit;
+    intersectScene(scene, ray, hit);
+    return shadeHit(ray, hit, scene, depth, nullptr, differential);
+}
+
+// Whether the reflection of a path with the given throughput (including the mirror it
+// leaves) is traced. weight receives the factor of its colour: 1, or 1 / survival chance
+// for a Russian roulette survivor, which keeps the expected colour unchanged.
+bool continueReflection(const Vec3& throughput, uint32_t seed, float& weight)
+{
+    float strongest = std::max(throughput.x, std::max(throughput.y, throughput.z));
+    weight = 1.0f;
+
+    if (reflectionSettings.roulette && strongest < reflectionSettings.rouletteThroughput)
+    {
+        // Deterministic per mirror hit (seed is its hashHit), so renders stay reproducible
+        float survival = strongest / reflectionSettings.rouletteThroughput;
+        if ((seed >> 8) * (1.0f / 16777216.0f) >= survival) return false;
+        weight = 1.0f / survival;
+        return true;
+    }
+    return strongest >= reflectionSettings.minThroughput;
+}
+
+// Surface attributes of a hit, reconstructed from its HitRecord by getSurface
+struct SurfacePoint
+{
+    int materialId;
+    Vec3 position, normal;
+    uint32_t seed;  // hashHit, the random numbers of lights sampled from the point
+    Vec2f uv;       // textured materials only
+    Vec3 dP[2];     // pixel footprint on the surface, with a differential for textured or reflecting materials only
+    Vec2f duv[2];
+};
+
+// Reconstructs the surface of the closest hit. Position, normal and material always; the uv
+// and the footprint only when the material reads them (a texture, or a mirror reflection that
+// carries the differential on), so hits on plain materials skip the corner uvs and edges.
+void getSurface(const Scene& scene, const Ray& ray, const HitRecord& hit, int depth,
+                const RayDifferential* differential, SurfacePoint& surface)
 {
-    Vec3 e1 = b - a;
-    Vec3 e2 = c - a;
+    // 1. Material and normal; out of core the chunk holds the shading data of the triangle
+    bool chunked = scene.chunks != nullptr;
+    ChunkTriangle chunkTriangle;
+    const std::array<FaceIndex, 3>* face = nullptr;
+    if (chunked)
+    {
+        chunkTriangle = scene.chunks->getTriangle(hit.triIndex);
+        surface.materialId = chunkTriangle.materialId;
+        surface.normal = chunkTriangle.normal.normalized();
+        surface.seed = hashHit(chunkTriangle.meshIndex, chunkTriangle.faceIndex, hit);
+    }
+    else
+    {
+        const TriangleRef& ref = scene.bvh.getTriangle(hit.triIndex);
+        const Mesh& mesh = scene.objects.meshes[ref.meshIndex];
+        face = &mesh.faces[ref.faceIndex];
+        surface.materialId = mesh.materialId;
+        surface.normal = scene.normalData[(*face)[0].normalId].normalized();
+        surface.seed = hashHit(ref.meshIndex, ref.faceIndex, hit);
+    }
+    surface.position = ray.getOrigin() + ray.getDirection() * hit.t;
 
-    Vec3 s = o - a;
+    // 2. What the material reads beyond that
+    const ShadingMaterial& mat = scene.compiled.materials[surface.materialId - 1];
+    bool textured = mat.has(ShadingMaterial::TEXTURED);
+    bool footprint = differential != nullptr && (textured || (mat.has(ShadingMaterial::MIRROR) && depth > 0));
+    if (!textured && !footprint)
+        return;
 
-    // Matrisin columns:
-    // A = [ -d | e1 | e2 ] → 3x3 matrix
-    Vec3 col1 = d*-1; // -d
-    Vec3 col2 = e1;
-    Vec3 col3 = e2;
+    // 3. uv and footprint from the corners
+    if (chunked)
+    {
+        float alpha = 1.0f - hit.beta - hit.gamma;
+        surface.uv = chunkTriangle.uv[0] * alpha + chunkTriangle.uv[1] * hit.beta + chunkTriangle.uv[2] * hit.gamma;
+        if (footprint)
+            transferDifferential(ray, *differential, hit.t, chunkTriangle.edges, chunkTriangle.uv, surface.dP, surface.duv);
+    }
+    else
+    {
+        const auto& triangle = *face;
+        surface.uv = computeInterpolatedUV(scene, triangle[0], triangle[1], triangle[2], hit.beta, hit.gamma);
+        if (footprint)
+        {
+            const Vec3& v0 = scene.vertexData[triangle[0].vertexId];
+            Vec3 edges[2] = {scene.vertexData[triangle[1].vertexId] - v0, scene.vertexData[triangle[2].vertexId] - v0};
+            Vec2f uvs[3] = {scene.textureData[triangle[0].textureId], scene.textureData[triangle[1].textureId],
+                            scene.textureData[triangle[2].textureId]};
+            transferDifferential(ray, *differential, hit.t, edges, uvs, surface.dP, surface.duv);
+        }
+    }
+}
 
-    // det(A) → determinant calc: |A| = col1 · (col2 × col3)
-    float det = col1.dot(col2.cross(col3)); // cross product
+// Shading of a hit on a material with the given features (see GENERIC_KERNEL): ambient, lights
+// and texture into baseColor and, for a mirror, the reflected ray (mirror is left at zero otherwise)
+template <unsigned Features>
+void shadeMaterial(const Scene& scene, const Ray& ray, const SurfacePoint& surface, const ShadingMaterial& mat,
+                   int depth, const bool* shadowed, const RayDifferential* differential,
+                   Color& baseColor, Vec3& mirror, Ray& reflectedRay, RayDifferential* reflectedDifferential)
+{
+    const Vec3& hitPoint = surface.position;
+    const Vec3& normal = surface.normal;
 
-    // if determinant too close to zero, return false
-    if (fabs(det) < 1e-8) return false;
+    Color finalColor = mat.ambient;
+    finalColor += computeLighting<Features>(scene, hitPoint, normal, surface.seed, mat, ray, shadowed);
 
-    // inverse det
-    float invDet = 1.0f / det;
+    // A texture factor of 0 keeps the lit colour as it is, nothing to sample
+    if (hasFeature<Features>(mat, ShadingMaterial::TEXTURED))
+    {
+        Color textureColor = getTextureColor(scene, mat, surface.uv, differential != nullptr ? surface.duv : nullptr);
+        float tFactor = mat.textureFactor;
+        baseColor = finalColor * (1.0f - tFactor) + textureColor * tFactor;
+    }
+    else
+        baseColor = finalColor;
 
-    // Cramer’s Rule:
-    // t = |[s | e1 | e2]| / |A| = dot(s, (e1 × e2)) / det
-    float tVal = s.dot(col2.cross(col3)) * invDet; // t = |[s | e1 | e2]| / |A|
+    if (hasFeature<Features>(mat, ShadingMaterial::MIRROR) && depth > 0)
+    {
+        Vec3 normalAdjusted = normal;
+        if (ray.getDirection().dot(normalAdjusted) > 0)
+        {
+            normalAdjusted = Vec3(-normal.x, -normal.y, -normal.z);
+        }
 
-    // β = |[-d | s | e2]| / |A| = dot(-d, (s × e2)) / det
-    // float betaVal = dot(col1, cross(s, col3)) * invDet;
-    float betaVal = col1.dot(s.cross(col3)) * invDet; // β = |[-d | s | e2]| / |A|
+        Vec3 wo = ray.getDirection() * -1.0f;
+        float dotProduct = normalAdjusted.dot(wo);
 
-    // γ = |[-d | e1 | s]| / |A| = dot(-d, (e1 × s)) / det
-    // float gammaVal = dot(col1, cross(col2, s)) * invDet;
-    float gammaVal = col1.dot(col2.cross(s)) * invDet; // γ = |[-d | e1 | s]| / |A|
-    // Barycentric conditions:
-    if (betaVal < 0 || gammaVal < 0 || (betaVal + gammaVal) > 1) return false;
+        Vec3 reflectDir = Vec3(
+            -wo.x + 2.0f * normalAdjusted.x * dotProduct,
+            -wo.y + 2.0f * normalAdjusted.y * dotProduct,
+            -wo.z + 2.0f * normalAdjusted.z * dotProduct
+        );
 
-    // t < 0
-    if (tVal < 0) return false;
+        reflectedRay = Ray(
+            Vec3(
+                hitPoint.x + normalAdjusted.x * 0.001f,
+                hitPoint.y + normalAdjusted.y * 0.001f,
+                hitPoint.z + normalAdjusted.z * 0.001f
+            ),
+            reflectDir.normalized()
+        );
+        mirror = mat.mirror;
+        if (differential != nullptr && reflectedDifferential != nullptr)
+            *reflectedDifferential = reflectDifferential(ray.getDirection(), *differential, normalAdjusted, surface.dP);
+    }
+}
 
-    t = tVal;
-    beta = betaVal;
-    gamma = gammaVal;
+typedef void (*MaterialKernel)(const Scene& scene, const Ray& ray, const SurfacePoint& surface, const ShadingMaterial& mat,
+                               int depth, const bool* shadowed, const RayDifferential* differential,
+                               Color& baseColor, Vec3& mirror, Ray& reflectedRay, RayDifferential* reflectedDifferential);
 
+// Indexed by the flags of a material
+static_assert((ShadingMaterial::MIRROR | ShadingMaterial::TEXTURED | ShadingMaterial::INTEGER_PHONG) == 7,
+              "one kernel per combination of flags");
+const MaterialKernel MATERIAL_KERNELS[8] = {
+    shadeMaterial<0>, shadeMaterial<1>, shadeMaterial<2>, shadeMaterial<3>,
+    shadeMaterial<4>, shadeMaterial<5>, shadeMaterial<6>, shadeMaterial<7>
+};
+
+std::vector<MaterialKernel> materialKernels;    // per material, chosen in main from its flags
+
+// Local shading of a hit: ambient, lights and texture without the mirror term.
+// Returns false for a miss. mirror is zero unless a reflection ray has to be traced
+// (a mirror material and depth > 0), in which case reflectedRay is set. With the ray's
+// differential the texture is filtered and reflectedDifferential is set along with reflectedRay.
+bool shadeSurface(const Ray& ray, const HitRecord& hit, const Scene& scene, int depth, const bool* shadowed,
+                  Color& baseColor, Vec3& mirror, Ray& reflectedRay,
+                  const RayDifferential* differential, RayDifferential* reflectedDifferential)
+{
+    mirror = Vec3(0, 0, 0);
+    if (hit.triIndex < 0)
+        return false;
+
+    // --- Attributes of the closest hit, only those its material reads ---
+    SurfacePoint surface;
+    getSurface(scene, ray, hit, depth, differential, surface);
+
+    int material = surface.materialId - 1;
+    materialKernels[material](scene, ray, surface, scene.compiled.materials[material], depth, shadowed, differential,
+                              baseColor, mirror, reflectedRay, reflectedDifferential);
     return true;
 }
 
-Vec3 computeColorTriangle(const Ray& ray, const Scene& scene, int depth)
+// Colour of a hit: its local shading plus the mirror weighted colour of the reflected ray
+Vec3 combineReflection(const Color& baseColor, const Vec3& mirror, const Vec3& reflectedColor)
 {
-    Color resultColor(scene.backgroundColor.getColorR(), scene.backgroundColor.getColorG(), scene.backgroundColor.getColorB());
-    float minT = 1e9;
+    Color reflectionComponent(
+        reflectedColor.x * mirror.x,
+        reflectedColor.y * mirror.y,
+        reflectedColor.z * mirror.z
+    );
 
-    const Light* ambientLight = getAmbientLight(scene);
+    Color finalCombined = baseColor + reflectionComponent;
 
-    Vec3 hitPoint, normal;
-    Color textureColor;
-    float tFactor = 0.0f;
-    const Material* hitMaterial = nullptr;
+    return Vec3(
+        myClamp(finalCombined.getColorR(), 0.0f, 1.0f),
+        myClamp(finalCombined.getColorG(), 0.0f, 1.0f),
+        myClamp(finalCombined.getColorB(), 0.0f, 1.0f)
+    );
+}
 
-    FaceIndex f0, f1, f2;
-    float beta = 0, gamma = 0;
+Vec3 getBackgroundColor(const Scene& scene)
+{
+    return Vec3(scene.backgroundColor.getColorR(), scene.backgroundColor.getColorG(), scene.backgroundColor.getColorB());
+}
 
-    // --- Triangle intersection ---
-    for (const auto& mesh : scene.objects.meshes)
+// One mirror hit of a reflection path, combined with the colour below it once the path ends
+struct PathVertex
+{
+    Color baseColor;
+    Vec3 mirror;
+};
+
+// Colour of a ray whose closest hit is already known (hit.triIndex < 0 is a miss).
+// The reflections are followed in a loop, not by recursion: every mirror hit is kept on
+// a small per thread stack and the colours are combined bottom up at the end, with the
+// same clamping per bounce as before. shadowed applies to the first hit only, differential
+// (nullptr: nearest texels) to the first ray and is carried along the reflections.
+Vec3 shadeHit(const Ray& ray, const HitRecord& hit, const Scene& scene, int depth, const bool* shadowed,
+              const RayDifferential* differential)
+{
+    thread_local std::vector<PathVertex> path;  // reused, no allocation per pixel
+    path.clear();
+
+    Ray current = ray;
+    HitRecord currentHit = hit;
+    RayDifferential currentDifferential, reflectedDifferential;
+    if (differential != nullptr)
     {
-        const Material& mat = scene.materials[mesh.materialId - 1];
+        currentDifferential = *differential;
+        differential = &currentDifferential;
+    }
+    Vec3 throughput(1, 1, 1);
+    Vec3 color;
 
-        for (const auto& triangle : mesh.faces)
+    // 1. Down the path until a miss, a surface without reflection or a low throughput
+    for (;; --depth)
+    {
+        PathVertex vertex;
+        Ray reflectedRay;
+        if (!shadeSurface(current, currentHit, scene, depth, shadowed, vertex.baseColor, vertex.mirror, reflectedRay,
+                          differential, &reflectedDifferential))
         {
-            FaceIndex tempF0 = triangle[0];
-            FaceIndex tempF1 = triangle[1];
-            FaceIndex tempF2 = triangle[2];
+            color = getBackgroundColor(scene);
+            break;
+        }
 
-            Vec3 a = scene.vertexData[tempF0.vertexId];
-            Vec3 b = scene.vertexData[tempF1.vertexId];
-            Vec3 c = scene.vertexData[tempF2.vertexId];
+        const Vec3& mirror = vertex.mirror;
+        float weight = 1.0f;
+        if (mirror.x <= 0 && mirror.y <= 0 && mirror.z <= 0)
+        {
+            color = combineReflection(vertex.baseColor, mirror, Vec3(0, 0, 0));
+            break;
+        }
+
+        throughput = Vec3(throughput.x * mirror.x, throughput.y * mirror.y, throughput.z * mirror.z);
+        if (!continueReflection(throughput, hashHit(scene, currentHit), weight))
+        {
+            RT_COUNT(reflectionsCut, 1);
+            color = combineReflection(vertex.baseColor, mirror, Vec3(0, 0, 0));
+            break;
+        }
 
-            float t, tempBeta, tempGamma;
+        throughput = throughput * weight;
+        vertex.mirror = mirror * weight;
+        path.push_back(vertex);
 
-            if (intersectRayWithTriangle(ray.getOrigin(), ray.getDirection(), a, b, c, t, tempBeta, tempGamma))
+        RT_COUNT(reflectionRays, 1);
+        current = reflectedRay;
+        currentDifferential = reflectedDifferential;
+        currentHit = HitRecord();
+        intersectScene(scene, current, currentHit);
+        shadowed = nullptr;
+    }
+
+    // 2. Back up to the first hit
+    for (int i = static_cast<int>(path.size()) - 1; i >= 0; --i)
+    {
+        color = combineReflection(path[i].baseColor, path[i].mirror, color);
+    }
+    return color;
+}
+
+// Start of the shadow rays of a hit, same offset along the facing normal as computeLighting
+Vec3 getShadowOrigin(const Scene& scene, const Ray& ray, const HitRecord& hit, Vec3& hitPoint, Vec3& normal)
+{
+    const TriangleRef& ref = scene.bvh.getTriangle(hit.triIndex);
+    const FaceIndex& f0 = scene.objects.meshes[ref.meshIndex].faces[ref.faceIndex][0];
+
+    hitPoint = ray.getOrigin() + ray.getDirection() * hit.t;
+    normal = scene.normalData[f0.normalId].normalized();
+    if (ray.getDirection().dot(normal) > 0)
+        normal = Vec3(-normal.x, -normal.y, -normal.z);
+    return hitPoint + normal * 0.001f;
+}
+
+// Traces the shadow rays of all lanes for each slot (a light, or the slot-th light each
+// lane picked when sampling) as one packet. shadowed[lane * slots + slot] receives the result.
+void traceShadowPackets(const Scene& scene, const Ray* rays, const HitRecord* hits, uint32_t lanes, bool* shadowed)
+{
+    int slots = getShadowSlots(scene);
+    bool sampling = isSamplingLights(scene);
+    const CompiledScene& compiled = scene.compiled;
+    std::vector<int>& occluderCache = getLastOccluders(scene);
+
+    Vec3 origins[PACKET_SIZE], hitPoints[PACKET_SIZE];
+    LightSample samples[PACKET_SIZE][LightTree::MAX_SAMPLES];
+    int sampleCounts[PACKET_SIZE] = {};
+    for (uint32_t m = lanes; m != 0; m &= m - 1)
+    {
+        int lane = __builtin_ctz(m);
+        Vec3 normal;
+        origins[lane] = getShadowOrigin(scene, rays[lane], hits[lane], hitPoints[lane], normal);
+        if (sampling)
+            sampleCounts[lane] = sampleLights(scene, hitPoints[lane], normal, hashHit(scene, hits[lane]), samples[lane]);
+    }
+
+    for (int slot = 0; slot < slots; ++slot)
+    {
+        RayPacket packet;
+        float tMin[PACKET_SIZE], tMax[PACKET_SIZE];
+        int occluders[PACKET_SIZE], cached[PACKET_SIZE], lights[PACKET_SIZE];
+
+        for (uint32_t m = lanes; m != 0; m &= m - 1)
+        {
+            int lane = __builtin_ctz(m);
+            if (sampling && slot >= sampleCounts[lane]) continue;
+            int lightIndex = sampling ? samples[lane][slot].lightIndex : slot;
+            if (compiled.isAreaLight(lightIndex)) continue;
+
+            Vec3 lightDir;
+            float lightDistance;
+            getLightDirection(compiled.pointLights, lightIndex, hitPoints[lane], lightDir, lightDistance);
+
+            packet.setRay(lane, origins[lane], lightDir);
+            tMin[lane] = 1e-4f;
+            tMax[lane] = lightDistance;
+            lights[lane] = lightIndex;
+            occluders[lane] = cached[lane] = occluderCache[lightIndex];
+        }
+        if (packet.active == 0) continue;
+
+        uint32_t blocked = scene.bvh.occludedPacket(packet, tMin, tMax, occluders);
+
+        RT_COUNT(shadowRays, __builtin_popcount(packet.active));
+        RT_COUNT(shadowOccluded, __builtin_popcount(blocked));
+        for (uint32_t m = packet.active; m != 0; m &= m - 1)
+        {
+            int lane = __builtin_ctz(m);
+            bool isBlocked = (blocked >> lane) & 1;
+            shadowed[lane * slots + slot] = isBlocked;
+            if (isBlocked)
             {
-                if (t < minT)
-                {
-                    minT = t;
+                if (cached[lane] >= 0 && occluders[lane] == cached[lane]) RT_COUNT(occluderCacheHits, 1);
+                occluderCache[lights[lane]] = occluders[lane];
+            }
+        }
+    }
+}
+
+// Primary and shadow rays of 4x4 pixel blocks are traced as packets,
+// reflections fall back to single rays since they no longer stay coherent
+void renderTilePackets(const Tile& tile, Image& image, const Scene& scene)
+{
+    StatsSpan span("tile", &tile);
+    int slots = getShadowSlots(scene);
+    std::vector<char> shadowFlags(PACKET_SIZE * std::max(1, slots));
+    bool* shadowed = reinterpret_cast<bool*>(shadowFlags.data());
+    RayDifferential differential;
+    bool traceDifferential = getCameraDifferential(scene, 1, differential);
+
+    for (int by = tile.y0; by < tile.y1; by += PACKET_WIDTH)
+    {
+        for (int bx = tile.x0; bx < tile.x1; bx += PACKET_WIDTH)
+        {
+            RayPacket packet;
+            Ray rays[PACKET_SIZE];
+            HitRecord hits[PACKET_SIZE];
+
+            for (int lane = 0; lane < PACKET_SIZE; ++lane)
+            {
+                int x = bx + lane % PACKET_WIDTH;
+                int y = by + lane / PACKET_WIDTH;
+                if (x >= tile.x1 || y >= tile.y1) continue;
 
-                    f0 = tempF0;
-                    f1 = tempF1;
-                    f2 = tempF2;
-                    beta = tempBeta;
-                    gamma = tempGamma;
+                rays[lane] = scene.camera.getRay(x, y);
+                packet.setRay(lane, rays[lane].getOrigin(), rays[lane].getDirection());
+            }
 
-                    hitPoint = ray.getOrigin() + ray.getDirection() * t;
-                    normal = scene.normalData[f0.normalId].normalized();
+            RT_COUNT(primaryRays, __builtin_popcount(packet.active));
+            scene.bvh.intersectPacket(packet, hits);
 
-                    Vec2f uv = computeInterpolatedUV(scene, f0, f1, f2, beta, gamma);
-                    textureColor = getTextureColor(scene, uv);
-                    tFactor = mat.texturefactor;
-                    hitMaterial = &mat;
-                }
+            uint32_t hitLanes = 0;
+            for (uint32_t m = packet.active; m != 0; m &= m - 1)
+            {
+                if (hits[__builtin_ctz(m)].triIndex >= 0) hitLanes |= 1u << __builtin_ctz(m);
+            }
+            traceShadowPackets(scene, rays, hits, hitLanes, shadowed);
+
+            for (uint32_t m = packet.active; m != 0; m &= m - 1)
+            {
+                int lane = __builtin_ctz(m);
+                Vec3 rayColor = shadeHit(rays[lane], hits[lane], scene, scene.maxRayTraceDepth, shadowed + lane * slots,
+                                         traceDifferential ? &differential : nullptr);
+                image.setPixel(bx + lane % PACKET_WIDTH, by + lane / PACKET_WIDTH, Color(rayColor.x, rayColor.y, rayColor.z));
             }
         }
     }
+}
+
+// Returns the camera rays traced. heatmap, when given, records the cost of every pixel as well.
+long long renderTile(const Tile& tile, Image& image, const Scene& scene, const PixelSampler& sampler, CostHeatmap* heatmap)
+{
+    StatsSpan span("tile", &tile);
 
-    if (minT < 1e9)
+    // The footprint of the minimum sample count, samples an adaptive pixel adds narrow it further
+    RayDifferential differential;
+    bool traceDifferential = getCameraDifferential(scene, sampler.getMinSpp(), differential);
+
+    auto trace = [&](const Ray& ray)
     {
-        Color finalColor = computeAmbientComponent(ambientLight, *hitMaterial);
-        finalColor += computeLighting(scene, hitPoint, normal, *hitMaterial, ray);
+        RT_COUNT(primaryRays, 1);
+        return computeColorTriangle(ray, scene, scene.maxRayTraceDepth, traceDifferential ? &differential : nullptr);
+    };
 
-        Color baseColor = finalColor * (1.0f - tFactor) + textureColor * tFactor;
+    long long rays = 0;
+    for (int i = tile.y0; i < tile.y1; ++i)
+    {
+        for (int j = tile.x0; j < tile.x1; ++j)
+        {
+            CostHeatmap::Sample sample;
+            if (heatmap != nullptr) sample = CostHeatmap::begin();
 
-        Color reflectionComponent(0, 0, 0);
+            int sampleCount;
+            Vec3 rayColor = sampler.render(scene.camera, j, i, trace, sampleCount);
+            image.setPixel(j, i, Color(rayColor.x, rayColor.y, rayColor.z));
+            rays += sampleCount;
+
+            if (heatmap != nullptr) heatmap->end(j, i, sample);
+        }
+    }
+    return rays;
+}
 
-        if (depth > 0 && (hitMaterial->mirrorReflectance.x > 0 || hitMaterial->mirrorReflectance.y > 0 || hitMaterial->mirrorReflectance.z > 0))
+// Root mean square difference of the displayed (clamped) colours of two images
+double imageRMSE(const Image& a, const Image& b)
+{
+    double sum = 0.0;
+    for (int y = 0; y < a.getHeight(); ++y)
+    {
+        for (int x = 0; x < a.getWidth(); ++x)
         {
-            Vec3 normalAdjusted = normal;
-            if (ray.getDirection().dot(normalAdjusted) > 0)
+            const Color& p = a.getPixel(x, y);
+            const Color& q = b.getPixel(x, y);
+            float d[3] = { myClamp(p.getColorR(), 0.0f, 1.0f) - myClamp(q.getColorR(), 0.0f, 1.0f),
+                           myClamp(p.getColorG(), 0.0f, 1.0f) - myClamp(q.getColorG(), 0.0f, 1.0f),
+                           myClamp(p.getColorB(), 0.0f, 1.0f) - myClamp(q.getColorB(), 0.0f, 1.0f) };
+            sum += d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+        }
+    }
+    return std::sqrt(sum / (3.0 * a.getWidth() * a.getHeight()));
+}
+
+// Renders image with sampler on all workers, returns the seconds taken and the rays traced
+double renderSampled(const Scene& scene, Image& image, TileScheduler& scheduler, const PixelSampler& sampler, long long& rays)
+{
+    std::atomic<long long> traced(0);
+    auto start = std::chrono::high_resolution_clock::now();
+    scheduler.run([&](const Tile& tile, int)
+    {
+        traced += renderTile(tile, image, scene, sampler, nullptr);
+    });
+    rays = traced;
+    return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+// Adaptive sampling against uniform supersampling: uniform at maxSpp is the reference,
+// uniform at the adaptive average spp shows the error of spending the same rays evenly
+void compareSampling(const Scene& scene, const Image& adaptive, double adaptiveSeconds, long long adaptiveRays,
+                     TileScheduler& scheduler, const PixelSampler& sampler)
+{
+    int width = adaptive.getWidth(), height = adaptive.getHeight();
+    double pixels = static_cast<double>(width) * height;
+    int evenSpp = std::max(1, static_cast<int>(std::lround(adaptiveRays / pixels)));
+
+    // The statistics printed later are those of the adaptive render alone
+    Image reference(width, height), even(width, height);
+    long long referenceRays = 0, evenRays = 0;
+    RenderStats::setRecording(false);
+    double referenceSeconds = renderSampled(scene, reference, scheduler,
+        PixelSampler(sampler.getMaxSpp(), sampler.getMaxSpp()), referenceRays);
+    double evenSeconds = renderSampled(scene, even, scheduler, PixelSampler(evenSpp, evenSpp), evenRays);
+    RenderStats::setRecording(true);
+
+    std::string uniformMax = "uniform " + std::to_string(sampler.getMaxSpp());
+    std::string uniformEven = "uniform " + std::to_string(evenSpp);
+    std::string adaptiveName = "adaptive " + std::to_string(sampler.getMinSpp()) + "-" + std::to_string(sampler.getMaxSpp());
+
+    std::printf("%-16s %8s %9s %12s\n", "sampling", "spp", "seconds", "RMSE");
+    std::printf("%-16s %8.2f %9.3f %12s\n", uniformMax.c_str(), referenceRays / pixels, referenceSeconds, "reference");
+    std::printf("%-16s %8.2f %9.3f %12.5f\n", uniformEven.c_str(), evenRays / pixels, evenSeconds, imageRMSE(even, reference));
+    std::printf("%-16s %8.2f %9.3f %12.5f\n", adaptiveName.c_str(), adaptiveRays / pixels, adaptiveSeconds, imageRMSE(adaptive, reference));
+}
+
+// === Wavefront renderer ===
+// Instead of following one pixel through all of its bounces, every stage runs over a
+// whole queue of rays: intersect them all, trace the shadow rays of all hits, shade all
+// hits and queue the reflection rays of the next bounce, sorted by rayMortonKey so the
+// traversal of neighbouring rays touches the same nodes. The colours are combined bottom
+// up once the last bounce is done, which gives the same image as the recursive renderer.
+
+struct WavefrontStage
+{
+    long long rays = 0;
+    double seconds = 0.0;
+};
+
+struct WavefrontStats
+{
+    WavefrontStage camera, intersect, shadow, shade, sort;
+    int bounces = 0;
+};
+
+// Rays of one bounce, every array is indexed like rays
+struct Bounce
+{
+    std::vector<Ray> rays;
+    std::vector<int> parents;       // pixel for camera rays, otherwise the ray of the previous bounce
+    std::vector<Vec3> throughputs;  // product of the mirror reflectances above the ray
+    std::vector<HitRecord> hits;
+    std::vector<Color> baseColors;
+    std::vector<Vec3> mirrors;
+    std::vector<Ray> reflectedRays;
+    std::vector<RayDifferential> differentials;             // empty when textures are point sampled
+    std::vector<RayDifferential> reflectedDifferentials;
+    std::vector<int> children;      // reflection ray in the next bounce, -1 for none
+    std::vector<Vec3> colors;
+};
+
+template <typename F>
+void timeStage(WavefrontStage& stage, long long rays, F body)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    body();
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+    stage.rays += rays;
+    stage.seconds += elapsed.count();
+}
+
+void renderWavefront(const Scene& scene, Image& image, int threadCount, WavefrontStats& stats)
+{
+    const int BATCH_SIZE = 1 << 18; // camera rays per wavefront, bounds the queue memory
+    const int CHUNK_SIZE = 256;     // rays per parallelFor chunk
+
+    int width = image.getWidth();
+    int pixelCount = width * image.getHeight();
+    int slots = getShadowSlots(scene);
+    bool sampling = isSamplingLights(scene);
+    RayDifferential cameraDifferential;
+    bool traceDifferentials = getCameraDifferential(scene, 1, cameraDifferential);
+
+    for (int first = 0; first < pixelCount; first += BATCH_SIZE)
+    {
+        int batchSize = std::min(BATCH_SIZE, pixelCount - first);
+        std::vector<Bounce> bounces(1);
+
+        // 1. Camera rays
+        timeStage(stats.camera, batchSize, [&]()
+        {
+            Bounce& camera = bounces[0];
+            camera.rays.resize(batchSize);
+            camera.parents.resize(batchSize);
+            camera.throughputs.assign(batchSize, Vec3(1, 1, 1));
+            if (traceDifferentials)
+                camera.differentials.assign(batchSize, cameraDifferential);
+            TileScheduler::parallelFor(batchSize, CHUNK_SIZE, threadCount, [&](int begin, int end)
             {
-                normalAdjusted = Vec3(-normal.x, -normal.y, -normal.z);
+                StatsSpan span("camera");
+                for (int i = begin; i < end; ++i)
+                {
+                    int pixel = first + i;
+                    camera.rays[i] = scene.camera.getRay(pixel % width, pixel / width);
+                    camera.parents[i] = pixel;
+                }
+            });
+        });
+
+        for (int depth = scene.maxRayTraceDepth; ; --depth)
+        {
+            Bounce& bounce = bounces.back();
+            int count = static_cast<int>(bounce.rays.size());
+
+            // 2. Closest hits of the whole queue
+            timeStage(stats.intersect, count, [&]()
+            {
+                bounce.hits.assign(count, HitRecord());
+                TileScheduler::parallelFor(count, CHUNK_SIZE, threadCount, [&](int begin, int end)
+                {
+                    StatsSpan span("intersect");
+                    if (bounces.size() == 1)
+                        RT_COUNT(primaryRays, end - begin);
+                    else
+                        RT_COUNT(reflectionRays, end - begin);
+
+                    for (int i = begin; i < end; ++i)
+                        scene.bvh.intersect(bounce.rays[i], bounce.hits[i]);
+                });
+            });
+
+            // 3. Shadow rays, shadowed[i * slots + slot] like the packet renderer
+            std::vector<char> shadowFlags(static_cast<size_t>(count) * std::max(1, slots), 0);
+            bool* shadowed = reinterpret_cast<bool*>(shadowFlags.data());
+            std::atomic<long long> shadowRays(0);
+            auto shadowStart = std::chrono::high_resolution_clock::now();
+
+            TileScheduler::parallelFor(count, CHUNK_SIZE, threadCount, [&](int begin, int end)
+            {
+                StatsSpan span("shadow");
+                long long traced = 0;
+                for (int i = begin; i < end; ++i)
+                {
+                    if (bounce.hits[i].triIndex < 0) continue;
+
+                    Vec3 hitPoint, normal;
+                    Vec3 origin = getShadowOrigin(scene, bounce.rays[i], bounce.hits[i], hitPoint, normal);
+                    LightSample samples[LightTree::MAX_SAMPLES];
+                    int slotCount = sampling ? sampleLights(scene, hitPoint, normal, hashHit(scene, bounce.hits[i]), samples) : slots;
+                    for (int slot = 0; slot < slotCount; ++slot)
+                    {
+                        int lightIndex = sampling ? samples[slot].lightIndex : slot;
+                        if (scene.compiled.isAreaLight(lightIndex))
+                            continue;
+
+                        Vec3 lightDir;
+                        float lightDistance;
+                        getLightDirection(scene.compiled.pointLights, lightIndex, hitPoint, lightDir, lightDistance);
+
+                        shadowed[static_cast<size_t>(i) * slots + slot] =
+                            isInShadow(scene, origin, lightDir, lightDistance, lightIndex);
+                        traced++;
+                    }
+                }
+                shadowRays += traced;
+            });
+
+            std::chrono::duration<double> shadowTime = std::chrono::high_resolution_clock::now() - shadowStart;
+            stats.shadow.rays += shadowRays;
+            stats.shadow.seconds += shadowTime.count();
+
+            // 4. Local shading, mirror hits leave a reflection ray behind
+            timeStage(stats.shade, count, [&]()
+            {
+                bounce.baseColors.resize(count);
+                bounce.mirrors.resize(count);
+                bounce.reflectedRays.resize(count);
+                if (traceDifferentials)
+                    bounce.reflectedDifferentials.resize(count);
+                TileScheduler::parallelFor(count, CHUNK_SIZE, threadCount, [&](int begin, int end)
+                {
+                    StatsSpan span("shade");
+                    for (int i = begin; i < end; ++i)
+                    {
+                        shadeSurface(bounce.rays[i], bounce.hits[i], scene, depth,
+                            shadowed + static_cast<size_t>(i) * slots,
+                            bounce.baseColors[i], bounce.mirrors[i], bounce.reflectedRays[i],
+                            traceDifferentials ? &bounce.differentials[i] : nullptr,
+                            traceDifferentials ? &bounce.reflectedDifferentials[i] : nullptr);
+                    }
+                });
+            });
+
+            // 5. Queue of the next bounce, sorted so neighbouring rays stay coherent.
+            //    Reflections whose throughput is too low end here, like in shadeHit.
+            Bounce next;
+            {
+                StatsSpan span("queue");
+                for (int i = 0; i < count; ++i)
+                {
+                    Vec3& mirror = bounce.mirrors[i];
+                    if (mirror.x <= 0 && mirror.y <= 0 && mirror.z <= 0) continue;
+
+                    const Vec3& above = bounce.throughputs[i];
+                    Vec3 throughput(above.x * mirror.x, above.y * mirror.y, above.z * mirror.z);
+                    float weight;
+                    if (!continueReflection(throughput, hashHit(scene, bounce.hits[i]), weight))
+                    {
+                        RT_COUNT(reflectionsCut, 1);
+                        continue;
+                    }
+
+                    mirror = mirror * weight;
+                    next.rays.push_back(bounce.reflectedRays[i]);
+                    next.parents.push_back(i);
+                    next.throughputs.push_back(throughput * weight);
+                    if (traceDifferentials)
+                        next.differentials.push_back(bounce.reflectedDifferentials[i]);
+                }
             }
+            bounce.reflectedRays = std::vector<Ray>();
+            bounce.differentials = std::vector<RayDifferential>();
+            bounce.reflectedDifferentials = std::vector<RayDifferential>();
+            bounce.children.assign(count, -1);
+
+            if (next.rays.empty())
+                break;
+
+            timeStage(stats.sort, static_cast<long long>(next.rays.size()), [&]()
+            {
+                std::vector<int> order = sortRaysByMorton(next.rays);
+                Bounce sorted;
+                sorted.rays.reserve(order.size());
+                sorted.parents.reserve(order.size());
+                sorted.throughputs.reserve(order.size());
+                for (int index : order)
+                {
+                    bounce.children[next.parents[index]] = static_cast<int>(sorted.rays.size());
+                    sorted.rays.push_back(next.rays[index]);
+                    sorted.parents.push_back(next.parents[index]);
+                    sorted.throughputs.push_back(next.throughputs[index]);
+                    if (traceDifferentials)
+                        sorted.differentials.push_back(next.differentials[index]);
+                }
+                next = std::move(sorted);
+            });
 
-            Vec3 wo = ray.getDirection() * -1.0f;
-            float dotProduct = normalAdjusted.dot(wo);
-
-            Vec3 reflectDir = Vec3(
-                -wo.x + 2.0f * normalAdjusted.x * dotProduct,
-                -wo.y + 2.0f * normalAdjusted.y * dotProduct,
-                -wo.z + 2.0f * normalAdjusted.z * dotProduct
-            );
-
-            Ray reflectedRay(
-                Vec3(
-                    hitPoint.x + normalAdjusted.x * 0.001f,
-                    hitPoint.y + normalAdjusted.y * 0.001f,
-                    hitPoint.z + normalAdjusted.z * 0.001f
-                ),
-                reflectDir.normalized()
-            );
-
-            Vec3 reflectedColor = computeColorTriangle(reflectedRay, scene, depth - 1);
-
-            reflectionComponent = Color(
-                reflectedColor.x * hitMaterial->mirrorReflectance.x,
-                reflectedColor.y * hitMaterial->mirrorReflectance.y,
-                reflectedColor.z * hitMaterial->mirrorReflectance.z
-            );
+            bounces.push_back(std::move(next));
+            stats.bounces = std::max(stats.bounces, static_cast<int>(bounces.size()) - 1);
         }
 
-        Color finalCombined = baseColor + reflectionComponent;
+        // 6. Colours from the deepest bounce up to the camera rays
+        for (int level = static_cast<int>(bounces.size()) - 1; level >= 0; --level)
+        {
+            Bounce& bounce = bounces[level];
+            int count = static_cast<int>(bounce.rays.size());
+            bounce.colors.resize(count);
+            for (int i = 0; i < count; ++i)
+            {
+                if (bounce.hits[i].triIndex < 0)
+                {
+                    bounce.colors[i] = getBackgroundColor(scene);
+                    continue;
+                }
 
-        resultColor = Color(
-            myClamp(finalCombined.getColorR(), 0.0f, 1.0f),
-            myClamp(finalCombined.getColorG(), 0.0f, 1.0f),
-            myClamp(finalCombined.getColorB(), 0.0f, 1.0f)
-        );
+                Vec3 reflectedColor(0, 0, 0);
+                if (bounce.children[i] >= 0)
+                    reflectedColor = bounces[level + 1].colors[bounce.children[i]];
+                bounce.colors[i] = combineReflection(bounce.baseColors[i], bounce.mirrors[i], reflectedColor);
+            }
+        }
+
+        const Bounce& camera = bounces[0];
+        for (int i = 0; i < batchSize; ++i)
+        {
+            const Vec3& c = camera.colors[i];
+            image.setPixel(camera.parents[i] % width, camera.parents[i] / width, Color(c.x, c.y, c.z));
+        }
     }
+}
 
-    return Vec3(resultColor.getColorR(), resultColor.getColorG(), resultColor.getColorB());
+void printWavefrontStats(const WavefrontStats& stats)
+{
+    auto printStage = [](const char* name, const WavefrontStage& stage)
+    {
+        std::cout << "  " << name << ": " << stage.rays << " rays, " << stage.seconds << " seconds, "
+                  << (stage.seconds > 0 ? stage.rays / stage.seconds / 1e6 : 0.0) << " Mrays/s" << std::endl;
+    };
+
+    std::cout << "Wavefront stages (" << stats.bounces << " reflection bounces):" << std::endl;
+    printStage("camera   ", stats.camera);
+    printStage("intersect", stats.intersect);
+    printStage("shadow   ", stats.shadow);
+    printStage("shade    ", stats.shade);
+    printStage("sort     ", stats.sort);
 }
 
+// === Progressive renderer ===
+// The first pass traces one ray per PROGRESSIVE_BLOCK x PROGRESSIVE_BLOCK block and fills
+// the block with its colour. Every further pass halves the block size and traces only the
+// pixels the coarser passes skipped, so after the 1x1 pass the image is the one renderTile
+// gives. Once the time budget runs out the current pass skips its remaining tiles, which
+// keep the coarser colours; the first pass always completes so the image has no holes.
+
+const int PROGRESSIVE_BLOCK = 8;
+
+struct ProgressivePass
+{
+    int blockSize = 0;
+    long long rays = 0;
+    double seconds = 0.0;
+    double meanChange = 0.0;    // mean colour change of the traced pixels, 0 for the first pass
+    bool complete = true;
+};
+
+// Traces the pixels of one pass inside tile, returns the summed colour change
+double renderTileProgressive(const Tile& tile, Image& image, const Scene& scene, int blockSize, bool firstPass, long long& rays)
+{
+    StatsSpan span("progressive", &tile);
+    RayDifferential differential;
+    bool traceDifferential = getCameraDifferential(scene, 1, differential);
+
+    int width = image.getWidth(), height = image.getHeight();
+    int yFirst = (tile.y0 + blockSize - 1) / blockSize * blockSize;
+    int xFirst = (tile.x0 + blockSize - 1) / blockSize * blockSize;
+    double change = 0.0;
 
-void renderRow(int startRow, int endRow, Image& image, const Scene& scene)
+    for (int i = yFirst; i < tile.y1; i += blockSize)
     {
-        int width = image.getWidth();
-        for (int i = startRow; i < endRow; ++i)
+        for (int j = xFirst; j < tile.x1; j += blockSize)
         {
-            for (int j = 0; j < width; ++j)
+            // The coarser passes traced every other pixel of this grid
+            if (!firstPass && i % (2 * blockSize) == 0 && j % (2 * blockSize) == 0) continue;
+
+            RT_COUNT(primaryRays, 1);
+            Ray ray = scene.camera.getRay(j, i);
+            Vec3 rayColor = computeColorTriangle(ray, scene, scene.maxRayTraceDepth, traceDifferential ? &differential : nullptr);
+            rays++;
+
+            if (!firstPass)
             {
-                Ray ray = scene.camera.getRay(j, i);
-                Vec3 rayColor = computeColorTriangle(ray, scene, scene.maxRayTraceDepth);
-                image.setPixel(j, i, Color(rayColor.x, rayColor.y, rayColor.z));
+                const Color& old = image.getPixel(j, i);
+                change += (std::fabs(rayColor.x - old.getColorR()) + std::fabs(rayColor.y - old.getColorG())
+                         + std::fabs(rayColor.z - old.getColorB())) / 3.0;
+            }
+
+            Color color(rayColor.x, rayColor.y, rayColor.z);
+            int yEnd = std::min(i + blockSize, height), xEnd = std::min(j + blockSize, width);
+            for (int y = i; y < yEnd; ++y)
+            {
+                for (int x = j; x < xEnd; ++x)
+                {
+                    image.setPixel(x, y, color);
+                }
             }
         }
     }
+    return change;
+}
 
-int main()
+// output.ppm -> output.pass2.ppm
+string getSnapshotName(const string& fileName, int pass)
 {
-    int width = 2000;
-    int height = 2000;
-    int i, j;
-    
-    Scene scene = XMLParser::parseScene("scene.xml");
-    string fileName = "output.ppm";
+    size_t dot = fileName.find_last_of('.');
+    size_t slash = fileName.find_last_of('/');
+    string suffix = ".pass" + std::to_string(pass);
+    if (dot == string::npos || (slash != string::npos && dot < slash))
+        return fileName + suffix;
+    return fileName.substr(0, dot) + suffix + fileName.substr(dot);
+}
 
-    Image image(scene.camera.getNx(), scene.camera.getNy());
-    ImageWriter imageWriter;
+std::vector<ProgressivePass> renderProgressive(const Scene& scene, Image& image, TileScheduler& scheduler,
+                                               const RenderOptions& options, ImageWriter& imageWriter)
+{
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(options.progressiveSeconds));
+    int threadCount = scheduler.getThreadCount();
+    std::vector<ProgressivePass> passes;
 
-    int originalChannels = 0;
-    textureData.data = stbi_load(scene.textureImageName.c_str(),
-                                &textureData.width,
-                                &textureData.height,
-                                &originalChannels,
-                                3);  // 3 kanal
+    for (int blockSize = PROGRESSIVE_BLOCK; blockSize >= 1; blockSize /= 2)
+    {
+        bool firstPass = passes.empty();
+        std::vector<double> change(threadCount, 0.0);
+        std::vector<long long> rays(threadCount, 0);
+        std::atomic<bool> skipped(false);
+        auto passStart = std::chrono::steady_clock::now();
+
+        // 1. Trace the pass, every worker sums into its own slot
+        scheduler.run([&](const Tile& tile, int worker)
+        {
+            if (!firstPass && std::chrono::steady_clock::now() >= deadline)
+            {
+                skipped = true;
+                return;
+            }
+            change[worker] += renderTileProgressive(tile, image, scene, blockSize, firstPass, rays[worker]);
+        });
+
+        // 2. Totals of the pass
+        ProgressivePass pass;
+        pass.blockSize = blockSize;
+        pass.complete = !skipped;
+        double changeSum = 0.0;
+        for (int w = 0; w < threadCount; ++w)
+        {
+            pass.rays += rays[w];
+            changeSum += change[w];
+        }
+        pass.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - passStart).count();
+        pass.meanChange = (!firstPass && pass.rays > 0) ? changeSum / pass.rays : 0.0;
+        passes.push_back(pass);
+
+        std::cout << "Pass " << passes.size() << " (" << blockSize << "x" << blockSize << " blocks): " << pass.rays << " rays, "
+                  << pass.seconds << " seconds" << (firstPass ? "" : ", mean change " + std::to_string(pass.meanChange))
+                  << (pass.complete ? "" : ", stopped by the time budget") << std::endl;
+
+        if (options.progressiveSnapshots)
+        {
+            string snapshot = getSnapshotName(options.outputFile, static_cast<int>(passes.size()));
+            imageWriter.writePPMBinary(snapshot.c_str(), image, threadCount);
+        }
+
+        // 3. Stop on the budget or once a pass hardly changes the image
+        if (!pass.complete || std::chrono::steady_clock::now() >= deadline)
+            break;
+        if (!firstPass && options.convergence > 0 && pass.meanChange < options.convergence)
+        {
+            std::cout << "Converged: mean change below " << options.convergence << std::endl;
+            break;
+        }
+    }
+    return passes;
+}
 
-    textureData.channels = 3;
-    if (textureData.data == nullptr)
+int main(int argc, char* argv[])
+{
+    RenderOptions options = RenderOptions::parse(argc, argv);
+
+    string fileName = options.outputFile;
+
+    // A binary cache next to the XML skips parsing and the BVH build when the XML is unchanged.
+    // Out of core, the geometry comes from a chunk file instead and only the settings from the cache.
+    Scene scene;
+    ChunkCache chunks;
+    bool outOfCore = options.outOfCoreMB > 0;
+    string cacheFile = SceneCache::getCachePath(options.sceneFile);
+    string chunkFile = ChunkCache::getChunkPath(options.sceneFile);
+    size_t chunkBudget = static_cast<size_t>(options.outOfCoreMB) << 20;
+    uint64_t sceneHash = 0;
+    bool hashed = (options.sceneCache || outOfCore) && SceneCache::hashFile(options.sceneFile, sceneHash);
+    bool useCache = options.sceneCache && hashed;
+    bool sceneCached = false, bvhCached = false;
+
+    auto loadStart = std::chrono::high_resolution_clock::now();
+    if (outOfCore && hashed)
+        chunks.open(chunkFile, sceneHash, chunkBudget);
+    if (useCache)
+        sceneCached = SceneCache::load(cacheFile, sceneHash, options.bvhBuilder, options.resolveThreadCount(), scene, bvhCached, !chunks.isOpen());
+    if (!sceneCached)
+        scene = XMLParser::parseScene(options.sceneFile, options.resolveThreadCount());
+    std::chrono::duration<double> loadTime = std::chrono::high_resolution_clock::now() - loadStart;
+    std::cout << "Scene " << (sceneCached ? "loaded from " + cacheFile : "parsed") << " in " << loadTime.count() << " seconds" << std::endl;
+
+    // Build the acceleration structure once, before any ray is traced
+    if (!bvhCached && !chunks.isOpen())
     {
-        std::cerr << "Texture loading failed!" << std::endl;
-        exit(1);
+        auto bvhStart = std::chrono::high_resolution_clock::now();
+        scene.bvh.build(scene, options.bvhBuilder, options.resolveThreadCount());
+        std::chrono::duration<double> bvhTime = std::chrono::high_resolution_clock::now() - bvhStart;
+        std::cout << getBVHBuilderName(options.bvhBuilder) << " BVH built: " << scene.bvh.getTriangleCount() << " triangles, "
+                  << scene.bvh.getNodeCount() << " nodes in " << bvhTime.count() << " seconds" << std::endl;
+
+        if (useCache && SceneCache::save(cacheFile, sceneHash, options.bvhBuilder, scene))
+            std::cout << "Scene cache written: " << cacheFile << std::endl;
+    }
+    else if (chunks.isOpen() && useCache && !sceneCached)
+    {
+        // The chunks hold the geometry, but the settings still come from the scene cache:
+        // write it without a BVH so the next run skips parsing too
+        if (SceneCache::save(cacheFile, sceneHash, options.bvhBuilder, scene))
+            std::cout << "Scene cache written: " << cacheFile << std::endl;
     }
 
-    // Fill the image with a black color
-    for(i = 0; i < height; i++)
+    if (outOfCore)
     {
-        for(j = 0; j < width; j++)
+        // Cut the resident scene into chunks once, then drop its geometry and BVH
+        if (!chunks.isOpen())
         {
-            image.setPixel(i, j, scene.backgroundColor);
+            if (!hashed || !ChunkCache::write(chunkFile, sceneHash, scene, ChunkCache::DEFAULT_CHUNK_TRIANGLES, options.resolveThreadCount()) ||
+                !chunks.open(chunkFile, sceneHash, chunkBudget))
+            {
+                std::cerr << "Failed to create chunk file: " << chunkFile << std::endl;
+                exit(1);
+            }
+            std::cout << "Chunk file written: " << chunkFile << std::endl;
         }
+
+        scene.bvh = BVH();
+        std::vector<Mesh>().swap(scene.objects.meshes);
+        std::vector<Vec3>().swap(scene.vertexData);
+        std::vector<Vec3>().swap(scene.normalData);
+        std::vector<Vec2f>().swap(scene.textureData);
+        scene.chunks = &chunks;
+        std::cout << "Out of core: " << chunks.getTriangleCount() << " triangles in " << chunks.getChunkCount()
+                  << " chunks, cache budget " << options.outOfCoreMB << " MB" << std::endl;
+    }
+    chunks.setSimdLevel(options.simdLevel);
+    scene.bvh.setSimdLevel(options.simdLevel);
+    std::cout << scene.bvh.getKernel().name << " triangle kernel" << std::endl;
+
+    size_t binaryBytes = scene.bvh.getNodeMemoryBytes();
+    if (options.wideBVH && scene.bvh.buildWide(options.packets))
+    {
+        std::cout << "BVH8: " << scene.bvh.getWideNodeCount() << " nodes, " << scene.bvh.getNodeMemoryBytes() / 1024
+                  << " KB of nodes (binary: " << binaryBytes / 1024 << " KB)" << std::endl;
     }
 
-    int threadCount = std::thread::hardware_concurrency();
-    vector<std::thread> threads;
+    Image image(scene.camera.getNx(), scene.camera.getNy());
+    ImageWriter imageWriter;
+
+    // Every material samples its own image or the scene's, each file is loaded once
+    TextureCache textures;
+    for (Material& mat : scene.materials)
+    {
+        mat.textureId = textures.add(mat.textureImageName.empty() ? scene.textureImageName : mat.textureImageName);
+    }
 
-    int rowsPerThread = height / threadCount;
+    auto textureStart = std::chrono::high_resolution_clock::now();
+    string textureFile = TextureCache::getTexturePath(options.sceneFile);
+    size_t textureBudget = static_cast<size_t>(options.textureCacheMB) << 20;
+    string failedTexture;
+    bool texturesLoaded = options.textureCacheMB > 0
+        ? textures.open(textureFile, textureBudget, options.sceneCache, options.resolveThreadCount(), failedTexture)
+        : textures.load(options.resolveThreadCount(), failedTexture);
+    if (!texturesLoaded)
+    {
+        std::cerr << "Texture loading failed: " << failedTexture << std::endl;
+        exit(1);
+    }
+    scene.textures = &textures;
+    std::chrono::duration<double> textureTime = std::chrono::high_resolution_clock::now() - textureStart;
+    textureFilter = options.textureFilter;
+    std::cout << "Textures: " << textures.getTextureCount() << " (" << textures.getTotalBytes() / 1024 << " KB tiled"
+              << (options.textureCacheMB > 0 ? ", mapped from " + textureFile : "") << ", "
+              << getTextureFilterName(textureFilter) << ") in " << textureTime.count() << " seconds" << std::endl;
+
+    // Tiles are handed out dynamically, so threads that finish the empty background
+    // tiles early help with the expensive ones instead of idling
+    TileScheduler scheduler(image.getWidth(), image.getHeight(), options.tileSize, options.resolveThreadCount());
+
+    reflectionSettings.minThroughput = options.minThroughput;
+    reflectionSettings.roulette = options.roulette;
+
+    // Lights by type and materials with their flags, then the light tree over them. Lights
+    // are few enough to shade every one unless --light-samples asks for fewer.
+    auto lightStart = std::chrono::high_resolution_clock::now();
+    scene.compiled.build(scene);
+    scene.lightTree.build(scene.compiled);
+
+    // One shading kernel per material, specialised for what the material uses
+    materialKernels.clear();
+    unsigned kernelsUsed = 0;
+    for (const ShadingMaterial& mat : scene.compiled.materials)
+    {
+        materialKernels.push_back(options.genericShading ? shadeMaterial<GENERIC_KERNEL> : MATERIAL_KERNELS[mat.flags]);
+        kernelsUsed |= 1u << mat.flags;
+    }
+    std::cout << "Shading: " << scene.compiled.materials.size() << " materials, "
+              << (options.genericShading ? "generic kernel" : std::to_string(__builtin_popcount(kernelsUsed)) + " specialised kernels")
+              << std::endl;
+    lightSamples = options.lightSamples;
+    areaLightSettings.samples = options.areaSamples;
+    areaLightSettings.coarseSamples = options.areaCoarseSamples;
+    if (isSamplingLights(scene))
+    {
+        std::chrono::duration<double> lightTime = std::chrono::high_resolution_clock::now() - lightStart;
+        std::cout << "Light tree: " << scene.lightTree.getLightCount() << " lights, " << scene.lightTree.getNodes().size()
+                  << " nodes in " << lightTime.count() << " seconds, " << lightSamples << " sampled per hit" << std::endl;
+    }
+
+    RenderStats::reset(scheduler.getThreadCount(), options.traceFile);
     auto start = std::chrono::high_resolution_clock::now();
-    //number of thread
-    std::cout << "Number of threads: " << threadCount << std::endl;
-    for (int t = 0; t < threadCount; ++t)
+    std::cout << "Number of threads: " << scheduler.getThreadCount()
+              << ", tiles: " << scheduler.getTileCount() << " (" << options.tileSize << "x" << options.tileSize << ")" << std::endl;
+
+    // Streaming output writes every row of tiles as soon as its last tile is done
+    StreamingPPMWriter stream;
+    if (options.streamOutput && !stream.open(fileName.c_str(), image.getWidth(), image.getHeight(), options.tileSize))
     {
-        int startRow = t * rowsPerThread;
-        int endRow = (t == threadCount - 1) ? height : (t + 1) * rowsPerThread;
+        exit(1);
+    }
 
-        threads.emplace_back(renderRow, startRow, endRow, std::ref(image), std::cref(scene));
+    // The heatmap replaces the shaded colours once the whole image is done
+    std::unique_ptr<CostHeatmap> heatmap;
+    if (options.heatmap != HEATMAP_NONE)
+        heatmap.reset(new CostHeatmap(image.getWidth(), image.getHeight(), options.heatmap));
+
+    WavefrontStats wavefrontStats;
+    if (options.wavefront)
+    {
+        renderWavefront(scene, image, scheduler.getThreadCount(), wavefrontStats);
     }
+    else if (options.progressiveSeconds > 0)
+    {
+        std::vector<ProgressivePass> passes = renderProgressive(scene, image, scheduler, options, imageWriter);
+        bool finished = passes.back().blockSize == 1 && passes.back().complete;
+        std::cout << "Progressive: " << passes.size() << " passes, "
+                  << (finished ? "full resolution" : "stopped at " + std::to_string(passes.back().blockSize) + "x" +
+                                 std::to_string(passes.back().blockSize) + " blocks") << std::endl;
+    }
+    else
+    {
+        PixelSampler sampler(options.minSpp, options.maxSpp, options.sampleThreshold);
+        std::atomic<long long> cameraRays(0);
+        auto renderStart = std::chrono::high_resolution_clock::now();
 
-    // Thread'lerin bitmesini bekle
-    for (auto& th : threads)
+        scheduler.run([&](const Tile& tile, int)
+        {
+            if (options.packets)
+                renderTilePackets(tile, image, scene);
+            else
+                cameraRays += renderTile(tile, image, scene, sampler, heatmap.get());
+            if (options.streamOutput)
+                stream.tileFinished(image, tile.x0, tile.y0, tile.x1, tile.y1);
+        });
+
+        std::cout << "Tiles stolen: " << scheduler.getStealCount() << std::endl;
+
+        if (!sampler.isCentreOnly())
+        {
+            double renderSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - renderStart).count();
+            std::cout << "Samples per pixel: " << static_cast<double>(cameraRays) / (static_cast<double>(image.getWidth()) * image.getHeight())
+                      << " (" << sampler.getMinSpp() << " to " << sampler.getMaxSpp() << ")" << std::endl;
+            if (options.compareSampling)
+                compareSampling(scene, image, renderSeconds, cameraRays, scheduler, sampler);
+        }
+    }
+
+    if (heatmap)
     {
-        th.join();
+        double white = heatmap->toImage(image);
+        std::cout << "Heatmap of " << getHeatmapMetricName(options.heatmap) << " per pixel: mean " << heatmap->getMean()
+                  << ", max " << heatmap->getMax() << ", white at " << white << std::endl;
     }
 
-    imageWriter.writePPM(fileName.c_str(), image); // convert string to const char*
+    if (options.streamOutput)
+    {
+        if (!stream.close()) exit(1);
+        std::cout << "PPM is written: " << fileName << " (" << stream.getBandsWritten() << " bands streamed)" << std::endl;
+    }
+    else if (options.asciiOutput)
+        imageWriter.writePPM(fileName.c_str(), image); // convert string to const char*
+    else
+        imageWriter.writePPMBinary(fileName.c_str(), image, scheduler.getThreadCount());
 
     std::cout << "Image written to " << fileName << std::endl;
     auto end = std::chrono::high_resolution_clock::now();
     std::chrono::duration<double> duration = end - start;
     std::cout << "Render time: " << duration.count() << " seconds" << std::endl;
+
+    if (options.wavefront)
+        printWavefrontStats(wavefrontStats);
+
+#if RT_STATS
+    ThreadStats total = RenderStats::getTotal();
+    std::cout << "BVH nodes visited per ray: " << (total.bvhQueries > 0 ? static_cast<double>(total.nodeVisits) / total.bvhQueries : 0.0)
+              << " (" << total.bvhQueries << " rays)" << std::endl;
+#else
+    std::cout << "Render statistics are compiled out (RT_NO_STATS)" << std::endl;
+#endif
+
+    if (outOfCore)
+    {
+        ChunkCacheStats chunkStats = chunks.getStats();
+        std::cout << "Chunk ";
+#if RT_STATS
+        std::cout << "lookups: " << total.chunkLookups << ", ";
+#endif
+        std::cout << "page-ins: " << chunkStats.pageIns
+                  << ", evictions: " << chunkStats.evictions << ", resident: " << chunkStats.residentChunks << " chunks, "
+                  << chunkStats.residentBytes / 1024 << " KB (peak " << chunkStats.peakResidentBytes / 1024 << " KB)" << std::endl;
+    }
+
+    if (options.textureCacheMB > 0)
+    {
+        TextureCacheStats textureStats = textures.getStats();
+        std::cout << "Texture ";
+#if RT_STATS
+        std::cout << "lookups: " << total.textureLookups << ", ";
+#endif
+        std::cout << "page-ins: " << textureStats.pageIns
+                  << ", evictions: " << textureStats.evictions << ", resident: " << textureStats.residentBlocks << " blocks, "
+                  << textureStats.residentBytes / 1024 << " KB (peak " << textureStats.peakResidentBytes / 1024 << " KB)" << std::endl;
+    }
+
+#if RT_STATS
+    std::cout << "Reflection rays: " << total.reflectionRays << ", cut by throughput: " << total.reflectionsCut << std::endl;
+    std::cout << "Shadow rays: " << total.shadowRays << ", occluded: " << total.shadowOccluded
+              << ", occluder cache hits: " << total.occluderCacheHits << " ("
+              << (total.shadowOccluded > 0 ? 100.0 * total.occluderCacheHits / total.shadowOccluded : 0.0) << "% of occluded)" << std::endl;
+    if (total.areaLightHits > 0)
+    {
+        std::cout << "Area lights: " << total.areaLightHits << " evaluations, "
+                  << static_cast<double>(total.areaLightRays) / total.areaLightHits << " shadow rays each, "
+                  << 100.0 * total.penumbraHits / total.areaLightHits << "% in penumbra" << std::endl;
+    }
+#endif
+
+    if (options.workerStats)
+        RenderStats::printWorkers();
+
+    if (!options.traceFile.empty() && RenderStats::writeTrace())
+        std::cout << "Trace written: " << options.traceFile << std::endl;
     return 0;
 }
\ No newline at end of file